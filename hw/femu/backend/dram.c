@@ -1,17 +1,51 @@
 #include "../nvme.h"
 
+#ifdef CONFIG_NUMA
+#include <numaif.h>
+#endif
+
 /* Coperd: FEMU Memory Backend (mbe) for emulated SSD */
 
-int init_dram_backend(SsdDramBackend **mbe, int64_t nbytes)
+#ifdef CONFIG_NUMA
+/* Bind the space to @node before anything faults it in */
+static void *dram_alloc_on_node(int64_t nbytes, int node)
+{
+    unsigned long nodemask[(node / 64) + 1];
+    void *p = qemu_memalign(qemu_real_host_page_size(), nbytes);
+
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / 64] = 1UL << (node % 64);
+    if (mbind(p, nbytes, MPOL_BIND, nodemask, node + 2, MPOL_MF_STRICT)) {
+        femu_err("Failed to bind the memory backend to NUMA node %d\n", node);
+    }
+    memset(p, 0, nbytes);
+
+    return p;
+}
+#endif
+
+int init_dram_backend(SsdDramBackend **mbe, int64_t nbytes, int node)
 {
     SsdDramBackend *b = *mbe = g_malloc0(sizeof(SsdDramBackend));
 
     b->size = nbytes;
-    b->logical_space = g_malloc0(nbytes);
+    b->node = -1;
+#ifdef CONFIG_NUMA
+    if (node >= 0) {
+        b->logical_space = dram_alloc_on_node(nbytes, node);
+        b->node = node;
+    }
+#else
+    if (node >= 0) {
+        femu_err("numa_node ignored, QEMU was built without NUMA support\n");
+    }
+#endif
+    if (!b->logical_space) {
+        b->logical_space = g_malloc0(nbytes);
+    }
 
     if (mlock(b->logical_space, nbytes) == -1) {
         femu_err("Failed to pin the memory backend to the host DRAM\n");
-        g_free(b->logical_space);
         abort();
     }
 
@@ -22,7 +56,37 @@ void free_dram_backend(SsdDramBackend *b)
 {
     if (b->logical_space) {
         munlock(b->logical_space, b->size);
-        g_free(b->logical_space);
+        if (b->node >= 0) {
+            qemu_vfree(b->logical_space);
+        } else {
+            g_free(b->logical_space);
+        }
+    }
+}
+
+/*
+ * Zero [off, off + len) by handing its pages back to the kernel, which faults
+ * them in zeroed on the next touch, rather than memset()ing up to a whole
+ * namespace. The dropped pages are no longer mlock()ed.
+ */
+void backend_discard(SsdDramBackend *b, uint64_t off, uint64_t len)
+{
+    uintptr_t pgsz = qemu_real_host_page_size();
+    uint8_t *start = (uint8_t *)b->logical_space + off;
+    uint8_t *end = start + len;
+    uint8_t *pstart = QEMU_ALIGN_PTR_UP(start, pgsz);
+    uint8_t *pend = QEMU_ALIGN_PTR_DOWN(end, pgsz);
+
+    if (pstart >= pend) {
+        memset(start, 0, len);
+        return;
+    }
+
+    memset(start, 0, pstart - start);
+    memset(pend, 0, end - pend);
+    munlock(pstart, pend - pstart);
+    if (madvise(pstart, pend - pstart, MADV_DONTNEED)) {
+        memset(pstart, 0, pend - pstart);
     }
 }
 
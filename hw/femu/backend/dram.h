@@ -8,11 +8,14 @@ typedef struct SsdDramBackend {
     void    *logical_space;
     int64_t size; /* in bytes */
     int     femu_mode;
+    /* host NUMA node the space is bound to, -1 if none */
+    int     node;
 } SsdDramBackend;
 
-int init_dram_backend(SsdDramBackend **mbe, int64_t nbytes);
+int init_dram_backend(SsdDramBackend **mbe, int64_t nbytes, int node);
 void free_dram_backend(SsdDramBackend *);
 
 int backend_rw(SsdDramBackend *, QEMUSGList *, uint64_t *, bool);
+void backend_discard(SsdDramBackend *b, uint64_t off, uint64_t len);
 
 #endif
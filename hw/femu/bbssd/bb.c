@@ -1,145 +1,10 @@
 #include "../nvme.h"
 #include "./ftl.h"
 
-/* FDP: Initialize a Reclaim Unit */
-static void fdp_init_ru(struct ssd *ssd, fdp_ru_t *ru, uint16_t ruid, 
-                        uint16_t rgid, uint8_t ruhid)
-{
-    struct ssdparams *spp = &ssd->sp;
-    
-    ru->ruid = ruid;
-    ru->rgid = rgid;
-    ru->ruhid = ruhid;
-    ru->state = NVME_FDP_RUH_UNUSED;
-    ru->curline = NULL;
-    ru->bytes_written = 0;
-    ru->ru_open_time = 0;
-    
-    /* Each RU gets a fraction of total capacity */
-    /* For Phase 1, we'll use simple equal division */
-    ru->capacity = (uint64_t)spp->tt_pgs * spp->secsz * spp->secs_per_pg / FDP_DEFAULT_RUHS;
-    
-    /* Initialize write pointer */
-    ru->wp.curline = NULL;
-    ru->wp.ch = 0;
-    ru->wp.lun = 0;
-    ru->wp.pg = 0;
-    ru->wp.blk = 0;
-    ru->wp.pl = 0;
-    
-    /* Initialize free line list for this RU */
-    QTAILQ_INIT(&ru->free_line_list);
-    ru->free_line_cnt = 0;
-}
-
-/* FDP: Initialize configuration */
-static void fdp_init_config(struct ssd *ssd)
-{
-    fdp_config_t *cfg = &ssd->fdp_cfg;
-    
-    /* Phase 1: Disable FDP by default until fully implemented */
-    cfg->enabled = false;
-    cfg->nrg = 1;  /* Single Reclaim Group for Phase 1 */
-    cfg->nruh = FDP_DEFAULT_RUHS;  /* 4 RU Handles */
-    cfg->fdpa = 0x1;  /* FDP enabled, RUH type is initially specified */
-    
-    /* Allocate Reclaim Groups */
-    cfg->rgs = g_malloc0(sizeof(fdp_rg_t) * cfg->nrg);
-    
-    /* Initialize the single Reclaim Group */
-    fdp_rg_t *rg = &cfg->rgs[0];
-    rg->rgid = 0;
-    rg->nruh = cfg->nruh;
-    rg->rgslbs = ssd->sp.tt_pgs;  /* Total logical blocks */
-    
-    /* Allocate and initialize Reclaim Units */
-    rg->rus = g_malloc0(sizeof(fdp_ru_t) * rg->nruh);
-    for (int i = 0; i < rg->nruh; i++) {
-        fdp_init_ru(ssd, &rg->rus[i], i, rg->rgid, i);
-    }
-    
-    /* Initialize PH to RUHID mapping (1:1 for Phase 1) */
-    for (int i = 0; i < FDP_MAX_PLACEMENT_HANDLES; i++) {
-        if (i < cfg->nruh) {
-            cfg->ph_to_ruhid[i] = i;  /* Direct mapping */
-        } else {
-            cfg->ph_to_ruhid[i] = 0;  /* Default to RU 0 */
-        }
-    }
-    
-    /* Initialize statistics */
-    cfg->total_host_writes = 0;
-    cfg->total_media_writes = 0;
-    cfg->ru_switches = 0;
-    
-    femu_log("[FDP] Initialized: %d RG(s), %d RUH(s) per RG\n", cfg->nrg, cfg->nruh);
-}
-
-/* FDP: Distribute lines among RUs and initialize write pointers */
-static void fdp_distribute_lines(struct ssd *ssd)
-{
-    fdp_config_t *cfg = &ssd->fdp_cfg;
-    struct line_mgmt *lm = &ssd->lm;
-    
-    if (!cfg->enabled) {
-        return;  /* Skip if FDP not enabled */
-    }
-    
-    /* Use actual free line count (may be less than tt_lines if global WP already used some) */
-    int total_lines = lm->free_line_cnt;
-    int lines_per_ru = total_lines / cfg->nruh;
-    int remaining_lines = total_lines % cfg->nruh;
-    
-    ftl_log("[FDP] Distributing %d lines among %d RUs (%d lines/RU, %d get +1)\n",
-            total_lines, cfg->nruh, lines_per_ru, remaining_lines);
-    
-    /* Move lines from global free_line_list to RU-specific lists */
-    for (int ruid = 0; ruid < cfg->nruh; ruid++) {
-        fdp_ru_t *ru = &cfg->rgs[0].rus[ruid];
-        int lines_for_this_ru = lines_per_ru + (ruid < remaining_lines ? 1 : 0);
-        
-        for (int i = 0; i < lines_for_this_ru; i++) {
-            struct line *line = QTAILQ_FIRST(&lm->free_line_list);
-            if (!line) {
-                ftl_err("Ran out of lines during RU distribution!\n");
-                break;
-            }
-            
-            QTAILQ_REMOVE(&lm->free_line_list, line, entry);
-            lm->free_line_cnt--;
-            
-            /* Mark this line as owned by this RU */
-            line->ru_owner = ruid;
-            
-            QTAILQ_INSERT_TAIL(&ru->free_line_list, line, entry);
-            ru->free_line_cnt++;
-        }
-        
-        /* Initialize write pointer for this RU */
-        struct line *first_line = QTAILQ_FIRST(&ru->free_line_list);
-        if (first_line) {
-            QTAILQ_REMOVE(&ru->free_line_list, first_line, entry);
-            ru->free_line_cnt--;
-            
-            ru->wp.curline = first_line;
-            ru->wp.ch = 0;
-            ru->wp.lun = 0;
-            ru->wp.pg = 0;
-            ru->wp.blk = first_line->id;
-            ru->wp.pl = 0;
-            
-            ru->state = NVME_FDP_RUH_HOST_SPEC;  /* Mark as open */
-            
-            ftl_log("[FDP] RU %d: %d lines, first_blk=%d\n",
-                    ruid, ru->free_line_cnt + 1, ru->wp.blk);
-        } else {
-            ftl_err("RU %d has no lines!\n", ruid);
-        }
-    }
-    
-    ftl_log("[FDP] Line distribution complete. Global free_line_cnt=%d\n",
-            lm->free_line_cnt);
-}
+/* Copy limits: up to 128 source ranges of 8192 LBAs, 16384 LBAs in total */
+#define BB_COPY_MSRC    (127)
+#define BB_COPY_MSSRL   (8192)
+#define BB_COPY_MCL     (16384)
 
 static void bb_init_ctrl_str(FemuCtrl *n)
 {
@@ -161,6 +26,20 @@ static void bb_init(FemuCtrl *n, Error **errp)
     ssd->ssdname = (char *)n->devname;
     femu_debug("Starting FEMU in Blackbox-SSD mode ...\n");
     ssd_init(n);
+
+    /* Copy and Write Zeroes run inside the FTL, see ssd_io() */
+    n->oncs |= NVME_ONCS_COPY | NVME_ONCS_WRITE_ZEROS;
+    n->id_ctrl.oncs = cpu_to_le16(n->oncs);
+    n->id_ctrl.ocfs = cpu_to_le16(1 << NVME_COPY_FORMAT_0);
+    for (int i = 0; i < n->num_namespaces; i++) {
+        NvmeIdNs *id_ns = &n->namespaces[i].id_ns;
+
+        /* DEAC in Write Zeroes is honoured */
+        id_ns->dlfeat |= 1 << 3;
+        id_ns->msrc = BB_COPY_MSRC;
+        id_ns->mssrl = cpu_to_le16(BB_COPY_MSSRL);
+        id_ns->mcl = cpu_to_le32(BB_COPY_MCL);
+    }
     
     /* Initialize FDP configuration (disabled by default) */
     fdp_init_config(ssd);
@@ -176,7 +55,7 @@ static void bb_init(FemuCtrl *n, Error **errp)
         
         /* Update the controller identify structure directly (init_ctrl already called) */
         n->id_ctrl.oncs = cpu_to_le16(n->oncs);
-        n->id_ctrl.oacs = cpu_to_le16(n->oacs);
+        n->id_ctrl.oacs |= cpu_to_le16(NVME_OACS_DIRECTIVES);
         
         /* Enable FDP features */
         n->features.fdp_mode = 1;
@@ -192,6 +71,8 @@ static void bb_flip(FemuCtrl *n, NvmeCmd *cmd)
 {
     struct ssd *ssd = n->ssd;
     int64_t cdw10 = le64_to_cpu(cmd->cdw10);
+    double util[NAND_NR_CLASSES];
+    int i;
 
     switch (cdw10) {
     case FEMU_ENABLE_GC_DELAY:
@@ -207,6 +88,7 @@ static void bb_flip(FemuCtrl *n, NvmeCmd *cmd)
         ssd->sp.pg_wr_lat = NAND_PROG_LATENCY;
         ssd->sp.blk_er_lat = NAND_ERASE_LATENCY;
         ssd->sp.ch_xfer_lat = 0;
+        ssd_update_timing(ssd);
         femu_log("%s,FEMU Delay Emulation [Enabled]!\n", n->devname);
         break;
     case FEMU_DISABLE_DELAY_EMU:
@@ -214,11 +96,17 @@ static void bb_flip(FemuCtrl *n, NvmeCmd *cmd)
         ssd->sp.pg_wr_lat = 0;
         ssd->sp.blk_er_lat = 0;
         ssd->sp.ch_xfer_lat = 0;
+        ssd_update_timing(ssd);
         femu_log("%s,FEMU Delay Emulation [Disabled]!\n", n->devname);
         break;
     case FEMU_RESET_ACCT:
         n->nr_tt_ios = 0;
         n->nr_tt_late_ios = 0;
+        nand_timing_reset_stats(&ssd->nt);
+        for (i = 1; n->poller_idle && i <= n->nr_pollers; i++) {
+            femu_idle_reset_stats(&n->poller_idle[i]);
+        }
+        femu_idle_reset_stats(&n->ftl_idle);
         femu_log("%s,Reset tt_late_ios/tt_ios,%lu/%lu\n", n->devname,
                 n->nr_tt_late_ios, n->nr_tt_ios);
         break;
@@ -238,7 +126,7 @@ static void bb_flip(FemuCtrl *n, NvmeCmd *cmd)
         n->oncs |= NVME_ONCS_FDP;
         n->oacs |= NVME_OACS_DIRECTIVES;
         n->id_ctrl.oncs = cpu_to_le16(n->oncs);
-        n->id_ctrl.oacs = cpu_to_le16(n->oacs);
+        n->id_ctrl.oacs |= cpu_to_le16(NVME_OACS_DIRECTIVES);
         /* Initialize FDP features */
         n->features.fdp_mode = 1;  /* FDP enabled */
         n->features.fdp_events = 0; /* No events enabled by default */
@@ -249,17 +137,50 @@ static void bb_flip(FemuCtrl *n, NvmeCmd *cmd)
         n->oncs &= ~NVME_ONCS_FDP;
         n->oacs &= ~NVME_OACS_DIRECTIVES;
         n->id_ctrl.oncs = cpu_to_le16(n->oncs);
-        n->id_ctrl.oacs = cpu_to_le16(n->oacs);
+        n->id_ctrl.oacs &= ~cpu_to_le16(NVME_OACS_DIRECTIVES);
         /* Clear FDP features */
         n->features.fdp_mode = 0;
         n->features.fdp_events = 0;
         femu_log("%s,FDP [Disabled]! ONCS=0x%x, OACS=0x%x\n", n->devname, n->oncs, n->oacs);
         break;
+    case FEMU_PRINT_DIE_UTIL:
+        nand_timing_util(&ssd->nt, util);
+        femu_log("%s,LUN utilization: host read %.3f, host write %.3f, "
+                 "GC %.3f (sched %d)\n", n->devname,
+                 util[NAND_CLS_USER_READ], util[NAND_CLS_USER_WRITE],
+                 util[NAND_CLS_GC], ssd->nt.p.sched);
+        break;
+    case FEMU_PRINT_IDLE_STATS:
+        for (i = 0; n->poller_idle && i <= n->nr_pollers; i++) {
+            FemuIdle *w = i ? &n->poller_idle[i] : &n->ftl_idle;
+
+            femu_log("%s,%s[%d] sleeps %lu, wakeups %lu, wake lat avg %.1fus "
+                     "max %.1fus\n", n->devname, i ? "poller" : "ftl", i,
+                     w->nr_sleeps, w->nr_wakeups,
+                     w->nr_wakeups ? w->wake_lat_sum / 1e3 / w->nr_wakeups : 0,
+                     w->wake_lat_max / 1e3);
+        }
+        break;
+    case FEMU_PRINT_NS_STATS:
+        for (i = 0; i < ssd->nr_ns; i++) {
+            femu_log("%s,ns%d host pages written %lu, valid pages %lu\n",
+                     n->devname, i + 1, ssd->ns_st[i].host_pgs_wr,
+                     ssd->ns_st[i].valid_pgs);
+        }
+        break;
     default:
         printf("FEMU:%s,Not implemented flip cmd (%lu)\n", n->devname, cdw10);
     }
 }
 
+/* Drop a deleted namespace's mappings; the FTL thread does the unmapping */
+static void bb_ns_delete(FemuCtrl *n, NvmeNamespace *ns)
+{
+    qatomic_set(&ns->busy, true);
+    qatomic_inc(&n->ssd->ns_reclaim);
+    femu_idle_kick(&n->ftl_idle);
+}
+
 static uint16_t bb_nvme_rw(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
                            NvmeRequest *req)
 {
@@ -520,6 +441,11 @@ static uint16_t bb_get_log(FemuCtrl *n, NvmeCmd *cmd)
     }
 }
 
+static void bb_smart_info(FemuCtrl *n, NvmeSmartLog *smart)
+{
+    ssd_health(n->ssd, &smart->percentage_used, &smart->available_spare);
+}
+
 int nvme_register_bbssd(FemuCtrl *n)
 {
     n->ext_ops = (FemuExtCtrlOps) {
@@ -530,6 +456,8 @@ int nvme_register_bbssd(FemuCtrl *n)
         .admin_cmd        = bb_admin_cmd,
         .io_cmd           = bb_io_cmd,
         .get_log          = bb_get_log,
+        .ns_delete        = bb_ns_delete,
+        .smart_info       = bb_smart_info,
     };
 
     return 0;
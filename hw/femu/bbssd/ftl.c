@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "ftl.h"
 
 #define FEMU_DEBUG_FTL
@@ -9,8 +11,43 @@ static inline void check_addr(int a, int max)
     ftl_assert(a >= 0 && a < max);
 }
 
+/* Index of a block into the nand_state block arrays */
+static inline uint64_t blk_index(struct ssdparams *spp, int ch, int lun,
+                                 int pl, int blk)
+{
+    return ch * spp->blks_per_ch + lun * spp->blks_per_lun +
+           pl * spp->blks_per_pl + blk;
+}
+
+/* Whether the block a write pointer is at must not be programmed */
+static inline bool wp_blk_bad(struct ssd *ssd, struct write_pointer *wpp)
+{
+    return ssd->nand.blk_bad[blk_index(&ssd->sp, wpp->ch, wpp->lun, wpp->pl,
+                                       wpp->blk)] != BLK_GOOD;
+}
+
+/* Close a line whose pages are all valid, see ssd_wear_level() */
+static inline void full_line_insert(struct line_mgmt *lm, struct line *line)
+{
+    QTAILQ_INSERT_TAIL(&lm->full_line_list, line, entry);
+    lm->full_line_cnt++;
+    lm->full_min_erase_cnt = MIN(lm->full_min_erase_cnt, line->erase_cnt);
+}
+
+/* Namespace of a request, 0 for the standalone FTL */
+static inline int ssd_req_ns(NvmeRequest *req)
+{
+    return req->ns ? req->ns->id - 1 : 0;
+}
+
+/* Device-wide LBA of a request: namespaces are laid out back to back */
+static inline uint64_t ssd_req_lba(NvmeRequest *req, uint64_t slba)
+{
+    return (req->ns ? req->ns->start_block : 0) + slba;
+}
+
 /* FDP: Get Reclaim Unit by Placement Handle */
-static inline fdp_ru_t *fdp_get_ru_by_ph(struct ssd *ssd, uint8_t ph)
+static inline fdp_ru_t *fdp_get_ru_by_ph(struct ssd *ssd, uint8_t ph, int ns)
 {
     fdp_config_t *cfg = &ssd->fdp_cfg;
     
@@ -31,6 +68,13 @@ static inline fdp_ru_t *fdp_get_ru_by_ph(struct ssd *ssd, uint8_t ph)
         ftl_err("Invalid RUHID=%d for PH=%d, using RU 0\n", ruhid, ph);
         return &cfg->rgs[0].rus[0];
     }
+
+    /* each namespace writes into its own slice of the RU handles */
+    if (ssd->nr_ns > 1) {
+        int per_ns = MAX(cfg->nruh / ssd->nr_ns, 1);
+
+        ruhid = (ns * per_ns + ruhid % per_ns) % cfg->nruh;
+    }
     
     /* For Phase 2, we have single RG at index 0 */
     return &cfg->rgs[0].rus[ruhid];
@@ -78,56 +122,88 @@ static void fdp_advance_write_pointer(struct ssd *ssd, fdp_ru_t *ru)
     struct write_pointer *wpp = &ru->wp;
     struct line_mgmt *lm = &ssd->lm;
     
-    check_addr(wpp->ch, spp->nchs);
-    wpp->ch++;
-    if (wpp->ch == spp->nchs) {
-        wpp->ch = 0;
-        check_addr(wpp->lun, spp->luns_per_ch);
-        wpp->lun++;
-        
-        if (wpp->lun == spp->luns_per_ch) {
-            wpp->lun = 0;
-            check_addr(wpp->pg, spp->pgs_per_blk);
-            wpp->pg++;
-            
-            if (wpp->pg == spp->pgs_per_blk) {
-                wpp->pg = 0;
-                
-                /* Move current line to victim or full list */
-                if (wpp->curline->vpc == spp->pgs_per_line) {
-                    ftl_assert(wpp->curline->ipc == 0);
-                    QTAILQ_INSERT_TAIL(&lm->full_line_list, wpp->curline, entry);
-                    lm->full_line_cnt++;
-                } else {
-                    ftl_assert(wpp->curline->vpc >= 0 && wpp->curline->vpc < spp->pgs_per_line);
-                    ftl_assert(wpp->curline->ipc > 0);
-                    pqueue_insert(lm->victim_line_pq, wpp->curline);
-                    lm->victim_line_cnt++;
+    /* bad blocks are left out of the line */
+    do {
+        check_addr(wpp->ch, spp->nchs);
+        wpp->ch++;
+        if (wpp->ch == spp->nchs) {
+            wpp->ch = 0;
+            check_addr(wpp->lun, spp->luns_per_ch);
+            wpp->lun++;
+
+            if (wpp->lun == spp->luns_per_ch) {
+                wpp->lun = 0;
+                check_addr(wpp->pg, spp->pgs_per_blk);
+                wpp->pg++;
+
+                if (wpp->pg == spp->pgs_per_blk) {
+                    wpp->pg = 0;
+
+                    /* Move current line to victim or full list */
+                    if (wpp->curline->vpc == wpp->curline->pgs) {
+                        ftl_assert(wpp->curline->ipc == 0);
+                        full_line_insert(lm, wpp->curline);
+                    } else {
+                        ftl_assert(wpp->curline->vpc >= 0 && wpp->curline->vpc < wpp->curline->pgs);
+                        ftl_assert(wpp->curline->ipc > 0);
+                        pqueue_insert(lm->victim_line_pq, wpp->curline);
+                        lm->victim_line_cnt++;
+                    }
+
+                    /* Get next free line from this RU */
+                    check_addr(wpp->blk, spp->blks_per_pl);
+                    wpp->curline = NULL;
+                    wpp->curline = fdp_get_next_free_line(ssd, ru);
+
+                    if (!wpp->curline) {
+                        ftl_err("RU %d out of free lines! (free=%d, victim=%d, full=%d)\n",
+                                ru->ruhid, ru->free_line_cnt,
+                                ssd->lm.victim_line_cnt, ssd->lm.full_line_cnt);
+                        ftl_err("This should not happen with RU-aware GC. Check GC implementation.\n");
+                        abort();
+                    }
+
+                    wpp->blk = wpp->curline->id;
+                    check_addr(wpp->blk, spp->blks_per_pl);
+
+                    ftl_assert(wpp->pg == 0);
+                    ftl_assert(wpp->lun == 0);
+                    ftl_assert(wpp->ch == 0);
+                    ftl_assert(wpp->pl == 0);
                 }
-                
-                /* Get next free line from this RU */
-                check_addr(wpp->blk, spp->blks_per_pl);
-                wpp->curline = NULL;
-                wpp->curline = fdp_get_next_free_line(ssd, ru);
-                
-                if (!wpp->curline) {
-                    ftl_err("RU %d out of free lines! (free=%d, victim=%d, full=%d)\n",
-                            ru->ruhid, ru->free_line_cnt,
-                            ssd->lm.victim_line_cnt, ssd->lm.full_line_cnt);
-                    ftl_err("This should not happen with RU-aware GC. Check GC implementation.\n");
-                    abort();
-                }
-                
-                wpp->blk = wpp->curline->id;
-                check_addr(wpp->blk, spp->blks_per_pl);
-                
-                ftl_assert(wpp->pg == 0);
-                ftl_assert(wpp->lun == 0);
-                ftl_assert(wpp->ch == 0);
-                ftl_assert(wpp->pl == 0);
             }
         }
+    } while (wp_blk_bad(ssd, wpp));
+}
+
+/* Lines of a static SLC cache are taken off the global free list for good */
+static void ssd_init_slc(struct ssd *ssd)
+{
+    struct slc_cache *sc = &ssd->slc;
+    struct line *line;
+
+    QTAILQ_INIT(&sc->free_line_list);
+    QTAILQ_INIT(&sc->fold_list);
+    if (ssd->sp.slc_mode != SSD_SLC_STATIC) {
+        return;
+    }
+
+    for (int i = 0; i < ssd->sp.slc_lines; i++) {
+        /* bad blocks may leave too few lines, keep the GC reserve */
+        if (ssd->lm.free_line_cnt <= ssd->sp.gc_thres_lines) {
+            ftl_err("Only %d of %d SLC lines available\n", i,
+                    ssd->sp.slc_lines);
+            ssd->sp.slc_lines = i;
+            break;
+        }
+        line = QTAILQ_LAST(&ssd->lm.free_line_list);
+        QTAILQ_REMOVE(&ssd->lm.free_line_list, line, entry);
+        ssd->lm.free_line_cnt--;
+        line->slc = true;
+        QTAILQ_INSERT_HEAD(&sc->free_line_list, line, entry);
+        sc->free_line_cnt++;
     }
+    sc->nr_lines = ssd->sp.slc_lines;
 }
 
 static inline bool should_gc(struct ssd *ssd)
@@ -142,13 +218,15 @@ static inline bool should_gc_high(struct ssd *ssd)
 
 static inline struct ppa get_maptbl_ent(struct ssd *ssd, uint64_t lpn)
 {
-    return ssd->maptbl[lpn];
+    struct ppa ppa = { .ppa = ~ssd->maptbl[lpn].ppa };
+
+    return ppa;
 }
 
 static inline void set_maptbl_ent(struct ssd *ssd, uint64_t lpn, struct ppa *ppa)
 {
-    ftl_assert(lpn < ssd->sp.tt_pgs);
-    ssd->maptbl[lpn] = *ppa;
+    ftl_assert(lpn < ssd->sp.tt_lpns);
+    ssd->maptbl[lpn].ppa = ~ppa->ppa;
 }
 
 static uint64_t ppa2pgidx(struct ssd *ssd, struct ppa *ppa)
@@ -171,7 +249,7 @@ static inline uint64_t get_rmap_ent(struct ssd *ssd, struct ppa *ppa)
 {
     uint64_t pgidx = ppa2pgidx(ssd, ppa);
 
-    return ssd->rmap[pgidx];
+    return ~ssd->rmap[pgidx];
 }
 
 /* set rmap[page_no(ppa)] -> lpn */
@@ -179,7 +257,7 @@ static inline void set_rmap_ent(struct ssd *ssd, uint64_t lpn, struct ppa *ppa)
 {
     uint64_t pgidx = ppa2pgidx(ssd, ppa);
 
-    ssd->rmap[pgidx] = lpn;
+    ssd->rmap[pgidx] = ~lpn;
 }
 
 static inline int victim_line_cmp_pri(pqueue_pri_t next, pqueue_pri_t curr)
@@ -231,35 +309,27 @@ static void ssd_init_lines(struct ssd *ssd)
         line->vpc = 0;
         line->pos = 0;
         line->ru_owner = 0xFF;  /* FDP: initially no owner */
+        line->pgs = spp->pgs_per_line;
+        for (int ch = 0; ch < spp->nchs; ch++) {
+            for (int lun = 0; lun < spp->luns_per_ch; lun++) {
+                if (ssd->nand.blk_bad[blk_index(spp, ch, lun, 0, i)]) {
+                    line->pgs -= spp->pgs_per_blk;
+                }
+            }
+        }
+        if (!line->pgs) {
+            /* no good block at all, the line is never used */
+            continue;
+        }
         /* initialize all the lines as free lines */
         QTAILQ_INSERT_TAIL(&lm->free_line_list, line, entry);
         lm->free_line_cnt++;
     }
 
-    ftl_assert(lm->free_line_cnt == lm->tt_lines);
     lm->victim_line_cnt = 0;
     lm->full_line_cnt = 0;
 }
 
-static void ssd_init_write_pointer(struct ssd *ssd)
-{
-    struct write_pointer *wpp = &ssd->wp;
-    struct line_mgmt *lm = &ssd->lm;
-    struct line *curline = NULL;
-
-    curline = QTAILQ_FIRST(&lm->free_line_list);
-    QTAILQ_REMOVE(&lm->free_line_list, curline, entry);
-    lm->free_line_cnt--;
-
-    /* wpp->curline is always our next-to-write super-block */
-    wpp->curline = curline;
-    wpp->ch = 0;
-    wpp->lun = 0;
-    wpp->pg = 0;
-    wpp->blk = 0;
-    wpp->pl = 0;
-}
-
 static struct line *get_next_free_line(struct ssd *ssd)
 {
     struct line_mgmt *lm = &ssd->lm;
@@ -282,51 +352,75 @@ static void ssd_advance_write_pointer(struct ssd *ssd)
     struct write_pointer *wpp = &ssd->wp;
     struct line_mgmt *lm = &ssd->lm;
 
-    check_addr(wpp->ch, spp->nchs);
-    wpp->ch++;
-    if (wpp->ch == spp->nchs) {
-        wpp->ch = 0;
-        check_addr(wpp->lun, spp->luns_per_ch);
-        wpp->lun++;
-        /* in this case, we should go to next lun */
-        if (wpp->lun == spp->luns_per_ch) {
-            wpp->lun = 0;
-            /* go to next page in the block */
-            check_addr(wpp->pg, spp->pgs_per_blk);
-            wpp->pg++;
-            if (wpp->pg == spp->pgs_per_blk) {
-                wpp->pg = 0;
-                /* move current line to {victim,full} line list */
-                if (wpp->curline->vpc == spp->pgs_per_line) {
-                    /* all pgs are still valid, move to full line list */
-                    ftl_assert(wpp->curline->ipc == 0);
-                    QTAILQ_INSERT_TAIL(&lm->full_line_list, wpp->curline, entry);
-                    lm->full_line_cnt++;
-                } else {
-                    ftl_assert(wpp->curline->vpc >= 0 && wpp->curline->vpc < spp->pgs_per_line);
-                    /* there must be some invalid pages in this line */
-                    ftl_assert(wpp->curline->ipc > 0);
-                    pqueue_insert(lm->victim_line_pq, wpp->curline);
-                    lm->victim_line_cnt++;
+    /* bad blocks are left out of the line */
+    do {
+        check_addr(wpp->ch, spp->nchs);
+        wpp->ch++;
+        if (wpp->ch == spp->nchs) {
+            wpp->ch = 0;
+            check_addr(wpp->lun, spp->luns_per_ch);
+            wpp->lun++;
+            /* in this case, we should go to next lun */
+            if (wpp->lun == spp->luns_per_ch) {
+                wpp->lun = 0;
+                /* go to next page in the block */
+                check_addr(wpp->pg, spp->pgs_per_blk);
+                wpp->pg++;
+                if (wpp->pg == spp->pgs_per_blk) {
+                    wpp->pg = 0;
+                    /* move current line to {victim,full} line list */
+                    if (wpp->curline->vpc == wpp->curline->pgs) {
+                        /* all pgs are still valid, move to full line list */
+                        ftl_assert(wpp->curline->ipc == 0);
+                        full_line_insert(lm, wpp->curline);
+                    } else {
+                        ftl_assert(wpp->curline->vpc >= 0 && wpp->curline->vpc < wpp->curline->pgs);
+                        /* there must be some invalid pages in this line */
+                        ftl_assert(wpp->curline->ipc > 0);
+                        pqueue_insert(lm->victim_line_pq, wpp->curline);
+                        lm->victim_line_cnt++;
+                    }
+                    /* current line is used up, pick another empty line */
+                    check_addr(wpp->blk, spp->blks_per_pl);
+                    wpp->curline = NULL;
+                    wpp->curline = get_next_free_line(ssd);
+                    if (!wpp->curline) {
+                        /* TODO */
+                        abort();
+                    }
+                    wpp->blk = wpp->curline->id;
+                    check_addr(wpp->blk, spp->blks_per_pl);
+                    /* make sure we are starting from page 0 in the super block */
+                    ftl_assert(wpp->pg == 0);
+                    ftl_assert(wpp->lun == 0);
+                    ftl_assert(wpp->ch == 0);
+                    /* TODO: assume # of pl_per_lun is 1, fix later */
+                    ftl_assert(wpp->pl == 0);
                 }
-                /* current line is used up, pick another empty line */
-                check_addr(wpp->blk, spp->blks_per_pl);
-                wpp->curline = NULL;
-                wpp->curline = get_next_free_line(ssd);
-                if (!wpp->curline) {
-                    /* TODO */
-                    abort();
-                }
-                wpp->blk = wpp->curline->id;
-                check_addr(wpp->blk, spp->blks_per_pl);
-                /* make sure we are starting from page 0 in the super block */
-                ftl_assert(wpp->pg == 0);
-                ftl_assert(wpp->lun == 0);
-                ftl_assert(wpp->ch == 0);
-                /* TODO: assume # of pl_per_lun is 1, fix later */
-                ftl_assert(wpp->pl == 0);
             }
         }
+    } while (wp_blk_bad(ssd, wpp));
+}
+
+static void ssd_init_write_pointer(struct ssd *ssd)
+{
+    struct write_pointer *wpp = &ssd->wp;
+    struct line_mgmt *lm = &ssd->lm;
+    struct line *curline = NULL;
+
+    curline = QTAILQ_FIRST(&lm->free_line_list);
+    QTAILQ_REMOVE(&lm->free_line_list, curline, entry);
+    lm->free_line_cnt--;
+
+    /* wpp->curline is always our next-to-write super-block */
+    wpp->curline = curline;
+    wpp->ch = 0;
+    wpp->lun = 0;
+    wpp->pg = 0;
+    wpp->blk = curline->id;
+    wpp->pl = 0;
+    if (wp_blk_bad(ssd, wpp)) {
+        ssd_advance_write_pointer(ssd);
     }
 }
 
@@ -345,6 +439,93 @@ static struct ppa get_new_page(struct ssd *ssd)
     return ppa;
 }
 
+/* Whether a new SLC line could be opened for host writes right now */
+static bool slc_can_open(struct ssd *ssd)
+{
+    struct slc_cache *sc = &ssd->slc;
+
+    switch (ssd->sp.slc_mode) {
+    case SSD_SLC_STATIC:
+        return sc->free_line_cnt > 0;
+    case SSD_SLC_DYNAMIC:
+        /* the cache shrinks away as the drive fills up */
+        return sc->nr_lines < ssd->sp.slc_lines && !should_gc(ssd);
+    default:
+        return false;
+    }
+}
+
+static void slc_advance_write_pointer(struct ssd *ssd)
+{
+    struct ssdparams *spp = &ssd->sp;
+    struct slc_cache *sc = &ssd->slc;
+    struct write_pointer *wpp = &sc->wp;
+
+    /* bad blocks are left out of the line */
+    do {
+        if (++wpp->ch < spp->nchs) {
+            continue;
+        }
+        wpp->ch = 0;
+        if (++wpp->lun < spp->luns_per_ch) {
+            continue;
+        }
+        wpp->lun = 0;
+        if (++wpp->pg < spp->slc_pgs_per_blk) {
+            continue;
+        }
+
+        /* line is full in SLC mode, queue it for folding */
+        QTAILQ_INSERT_TAIL(&sc->fold_list, wpp->curline, entry);
+        sc->fold_cnt++;
+        wpp->curline = NULL;
+    } while (wpp->curline && wp_blk_bad(ssd, wpp));
+}
+
+/*
+ * Next page of the SLC cache into @ppa, opening a line if needed. Returns
+ * false once the cache is used up, host writes then go to regular lines.
+ */
+static bool slc_get_new_page(struct ssd *ssd, struct ppa *ppa)
+{
+    struct slc_cache *sc = &ssd->slc;
+    struct write_pointer *wpp = &sc->wp;
+    struct line *line;
+
+    if (!wpp->curline) {
+        if (!slc_can_open(ssd)) {
+            return false;
+        }
+        if (ssd->sp.slc_mode == SSD_SLC_STATIC) {
+            line = QTAILQ_FIRST(&sc->free_line_list);
+            QTAILQ_REMOVE(&sc->free_line_list, line, entry);
+            sc->free_line_cnt--;
+        } else {
+            line = get_next_free_line(ssd);
+            line->slc = true;
+            sc->nr_lines++;
+        }
+        wpp->curline = line;
+        wpp->ch = 0;
+        wpp->lun = 0;
+        wpp->pg = 0;
+        wpp->blk = line->id;
+        wpp->pl = 0;
+        if (wp_blk_bad(ssd, wpp)) {
+            slc_advance_write_pointer(ssd);
+        }
+    }
+
+    ppa->ppa = 0;
+    ppa->g.ch = wpp->ch;
+    ppa->g.lun = wpp->lun;
+    ppa->g.pg = wpp->pg;
+    ppa->g.blk = wpp->blk;
+    ppa->g.pl = wpp->pl;
+
+    return true;
+}
+
 static void check_params(struct ssdparams *spp)
 {
     /*
@@ -354,6 +535,31 @@ static void check_params(struct ssdparams *spp)
 
     //ftl_assert(is_power_of_2(spp->luns_per_ch));
     //ftl_assert(is_power_of_2(spp->nchs));
+
+    /* every address must fit its struct ppa field */
+    if (spp->secsz <= 0 ||
+        spp->secs_per_pg <= 0 || spp->secs_per_pg > (1 << SEC_BITS) ||
+        spp->pgs_per_blk <= 0 || spp->pgs_per_blk > (1 << PG_BITS) ||
+        spp->blks_per_pl <= 0 || spp->blks_per_pl > (1 << BLK_BITS) ||
+        spp->pls_per_lun <= 0 || spp->pls_per_lun > (1 << PL_BITS) ||
+        spp->luns_per_ch <= 0 || spp->luns_per_ch > (1 << LUN_BITS) ||
+        spp->nchs <= 0 || spp->nchs > (1 << CH_BITS)) {
+        ftl_err("unsupported geometry: secs_per_pg=%d pgs_per_blk=%d "
+                "blks_per_pl=%d pls_per_lun=%d luns_per_ch=%d nchs=%d\n",
+                spp->secs_per_pg, spp->pgs_per_blk, spp->blks_per_pl,
+                spp->pls_per_lun, spp->luns_per_ch, spp->nchs);
+        abort();
+    }
+
+    /* block and line counters stay int */
+    if ((int64_t)spp->blks_per_pl * spp->pls_per_lun * spp->luns_per_ch *
+        spp->nchs > INT_MAX ||
+        spp->tt_luns * (int64_t)spp->pgs_per_blk * spp->secs_per_pg > INT_MAX) {
+        ftl_err("too many blocks or pages per line (nchs=%d luns_per_ch=%d "
+                "pgs_per_blk=%d)\n", spp->nchs, spp->luns_per_ch,
+                spp->pgs_per_blk);
+        abort();
+    }
 }
 
 static void ssd_init_params(struct ssdparams *spp, FemuCtrl *n)
@@ -370,15 +576,27 @@ static void ssd_init_params(struct ssdparams *spp, FemuCtrl *n)
     spp->pg_wr_lat = n->bb_params.pg_wr_lat;
     spp->blk_er_lat = n->bb_params.blk_er_lat;
     spp->ch_xfer_lat = n->bb_params.ch_xfer_lat;
+    spp->suspend_lat = n->bb_params.suspend_lat;
+    spp->resume_lat = n->bb_params.resume_lat;
+    spp->max_suspend = n->bb_params.max_suspend;
+    spp->die_sched = n->bb_params.die_sched;
+    spp->flash_type = n->flash_type;
+    spp->pg_type_mode = n->bb_params.pg_type_mode;
+    if (spp->pg_type_mode != SSD_PGTYPE_FLAT &&
+        (spp->flash_type < SLC || spp->flash_type > QLC)) {
+        ftl_err("pg_type_mode=%d needs flash_type 1-4 (got %d), using flat "
+                "latencies\n", spp->pg_type_mode, spp->flash_type);
+        spp->pg_type_mode = SSD_PGTYPE_FLAT;
+    }
 
     /* calculated values */
     spp->secs_per_blk = spp->secs_per_pg * spp->pgs_per_blk;
-    spp->secs_per_pl = spp->secs_per_blk * spp->blks_per_pl;
+    spp->secs_per_pl = (uint64_t)spp->secs_per_blk * spp->blks_per_pl;
     spp->secs_per_lun = spp->secs_per_pl * spp->pls_per_lun;
     spp->secs_per_ch = spp->secs_per_lun * spp->luns_per_ch;
     spp->tt_secs = spp->secs_per_ch * spp->nchs;
 
-    spp->pgs_per_pl = spp->pgs_per_blk * spp->blks_per_pl;
+    spp->pgs_per_pl = (uint64_t)spp->pgs_per_blk * spp->blks_per_pl;
     spp->pgs_per_lun = spp->pgs_per_pl * spp->pls_per_lun;
     spp->pgs_per_ch = spp->pgs_per_lun * spp->luns_per_ch;
     spp->tt_pgs = spp->pgs_per_ch * spp->nchs;
@@ -402,87 +620,366 @@ static void ssd_init_params(struct ssdparams *spp, FemuCtrl *n)
     spp->gc_thres_lines = (int)((1 - spp->gc_thres_pcent) * spp->tt_lines);
     spp->gc_thres_pcent_high = n->bb_params.gc_thres_pcent_high/100.0;
     spp->gc_thres_lines_high = (int)((1 - spp->gc_thres_pcent_high) * spp->tt_lines);
+
+    /*
+     * A full drive has only its spare lines free: keep background GC within
+     * them, and forced GC to their last quarter
+     */
+    spp->op_pcent = n->bb_params.op_pcent;
+    spp->endurance = MAX(n->bb_params.endurance, 1);
+    spp->tt_lpns = bb_logical_pgs(&n->bb_params);
+    if (spp->op_pcent >= 0) {
+        int op_lines = spp->tt_lines -
+                       DIV_ROUND_UP(spp->tt_lpns, spp->pgs_per_line);
+
+        if (op_lines < 2) {
+            ftl_err("op_pcent=%d leaves %d spare lines, GC needs 2 to make "
+                    "progress on a full drive\n", spp->op_pcent, op_lines);
+        }
+        spp->gc_thres_lines = MIN(spp->gc_thres_lines, MAX(op_lines / 2, 2));
+        spp->gc_thres_lines_high = MIN(spp->gc_thres_lines_high,
+                                       MAX(op_lines / 4, 1));
+    }
     spp->enable_gc_delay = true;
+    spp->wl_thres = MAX(n->bb_params.wl_thres, 0);
+
+    spp->slc_mode = n->bb_params.slc_mode;
+    spp->slc_lines = n->bb_params.slc_lines;
+    spp->slc_pgs_per_blk = spp->pgs_per_blk / MAX(spp->flash_type, 1);
+    if (spp->slc_mode < SSD_SLC_OFF || spp->slc_mode > SSD_SLC_DYNAMIC ||
+        (spp->slc_mode && (spp->flash_type <= SLC ||
+                           spp->pg_type_mode == SSD_PGTYPE_FLAT ||
+                           spp->slc_lines <= 0 ||
+                           spp->slc_lines > spp->tt_lines / 2 ||
+                           !spp->slc_pgs_per_blk))) {
+        if (spp->slc_mode) {
+            ftl_err("slc_mode=%d needs flash_type > 1, pg_type_mode > 0 and "
+                    "0 < slc_lines <= %d (got %d), SLC cache disabled\n",
+                    spp->slc_mode,
+                    spp->tt_lines / 2, spp->slc_lines);
+        }
+        spp->slc_mode = SSD_SLC_OFF;
+    }
 
+    spp->rr_lat = MAX(n->bb_params.rr_lat, 0);
+    spp->rr_pe_cycles = n->bb_params.rr_pe_cycles;
+    spp->rr_retention = n->bb_params.rr_retention;
+    spp->rr_reads = n->bb_params.rr_reads;
+    if (spp->rr_lat && (spp->rr_pe_cycles <= 0 || spp->rr_retention <= 0 ||
+                        spp->rr_reads <= 0)) {
+        ftl_err("rr_pe_cycles, rr_retention and rr_reads must be positive, "
+                "read retry model disabled\n");
+        spp->rr_lat = 0;
+    }
+
+    spp->pgm_fail_ppm = MIN(MAX(n->bb_params.pgm_fail_ppm, 0), 1000000);
+    spp->ers_fail_ppm = MIN(MAX(n->bb_params.ers_fail_ppm, 0), 1000000);
 
     check_params(spp);
 }
 
-static void ssd_init_nand_page(struct nand_page *pg, struct ssdparams *spp)
+static void ssd_init_nand(struct ssd *ssd)
 {
-    pg->nsecs = spp->secs_per_pg;
-    pg->sec = g_malloc0(sizeof(nand_sec_status_t) * pg->nsecs);
-    for (int i = 0; i < pg->nsecs; i++) {
-        pg->sec[i] = SEC_FREE;
+    struct ssdparams *spp = &ssd->sp;
+    struct nand_state *nand = &ssd->nand;
+
+    /* all pages PG_FREE */
+    nand->pg_st = g_new0(uint64_t, DIV_ROUND_UP(spp->tt_pgs, PG_ST_PER_WORD));
+    nand->blk_vpc = g_new0(int, spp->tt_blks);
+    nand->blk_ipc = g_new0(int, spp->tt_blks);
+    nand->blk_erase_cnt = g_new0(int, spp->tt_blks);
+    if (spp->rr_lat) {
+        nand->blk_rd_cnt = g_new0(uint32_t, spp->tt_blks);
+        nand->blk_prog_time = g_new0(uint64_t, spp->tt_blks);
     }
-    pg->status = PG_FREE;
+    nand->blk_bad = g_new0(uint8_t, spp->tt_blks);
+    ssd->rng = 0x9e3779b97f4a7c15ULL;
 }
 
-static void ssd_init_nand_blk(struct nand_block *blk, struct ssdparams *spp)
+/* Factory bad blocks from the bbt_fname file, "ch=N lun=N blk=N" per line */
+static void ssd_init_bbt(struct ssd *ssd, const char *fname)
 {
-    blk->npgs = spp->pgs_per_blk;
-    blk->pg = g_malloc0(sizeof(struct nand_page) * blk->npgs);
-    for (int i = 0; i < blk->npgs; i++) {
-        ssd_init_nand_page(&blk->pg[i], spp);
+    struct ssdparams *spp = &ssd->sp;
+    unsigned int ch, lun, blk;
+    uint8_t *bad;
+    char buf[256];
+    FILE *fp;
+
+    if (!fname) {
+        return;
     }
-    blk->ipc = 0;
-    blk->vpc = 0;
-    blk->erase_cnt = 0;
-    blk->wp = 0;
-}
 
-static void ssd_init_nand_plane(struct nand_plane *pl, struct ssdparams *spp)
-{
-    pl->nblks = spp->blks_per_pl;
-    pl->blk = g_malloc0(sizeof(struct nand_block) * pl->nblks);
-    for (int i = 0; i < pl->nblks; i++) {
-        ssd_init_nand_blk(&pl->blk[i], spp);
+    fp = fopen(fname, "r");
+    if (!fp) {
+        ftl_err("could not open bad block file %s\n", fname);
+        return;
+    }
+
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (buf[0] == '#' || buf[0] == '\n') {
+            continue;
+        }
+        if (sscanf(buf, "ch=%u lun=%u blk=%u", &ch, &lun, &blk) != 3 ||
+            ch >= spp->nchs || lun >= spp->luns_per_ch ||
+            blk >= spp->blks_per_pl) {
+            ftl_err("ignoring bad block line: %s", buf);
+            continue;
+        }
+        bad = &ssd->nand.blk_bad[blk_index(spp, ch, lun, 0, blk)];
+        if (*bad == BLK_GOOD) {
+            *bad = BLK_BAD;
+            ssd->nr_bad_blks++;
+        }
     }
+
+    fclose(fp);
+    ssd->nr_factory_bad_blks = ssd->nr_bad_blks;
 }
 
-static void ssd_init_nand_lun(struct nand_lun *lun, struct ssdparams *spp)
+/* (Re)load the timing engine latencies from ssdparams, e.g. after FEMU_FLIP */
+void ssd_update_timing(struct ssd *ssd)
 {
-    lun->npls = spp->pls_per_lun;
-    lun->pl = g_malloc0(sizeof(struct nand_plane) * lun->npls);
-    for (int i = 0; i < lun->npls; i++) {
-        ssd_init_nand_plane(&lun->pl[i], spp);
+    struct ssdparams *spp = &ssd->sp;
+    NandTimingParams *tp = &ssd->nt.p;
+    int nbits = spp->flash_type;
+
+    tp->suspend_lat = spp->suspend_lat;
+    tp->resume_lat = spp->resume_lat;
+    tp->max_suspends = spp->max_suspend;
+
+    /*
+     * FEMU_DISABLE_DELAY_EMU zeroes the latencies, whatever the page type.
+     * The SLC cache needs page types (see ssd_init_params()), flat latencies
+     * leave it no faster than the region it fronts.
+     */
+    if (spp->pg_type_mode == SSD_PGTYPE_FLAT ||
+        (!spp->pg_rd_lat && !spp->pg_wr_lat)) {
+        for (int i = 0; i < MAX_FLASH_TYPE; i++) {
+            tp->pg_rd_lat[i] = spp->pg_rd_lat;
+            tp->pg_wr_lat[i] = spp->pg_wr_lat;
+        }
+        tp->blk_er_lat = spp->blk_er_lat;
+        tp->ch_xfer_lat = spp->ch_xfer_lat;
+        tp->slc_rd_lat = spp->pg_rd_lat;
+        tp->slc_wr_lat = spp->pg_wr_lat;
+        tp->slc_er_lat = spp->blk_er_lat;
+        return;
+    }
+
+    nand_timing_flash_params(tp, spp->flash_type);
+    tp->ch_xfer_lat = spp->ch_xfer_lat;
+
+    /* SLC mode is never slower than the fastest page of the flash itself */
+    tp->slc_rd_lat = SLC_PAGE_READ_LATENCY_NS;
+    tp->slc_wr_lat = SLC_PAGE_WRITE_LATENCY_NS;
+    tp->slc_er_lat = MIN(SLC_BLOCK_ERASE_LATENCY_NS, tp->blk_er_lat);
+    for (int i = 0; i < nbits; i++) {
+        tp->slc_rd_lat = MIN(tp->slc_rd_lat, tp->pg_rd_lat[i]);
+        tp->slc_wr_lat = MIN(tp->slc_wr_lat, tp->pg_wr_lat[i]);
+    }
+
+    if (spp->pg_type_mode == SSD_PGTYPE_ONE_SHOT) {
+        /*
+         * Lower pages only fill the die's page buffers, the whole wordline is
+         * programmed in one tPROG when its last (upper) page arrives
+         */
+        for (int i = 0; i < nbits - 1; i++) {
+            tp->pg_wr_lat[i] = 0;
+        }
     }
-    lun->next_lun_avail_time = 0;
-    lun->busy = false;
 }
 
-static void ssd_init_ch(struct ssd_channel *ch, struct ssdparams *spp)
+/* Page type (lower/center/upper) of page @pg within its block */
+static inline int ssd_page_type(struct ssdparams *spp, int pg)
 {
-    ch->nluns = spp->luns_per_ch;
-    ch->lun = g_malloc0(sizeof(struct nand_lun) * ch->nluns);
-    for (int i = 0; i < ch->nluns; i++) {
-        ssd_init_nand_lun(&ch->lun[i], spp);
+    switch (spp->pg_type_mode) {
+    case SSD_PGTYPE_MULTI_PASS:
+        return get_page_type(spp->flash_type,
+                             pg % MAX_SUPPORTED_PAGES_PER_BLOCK);
+    case SSD_PGTYPE_ONE_SHOT:
+        /* consecutive pages share a wordline, lower page first */
+        return pg % spp->flash_type;
+    default:
+        return 0;
     }
-    ch->next_ch_avail_time = 0;
-    ch->busy = 0;
 }
 
-static void ssd_init_maptbl(struct ssd *ssd)
+static void ssd_init_timing(struct ssd *ssd)
 {
     struct ssdparams *spp = &ssd->sp;
+    NandTimingParams tp = {
+        .nchs        = spp->nchs,
+        .luns_per_ch = spp->luns_per_ch,
+        .pls_per_lun = spp->pls_per_lun,
+        .plane_level = false,
+        .shared      = false,
+        .sched       = spp->die_sched,
+    };
+
+    nand_timing_init(&ssd->nt, &tp);
+    ssd_update_timing(ssd);
+}
 
-    ssd->maptbl = g_malloc0(sizeof(struct ppa) * spp->tt_pgs);
-    for (int i = 0; i < spp->tt_pgs; i++) {
-        ssd->maptbl[i].ppa = UNMAPPED_PPA;
-    }
+/* all UNMAPPED_PPA, see struct ssd */
+static void ssd_init_maptbl(struct ssd *ssd)
+{
+    ssd->maptbl = g_new0(struct ppa, ssd->sp.tt_lpns);
 }
 
+/* all INVALID_LPN, see struct ssd */
 static void ssd_init_rmap(struct ssd *ssd)
+{
+    ssd->rmap = g_new0(uint64_t, ssd->sp.tt_pgs);
+}
+
+/* FDP: Initialize a Reclaim Unit */
+static void fdp_init_ru(struct ssd *ssd, fdp_ru_t *ru, uint16_t ruid, 
+                        uint16_t rgid, uint8_t ruhid)
 {
     struct ssdparams *spp = &ssd->sp;
+    
+    ru->ruid = ruid;
+    ru->rgid = rgid;
+    ru->ruhid = ruhid;
+    ru->state = NVME_FDP_RUH_UNUSED;
+    ru->curline = NULL;
+    ru->bytes_written = 0;
+    ru->ru_open_time = 0;
+    
+    /* Each RU gets a fraction of total capacity */
+    /* For Phase 1, we'll use simple equal division */
+    ru->capacity = (uint64_t)spp->tt_pgs * spp->secsz * spp->secs_per_pg / FDP_DEFAULT_RUHS;
+    
+    /* Initialize write pointer */
+    ru->wp.curline = NULL;
+    ru->wp.ch = 0;
+    ru->wp.lun = 0;
+    ru->wp.pg = 0;
+    ru->wp.blk = 0;
+    ru->wp.pl = 0;
+    
+    /* Initialize free line list for this RU */
+    QTAILQ_INIT(&ru->free_line_list);
+    ru->free_line_cnt = 0;
+}
 
-    ssd->rmap = g_malloc0(sizeof(uint64_t) * spp->tt_pgs);
-    for (int i = 0; i < spp->tt_pgs; i++) {
-        ssd->rmap[i] = INVALID_LPN;
+/* FDP: Initialize configuration */
+void fdp_init_config(struct ssd *ssd)
+{
+    fdp_config_t *cfg = &ssd->fdp_cfg;
+    
+    /* Phase 1: Disable FDP by default until fully implemented */
+    cfg->enabled = false;
+    cfg->nrg = 1;  /* Single Reclaim Group for Phase 1 */
+    cfg->nruh = FDP_DEFAULT_RUHS;  /* 4 RU Handles */
+    cfg->fdpa = 0x1;  /* FDP enabled, RUH type is initially specified */
+    
+    /* Allocate Reclaim Groups */
+    cfg->rgs = g_malloc0(sizeof(fdp_rg_t) * cfg->nrg);
+    
+    /* Initialize the single Reclaim Group */
+    fdp_rg_t *rg = &cfg->rgs[0];
+    rg->rgid = 0;
+    rg->nruh = cfg->nruh;
+    rg->rgslbs = ssd->sp.tt_pgs;  /* Total logical blocks */
+    
+    /* Allocate and initialize Reclaim Units */
+    rg->rus = g_malloc0(sizeof(fdp_ru_t) * rg->nruh);
+    for (int i = 0; i < rg->nruh; i++) {
+        fdp_init_ru(ssd, &rg->rus[i], i, rg->rgid, i);
     }
+    
+    /* Initialize PH to RUHID mapping (1:1 for Phase 1) */
+    for (int i = 0; i < FDP_MAX_PLACEMENT_HANDLES; i++) {
+        if (i < cfg->nruh) {
+            cfg->ph_to_ruhid[i] = i;  /* Direct mapping */
+        } else {
+            cfg->ph_to_ruhid[i] = 0;  /* Default to RU 0 */
+        }
+    }
+    
+    /* Initialize statistics */
+    cfg->total_host_writes = 0;
+    cfg->total_media_writes = 0;
+    cfg->ru_switches = 0;
+    
+    femu_log("[FDP] Initialized: %d RG(s), %d RUH(s) per RG\n", cfg->nrg, cfg->nruh);
 }
 
-void ssd_init(FemuCtrl *n)
+/* FDP: Distribute lines among RUs and initialize write pointers */
+void fdp_distribute_lines(struct ssd *ssd)
+{
+    fdp_config_t *cfg = &ssd->fdp_cfg;
+    struct line_mgmt *lm = &ssd->lm;
+    
+    if (!cfg->enabled) {
+        return;  /* Skip if FDP not enabled */
+    }
+    
+    /* Use actual free line count (may be less than tt_lines if global WP already used some) */
+    int total_lines = lm->free_line_cnt;
+    int lines_per_ru = total_lines / cfg->nruh;
+    int remaining_lines = total_lines % cfg->nruh;
+    
+    ftl_log("[FDP] Distributing %d lines among %d RUs (%d lines/RU, %d get +1)\n",
+            total_lines, cfg->nruh, lines_per_ru, remaining_lines);
+    
+    /* Move lines from global free_line_list to RU-specific lists */
+    for (int ruid = 0; ruid < cfg->nruh; ruid++) {
+        fdp_ru_t *ru = &cfg->rgs[0].rus[ruid];
+        int lines_for_this_ru = lines_per_ru + (ruid < remaining_lines ? 1 : 0);
+        
+        for (int i = 0; i < lines_for_this_ru; i++) {
+            struct line *line = QTAILQ_FIRST(&lm->free_line_list);
+            if (!line) {
+                ftl_err("Ran out of lines during RU distribution!\n");
+                break;
+            }
+            
+            QTAILQ_REMOVE(&lm->free_line_list, line, entry);
+            lm->free_line_cnt--;
+            
+            /* Mark this line as owned by this RU */
+            line->ru_owner = ruid;
+            
+            QTAILQ_INSERT_TAIL(&ru->free_line_list, line, entry);
+            ru->free_line_cnt++;
+        }
+        
+        /* Initialize write pointer for this RU */
+        struct line *first_line = QTAILQ_FIRST(&ru->free_line_list);
+        if (first_line) {
+            QTAILQ_REMOVE(&ru->free_line_list, first_line, entry);
+            ru->free_line_cnt--;
+            
+            ru->wp.curline = first_line;
+            ru->wp.ch = 0;
+            ru->wp.lun = 0;
+            ru->wp.pg = 0;
+            ru->wp.blk = first_line->id;
+            ru->wp.pl = 0;
+            if (wp_blk_bad(ssd, &ru->wp)) {
+                fdp_advance_write_pointer(ssd, ru);
+            }
+            
+            ru->state = NVME_FDP_RUH_HOST_SPEC;  /* Mark as open */
+            
+            ftl_log("[FDP] RU %d: %d lines, first_blk=%d\n",
+                    ruid, ru->free_line_cnt + 1, ru->wp.blk);
+        } else {
+            ftl_err("RU %d has no lines!\n", ruid);
+        }
+    }
+    
+    ftl_log("[FDP] Line distribution complete. Global free_line_cnt=%d\n",
+            lm->free_line_cnt);
+}
+
+/*
+ * Set up the FTL state of n->ssd from the bb_params of @n, without starting
+ * the FTL thread. This is all the standalone FTL simulator needs.
+ */
+void ssd_init_ftl(FemuCtrl *n)
 {
     struct ssd *ssd = n->ssd;
     struct ssdparams *spp = &ssd->sp;
@@ -492,10 +989,12 @@ void ssd_init(FemuCtrl *n)
     ssd_init_params(spp, n);
 
     /* initialize ssd internal layout architecture */
-    ssd->ch = g_malloc0(sizeof(struct ssd_channel) * spp->nchs);
-    for (int i = 0; i < spp->nchs; i++) {
-        ssd_init_ch(&ssd->ch[i], spp);
-    }
+    ssd_init_nand(ssd);
+    ssd_init_bbt(ssd, n->bb_params.bbt_fname);
+
+    /* initialize NAND timing model */
+    init_nand_flash(n);
+    ssd_init_timing(ssd);
 
     /* initialize maptbl */
     ssd_init_maptbl(ssd);
@@ -509,8 +1008,32 @@ void ssd_init(FemuCtrl *n)
     /* initialize write pointer, this is how we allocate new pages for writes */
     ssd_init_write_pointer(ssd);
 
+    ssd_init_slc(ssd);
+
+    ssd->nr_ns = MAX(n->num_namespaces, 1);
+    ssd->ns_st = g_new0(struct ssd_ns_stats, ssd->nr_ns);
+
+    ssd->unmap_ipc = g_new0(int, ssd->lm.tt_lines);
+    ssd->unmap_lines = g_new0(int, ssd->lm.tt_lines);
+
+    ssd->gc_src = g_new(struct ppa, spp->pgs_per_line);
+    ssd->gc_dst = g_new(struct ppa, spp->pgs_per_line);
+    ssd->gc_lun_cnt = g_new0(int, spp->tt_luns + 1);
+
+    ssd->lunq = g_new0(struct ftl_lunq, spp->tt_luns);
+}
+
+void ssd_init(FemuCtrl *n)
+{
+    struct ssd *ssd = n->ssd;
+
+    ssd_init_ftl(n);
+
     qemu_thread_create(&ssd->ftl_thread, "FEMU-FTL-Thread", ftl_thread, n,
                        QEMU_THREAD_JOINABLE);
+    if (femu_thread_pin(&ssd->ftl_thread, &n->ftl_cpuset, -1)) {
+        ftl_err("failed to pin the FTL thread\n");
+    }
 }
 
 static inline bool valid_ppa(struct ssd *ssd, struct ppa *ppa)
@@ -533,7 +1056,7 @@ static inline bool valid_ppa(struct ssd *ssd, struct ppa *ppa)
 
 static inline bool valid_lpn(struct ssd *ssd, uint64_t lpn)
 {
-    return (lpn < ssd->sp.tt_pgs);
+    return (lpn < ssd->sp.tt_lpns);
 }
 
 static inline bool mapped_ppa(struct ppa *ppa)
@@ -541,148 +1064,181 @@ static inline bool mapped_ppa(struct ppa *ppa)
     return !(ppa->ppa == UNMAPPED_PPA);
 }
 
-static inline struct ssd_channel *get_ch(struct ssd *ssd, struct ppa *ppa)
+/* Index of the block of @ppa into the nand_state block arrays */
+static inline uint64_t ppa2blkidx(struct ssd *ssd, struct ppa *ppa)
 {
-    return &(ssd->ch[ppa->g.ch]);
+    return blk_index(&ssd->sp, ppa->g.ch, ppa->g.lun, ppa->g.pl, ppa->g.blk);
 }
 
-static inline struct nand_lun *get_lun(struct ssd *ssd, struct ppa *ppa)
+static inline struct line *get_line(struct ssd *ssd, struct ppa *ppa)
 {
-    struct ssd_channel *ch = get_ch(ssd, ppa);
-    return &(ch->lun[ppa->g.lun]);
+    return &(ssd->lm.lines[ppa->g.blk]);
 }
 
-static inline struct nand_plane *get_pl(struct ssd *ssd, struct ppa *ppa)
+static inline int get_pg_status(struct ssd *ssd, uint64_t pgidx)
 {
-    struct nand_lun *lun = get_lun(ssd, ppa);
-    return &(lun->pl[ppa->g.pl]);
+    return (ssd->nand.pg_st[pgidx / PG_ST_PER_WORD] >>
+            (pgidx % PG_ST_PER_WORD * PG_ST_BITS)) & 3;
 }
 
-static inline struct nand_block *get_blk(struct ssd *ssd, struct ppa *ppa)
+static inline void set_pg_status(struct ssd *ssd, uint64_t pgidx, int status)
 {
-    struct nand_plane *pl = get_pl(ssd, ppa);
-    return &(pl->blk[ppa->g.blk]);
+    uint64_t *w = &ssd->nand.pg_st[pgidx / PG_ST_PER_WORD];
+    int shift = pgidx % PG_ST_PER_WORD * PG_ST_BITS;
+
+    *w = (*w & ~(3ULL << shift)) | ((uint64_t)status << shift);
 }
 
-static inline struct line *get_line(struct ssd *ssd, struct ppa *ppa)
+/* xorshift64* */
+static inline double ssd_rand_double(struct ssd *ssd)
 {
-    return &(ssd->lm.lines[ppa->g.blk]);
+    ssd->rng ^= ssd->rng >> 12;
+    ssd->rng ^= ssd->rng << 25;
+    ssd->rng ^= ssd->rng >> 27;
+    return ((ssd->rng * 0x2545F4914F6CDD1DULL) >> 11) *
+           (1.0 / (1ULL << 53));
+}
+
+/*
+ * Read retry model: the raw bit error rate of a block grows with its P/E
+ * cycles, the age of its data and the reads it took since the erase (read
+ * disturb). Each of them, relative to the rr_* property costing one retry,
+ * adds to the mean of a Poisson distributed retry count, and every retry is
+ * another rr_lat of array time. Past rr_reads reads or SSD_RR_RECLAIM mean
+ * retries, the block's line is queued for read reclaim.
+ */
+static int64_t ssd_read_retry_lat(struct ssd *ssd, struct ppa *ppa,
+                                  uint64_t now)
+{
+    struct ssdparams *spp = &ssd->sp;
+    struct nand_state *nand = &ssd->nand;
+    uint64_t blkidx = ppa2blkidx(ssd, ppa);
+    uint32_t reads = ++nand->blk_rd_cnt[blkidx];
+    struct line *line;
+    double mean, l, p;
+    int n = 0;
+
+    mean = (double)nand->blk_erase_cnt[blkidx] / spp->rr_pe_cycles +
+           (double)reads / spp->rr_reads;
+    if (now > nand->blk_prog_time[blkidx]) {
+        mean += (now - nand->blk_prog_time[blkidx]) / 1e9 / spp->rr_retention;
+    }
+
+    line = get_line(ssd, ppa);
+    if ((reads >= spp->rr_reads || mean >= SSD_RR_RECLAIM) &&
+        !line->reclaim && ssd->nr_rr_q < SSD_RR_QDEPTH) {
+        line->reclaim = true;
+        ssd->rr_q[ssd->nr_rr_q++] = line->id;
+    }
+
+    /* Knuth's Poisson sampling, a read fails over after the last retry */
+    l = exp(-MIN(mean, SSD_RR_MAX_RETRIES));
+    p = ssd_rand_double(ssd);
+    while (p > l && n < SSD_RR_MAX_RETRIES) {
+        p *= ssd_rand_double(ssd);
+        n++;
+    }
+    ssd->nr_read_retries += n;
+
+    return n * spp->rr_lat;
+}
+
+/* Whether an injected NAND failure, @ppm per million operations, hits */
+static inline bool ssd_nand_fails(struct ssd *ssd, int ppm)
+{
+    return ppm && ssd_rand_double(ssd) * 1e6 < ppm;
 }
 
-static inline struct nand_page *get_pg(struct ssd *ssd, struct ppa *ppa)
+/* Take the block of @ppa out of its line for good */
+static void ssd_retire_block(struct ssd *ssd, struct ppa *ppa)
 {
-    struct nand_block *blk = get_blk(ssd, ppa);
-    return &(blk->pg[ppa->g.pg]);
+    ssd->nand.blk_bad[ppa2blkidx(ssd, ppa)] = BLK_BAD;
+    get_line(ssd, ppa)->pgs -= ssd->sp.pgs_per_blk;
+    ssd->nr_bad_blks++;
 }
 
 static uint64_t ssd_advance_status(struct ssd *ssd, struct ppa *ppa, struct
         nand_cmd *ncmd)
 {
-    int c = ncmd->cmd;
-    uint64_t cmd_stime = (ncmd->stime == 0) ? \
-        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) : ncmd->stime;
-    uint64_t nand_stime;
-    struct ssdparams *spp = &ssd->sp;
-    struct nand_lun *lun = get_lun(ssd, ppa);
-    uint64_t lat = 0;
-
-    switch (c) {
-    case NAND_READ:
-        /* read: perform NAND cmd first */
-        nand_stime = (lun->next_lun_avail_time < cmd_stime) ? cmd_stime : \
-                     lun->next_lun_avail_time;
-        lun->next_lun_avail_time = nand_stime + spp->pg_rd_lat;
-        lat = lun->next_lun_avail_time - cmd_stime;
-#if 0
-        lun->next_lun_avail_time = nand_stime + spp->pg_rd_lat;
-
-        /* read: then data transfer through channel */
-        chnl_stime = (ch->next_ch_avail_time < lun->next_lun_avail_time) ? \
-            lun->next_lun_avail_time : ch->next_ch_avail_time;
-        ch->next_ch_avail_time = chnl_stime + spp->ch_xfer_lat;
-
-        lat = ch->next_ch_avail_time - cmd_stime;
-#endif
-        break;
-
-    case NAND_WRITE:
-        /* write: transfer data through channel first */
-        nand_stime = (lun->next_lun_avail_time < cmd_stime) ? cmd_stime : \
-                     lun->next_lun_avail_time;
-        if (ncmd->type == USER_IO) {
-            lun->next_lun_avail_time = nand_stime + spp->pg_wr_lat;
-        } else {
-            lun->next_lun_avail_time = nand_stime + spp->pg_wr_lat;
+    NandTimingCmd tcmd = {
+        .op = ncmd->cmd,
+        .type = ncmd->type,
+        .ch = ppa->g.ch,
+        .lun = ppa->g.lun,
+        .pl = ppa->g.pl,
+        .page_type = ssd_page_type(&ssd->sp, ppa->g.pg),
+        .slc = get_line(ssd, ppa)->slc,
+        .stime = ncmd->stime,
+    };
+    uint64_t nand_etime;
+
+    if (ssd->sp.rr_lat && ncmd->cmd == NAND_READ) {
+        if (!tcmd.stime) {
+            tcmd.stime = nand_timing_now(&ssd->nt);
         }
-        lat = lun->next_lun_avail_time - cmd_stime;
+        tcmd.xlat = ssd_read_retry_lat(ssd, ppa, tcmd.stime);
+    }
 
-#if 0
-        chnl_stime = (ch->next_ch_avail_time < cmd_stime) ? cmd_stime : \
-                     ch->next_ch_avail_time;
-        ch->next_ch_avail_time = chnl_stime + spp->ch_xfer_lat;
+    nand_etime = nand_timing_advance(&ssd->nt, &tcmd);
 
-        /* write: then do NAND program */
-        nand_stime = (lun->next_lun_avail_time < ch->next_ch_avail_time) ? \
-            ch->next_ch_avail_time : lun->next_lun_avail_time;
-        lun->next_lun_avail_time = nand_stime + spp->pg_wr_lat;
+    if (ssd->sp.rr_lat && ncmd->cmd == NAND_WRITE) {
+        ssd->nand.blk_prog_time[ppa2blkidx(ssd, ppa)] = tcmd.stime;
+    }
 
-        lat = lun->next_lun_avail_time - cmd_stime;
-#endif
-        break;
+    return nand_etime - tcmd.stime;
+}
 
-    case NAND_ERASE:
-        /* erase: only need to advance NAND status */
-        nand_stime = (lun->next_lun_avail_time < cmd_stime) ? cmd_stime : \
-                     lun->next_lun_avail_time;
-        lun->next_lun_avail_time = nand_stime + spp->blk_er_lat;
+/*
+ * Host page op at @stime. While the FTL thread splits a request (ssd->split)
+ * it is only queued on its LUN, to be charged by ftl_dispatch(), and costs 0
+ * here; otherwise it is charged right away.
+ */
+static uint64_t ssd_user_page(struct ssd *ssd, struct ppa *ppa, int cmd,
+                              int64_t stime)
+{
+    struct nand_cmd ncmd = { .type = USER_IO, .cmd = cmd, .stime = stime };
+    struct ftl_batch *b = ssd->split;
+    struct ftl_lunq *q;
 
-        lat = lun->next_lun_avail_time - cmd_stime;
-        break;
+    if (!b) {
+        return ssd_advance_status(ssd, ppa, &ncmd);
+    }
 
-    default:
-        ftl_err("Unsupported NAND command: 0x%x\n", c);
+    q = &ssd->lunq[ppa->g.ch * ssd->sp.luns_per_ch + ppa->g.lun];
+    if (q->nr == q->cap) {
+        q->cap = MAX(q->cap * 2, FTL_BATCH);
+        q->op = g_renew(struct ftl_subop, q->op, q->cap);
     }
+    q->op[q->nr++] = (struct ftl_subop) {
+        .ppa = *ppa,
+        .cmd = cmd,
+        .parent = b,
+    };
+    b->pending++;
 
-    return lat;
+    return 0;
 }
 
-/* update SSD status about one page from PG_VALID -> PG_INVALID */
-static void mark_page_invalid(struct ssd *ssd, struct ppa *ppa)
+/* @npgs pages of @line went from PG_VALID -> PG_INVALID */
+static void mark_line_invalid(struct ssd *ssd, struct line *line, int npgs)
 {
     struct line_mgmt *lm = &ssd->lm;
     struct ssdparams *spp = &ssd->sp;
-    struct nand_block *blk = NULL;
-    struct nand_page *pg = NULL;
     bool was_full_line = false;
-    struct line *line;
-
-    /* update corresponding page status */
-    pg = get_pg(ssd, ppa);
-    ftl_assert(pg->status == PG_VALID);
-    pg->status = PG_INVALID;
-
-    /* update corresponding block status */
-    blk = get_blk(ssd, ppa);
-    ftl_assert(blk->ipc >= 0 && blk->ipc < spp->pgs_per_blk);
-    blk->ipc++;
-    ftl_assert(blk->vpc > 0 && blk->vpc <= spp->pgs_per_blk);
-    blk->vpc--;
 
-    /* update corresponding line status */
-    line = get_line(ssd, ppa);
-    ftl_assert(line->ipc >= 0 && line->ipc < spp->pgs_per_line);
-    if (line->vpc == spp->pgs_per_line) {
+    ftl_assert(line->ipc >= 0 && line->ipc + npgs <= line->pgs);
+    if (line->vpc == line->pgs) {
         ftl_assert(line->ipc == 0);
         was_full_line = true;
     }
-    line->ipc++;
-    ftl_assert(line->vpc > 0 && line->vpc <= spp->pgs_per_line);
+    line->ipc += npgs;
+    ftl_assert(line->vpc >= npgs && line->vpc <= line->pgs);
     /* Adjust the position of the victime line in the pq under over-writes */
     if (line->pos) {
         /* Note that line->vpc will be updated by this call */
-        pqueue_change_priority(lm->victim_line_pq, line->vpc - 1, line);
+        pqueue_change_priority(lm->victim_line_pq, line->vpc - npgs, line);
     } else {
-        line->vpc--;
+        line->vpc -= npgs;
     }
 
     if (was_full_line) {
@@ -694,46 +1250,79 @@ static void mark_page_invalid(struct ssd *ssd, struct ppa *ppa)
     }
 }
 
-static void mark_page_valid(struct ssd *ssd, struct ppa *ppa)
+/* update page and block status from PG_VALID -> PG_INVALID, but not line's */
+static struct line *mark_page_invalid_nl(struct ssd *ssd, struct ppa *ppa)
 {
-    struct nand_block *blk = NULL;
-    struct nand_page *pg = NULL;
+    struct nand_state *nand = &ssd->nand;
+    uint64_t pgidx = ppa2pgidx(ssd, ppa);
+    uint64_t blkidx = ppa2blkidx(ssd, ppa);
+
+    /* update corresponding page status */
+    ftl_assert(get_pg_status(ssd, pgidx) == PG_VALID);
+    set_pg_status(ssd, pgidx, PG_INVALID);
+
+    /* update corresponding block status */
+    ftl_assert(nand->blk_ipc[blkidx] >= 0 &&
+               nand->blk_ipc[blkidx] < ssd->sp.pgs_per_blk);
+    nand->blk_ipc[blkidx]++;
+    ftl_assert(nand->blk_vpc[blkidx] > 0 &&
+               nand->blk_vpc[blkidx] <= ssd->sp.pgs_per_blk);
+    nand->blk_vpc[blkidx]--;
+
+    return get_line(ssd, ppa);
+}
+
+/* update SSD status about one page from PG_VALID -> PG_INVALID */
+static void mark_page_invalid(struct ssd *ssd, struct ppa *ppa)
+{
+    mark_line_invalid(ssd, mark_page_invalid_nl(ssd, ppa), 1);
+}
+
+static void mark_page_valid(struct ssd *ssd, struct ppa *ppa)
+{
+    uint64_t pgidx = ppa2pgidx(ssd, ppa);
+    uint64_t blkidx = ppa2blkidx(ssd, ppa);
     struct line *line;
 
     /* update page status */
-    pg = get_pg(ssd, ppa);
-    ftl_assert(pg->status == PG_FREE);
-    pg->status = PG_VALID;
+    ftl_assert(get_pg_status(ssd, pgidx) == PG_FREE);
+    set_pg_status(ssd, pgidx, PG_VALID);
 
     /* update corresponding block status */
-    blk = get_blk(ssd, ppa);
-    ftl_assert(blk->vpc >= 0 && blk->vpc < ssd->sp.pgs_per_blk);
-    blk->vpc++;
+    ftl_assert(ssd->nand.blk_vpc[blkidx] >= 0 &&
+               ssd->nand.blk_vpc[blkidx] < ssd->sp.pgs_per_blk);
+    ssd->nand.blk_vpc[blkidx]++;
 
     /* update corresponding line status */
     line = get_line(ssd, ppa);
-    ftl_assert(line->vpc >= 0 && line->vpc < ssd->sp.pgs_per_line);
+    ftl_assert(line->vpc >= 0 && line->vpc < line->pgs);
     line->vpc++;
 }
 
 static void mark_block_free(struct ssd *ssd, struct ppa *ppa)
 {
     struct ssdparams *spp = &ssd->sp;
-    struct nand_block *blk = get_blk(ssd, ppa);
-    struct nand_page *pg = NULL;
-
-    for (int i = 0; i < spp->pgs_per_blk; i++) {
-        /* reset page status */
-        pg = &blk->pg[i];
-        ftl_assert(pg->nsecs == spp->secs_per_pg);
-        pg->status = PG_FREE;
+    uint64_t blkidx = ppa2blkidx(ssd, ppa);
+    uint64_t pgidx = blkidx * spp->pgs_per_blk;
+    uint64_t end = pgidx + spp->pgs_per_blk;
+
+    /* reset page status, whole words at a time where the block covers them */
+    while (pgidx < end) {
+        if (pgidx % PG_ST_PER_WORD == 0 && end - pgidx >= PG_ST_PER_WORD) {
+            ssd->nand.pg_st[pgidx / PG_ST_PER_WORD] = 0;
+            pgidx += PG_ST_PER_WORD;
+        } else {
+            set_pg_status(ssd, pgidx++, PG_FREE);
+        }
     }
 
     /* reset block status */
-    ftl_assert(blk->npgs == spp->pgs_per_blk);
-    blk->ipc = 0;
-    blk->vpc = 0;
-    blk->erase_cnt++;
+    ssd->nand.blk_ipc[blkidx] = 0;
+    ssd->nand.blk_vpc[blkidx] = 0;
+    ssd->nand.blk_erase_cnt[blkidx]++;
+    if (ssd->nand.blk_rd_cnt) {
+        ssd->nand.blk_rd_cnt[blkidx] = 0;
+    }
 }
 
 static void gc_read_page(struct ssd *ssd, struct ppa *ppa)
@@ -748,11 +1337,13 @@ static void gc_read_page(struct ssd *ssd, struct ppa *ppa)
     }
 }
 
-/* move valid page data (already in DRAM) from victim line to a new page */
-static uint64_t gc_write_page(struct ssd *ssd, struct ppa *old_ppa)
+/*
+ * move valid page data (already in DRAM) from victim line to a new page,
+ * returning it; the program itself is charged by gc_write_pages()
+ */
+static struct ppa gc_move_page(struct ssd *ssd, struct ppa *old_ppa)
 {
     struct ppa new_ppa;
-    struct nand_lun *new_lun;
     uint64_t lpn = get_rmap_ent(ssd, old_ppa);
 
     ftl_assert(valid_lpn(ssd, lpn));
@@ -766,25 +1357,40 @@ static uint64_t gc_write_page(struct ssd *ssd, struct ppa *old_ppa)
 
     /* need to advance the write pointer here */
     ssd_advance_write_pointer(ssd);
+    ssd->nr_gc_pgs_wr++;
 
-    if (ssd->sp.enable_gc_delay) {
-        struct nand_cmd gcw;
-        gcw.type = GC_IO;
-        gcw.cmd = NAND_WRITE;
-        gcw.stime = 0;
-        ssd_advance_status(ssd, &new_ppa, &gcw);
-    }
+    return new_ppa;
+}
 
-    /* advance per-ch gc_endtime as well */
-#if 0
-    new_ch = get_ch(ssd, &new_ppa);
-    new_ch->gc_endtime = new_ch->next_ch_avail_time;
-#endif
+/*
+ * Program the @nr relocated pages of ssd->gc_dst, one destination LUN after
+ * the other (counting sort into ssd->gc_src, no longer needed by then)
+ */
+static void gc_write_pages(struct ssd *ssd, int nr)
+{
+    struct ssdparams *spp = &ssd->sp;
+    int *cnt = ssd->gc_lun_cnt;
+    struct nand_cmd gcw;
+    int lun;
 
-    new_lun = get_lun(ssd, &new_ppa);
-    new_lun->gc_endtime = new_lun->next_lun_avail_time;
+    memset(cnt, 0, sizeof(int) * (spp->tt_luns + 1));
+    for (int i = 0; i < nr; i++) {
+        cnt[ssd->gc_dst[i].g.ch * spp->luns_per_ch + ssd->gc_dst[i].g.lun + 1]++;
+    }
+    for (lun = 1; lun <= spp->tt_luns; lun++) {
+        cnt[lun] += cnt[lun - 1];
+    }
+    for (int i = 0; i < nr; i++) {
+        lun = ssd->gc_dst[i].g.ch * spp->luns_per_ch + ssd->gc_dst[i].g.lun;
+        ssd->gc_src[cnt[lun]++] = ssd->gc_dst[i];
+    }
 
-    return 0;
+    gcw.type = GC_IO;
+    gcw.cmd = NAND_WRITE;
+    gcw.stime = 0;
+    for (int i = 0; i < nr; i++) {
+        ssd_advance_status(ssd, &ssd->gc_src[i], &gcw);
+    }
 }
 
 static struct line *select_victim_line(struct ssd *ssd, bool force)
@@ -797,7 +1403,7 @@ static struct line *select_victim_line(struct ssd *ssd, bool force)
         return NULL;
     }
 
-    if (!force && victim_line->ipc < ssd->sp.pgs_per_line / 8) {
+    if (!force && victim_line->ipc < victim_line->pgs / 8) {
         return NULL;
     }
 
@@ -809,27 +1415,71 @@ static struct line *select_victim_line(struct ssd *ssd, bool force)
     return victim_line;
 }
 
-/* here ppa identifies the block we want to clean */
-static void clean_one_block(struct ssd *ssd, struct ppa *ppa)
+/*
+ * here ppa identifies the block we want to clean: append its valid pages to
+ * @out and return how many. Valid pages are found a status word (32 pages)
+ * at a time, runs of invalid pages cost nothing.
+ */
+static int gc_collect_block(struct ssd *ssd, struct ppa *ppa, struct ppa *out)
 {
     struct ssdparams *spp = &ssd->sp;
-    struct nand_page *pg_iter = NULL;
-    int cnt = 0;
-
-    for (int pg = 0; pg < spp->pgs_per_blk; pg++) {
-        ppa->g.pg = pg;
-        pg_iter = get_pg(ssd, ppa);
-        /* there shouldn't be any free page in victim blocks */
-        ftl_assert(pg_iter->status != PG_FREE);
-        if (pg_iter->status == PG_VALID) {
-            gc_read_page(ssd, ppa);
-            /* delay the maptbl update until "write" happens */
-            gc_write_page(ssd, ppa);
+    uint64_t blkidx = ppa2blkidx(ssd, ppa);
+    uint64_t first = blkidx * spp->pgs_per_blk;
+    uint64_t end = first + spp->pgs_per_blk;
+    uint64_t pgidx = first;
+    uint64_t w, valid;
+    int nr, cnt = 0;
+
+    if (!ssd->nand.blk_vpc[blkidx]) {
+        return 0;
+    }
+
+    while (pgidx < end) {
+        nr = MIN(PG_ST_PER_WORD - pgidx % PG_ST_PER_WORD, end - pgidx);
+        w = ssd->nand.pg_st[pgidx / PG_ST_PER_WORD] >>
+            (pgidx % PG_ST_PER_WORD * PG_ST_BITS);
+        if (nr < PG_ST_PER_WORD) {
+            w &= (1ULL << (nr * PG_ST_BITS)) - 1;
+        }
+        /* PG_VALID is 0b10: the high bit of the page's pair only */
+        valid = (w >> 1) & ~w & 0x5555555555555555ULL;
+
+        while (valid) {
+            out[cnt] = *ppa;
+            out[cnt].g.pg = pgidx - first + ctz64(valid) / PG_ST_BITS;
             cnt++;
+            valid &= valid - 1;
         }
+        pgidx += nr;
+    }
+
+    ftl_assert(ssd->nand.blk_vpc[blkidx] == cnt);
+
+    return cnt;
+}
+
+/*
+ * Dynamic wear leveling (wl_thres > 0): free lines are taken from the head,
+ * so keep each free list in erase_cnt order. A line just erased is usually
+ * among the most worn, hence the search from the tail.
+ */
+static void free_line_insert(struct ssd *ssd, struct free_line_list *list,
+                             struct line *line)
+{
+    struct line *prev;
+
+    if (!ssd->sp.wl_thres) {
+        QTAILQ_INSERT_TAIL(list, line, entry);
+        return;
     }
 
-    ftl_assert(get_blk(ssd, ppa)->vpc == cnt);
+    QTAILQ_FOREACH_REVERSE(prev, list, entry) {
+        if (prev->erase_cnt <= line->erase_cnt) {
+            QTAILQ_INSERT_AFTER(list, prev, line, entry);
+            return;
+        }
+    }
+    QTAILQ_INSERT_HEAD(list, line, entry);
 }
 
 static void mark_line_free(struct ssd *ssd, struct ppa *ppa)
@@ -838,50 +1488,93 @@ static void mark_line_free(struct ssd *ssd, struct ppa *ppa)
     struct line *line = get_line(ssd, ppa);
     line->ipc = 0;
     line->vpc = 0;
+    line->erase_cnt++;
+    lm->max_erase_cnt = MAX(lm->max_erase_cnt, line->erase_cnt);
+    lm->nr_erases++;
+    line->reclaim = false;
+
+    if (!line->pgs) {
+        /* every block retired, the line is gone */
+        if (line->slc) {
+            line->slc = false;
+            ssd->slc.nr_lines--;
+        }
+        return;
+    }
+
+    if (line->slc) {
+        struct slc_cache *sc = &ssd->slc;
+
+        if (ssd->sp.slc_mode == SSD_SLC_STATIC) {
+            free_line_insert(ssd, &sc->free_line_list, line);
+            sc->free_line_cnt++;
+            return;
+        }
+        /* dynamic mode hands the line back as a regular one */
+        line->slc = false;
+        sc->nr_lines--;
+    }
     
     /* FDP: Return line to its original RU owner if FDP is enabled */
     fdp_config_t *cfg = &ssd->fdp_cfg;
     if (cfg->enabled && line->ru_owner != 0xFF && line->ru_owner < cfg->nruh) {
         /* Return to RU-specific free list */
         fdp_ru_t *ru = &cfg->rgs[0].rus[line->ru_owner];
-        QTAILQ_INSERT_TAIL(&ru->free_line_list, line, entry);
+        free_line_insert(ssd, &ru->free_line_list, line);
         ru->free_line_cnt++;
         ftl_debug("GC: Returned line %d to RU %d (now has %d free lines)\n",
                   line->id, line->ru_owner, ru->free_line_cnt);
     } else {
         /* Return to global free line list */
-        QTAILQ_INSERT_TAIL(&lm->free_line_list, line, entry);
+        free_line_insert(ssd, &lm->free_line_list, line);
         lm->free_line_cnt++;
     }
 }
 
-static int do_gc(struct ssd *ssd, bool force)
+/* Move the valid pages of @line elsewhere, erase it and free it */
+static void ssd_reclaim_line(struct ssd *ssd, struct line *line)
 {
-    struct line *victim_line = NULL;
     struct ssdparams *spp = &ssd->sp;
-    struct nand_lun *lunp;
     struct ppa ppa;
-    int ch, lun;
+    uint8_t *bad;
+    int ch, lun, nr = 0;
 
-    victim_line = select_victim_line(ssd, force);
-    if (!victim_line) {
-        return -1;
+    ppa.g.blk = line->id;
+
+    /* gather the valid pages of the line, block by block */
+    ppa.g.pl = 0;
+    for (ch = 0; ch < spp->nchs; ch++) {
+        for (lun = 0; lun < spp->luns_per_ch; lun++) {
+            ppa.g.ch = ch;
+            ppa.g.lun = lun;
+            nr += gc_collect_block(ssd, &ppa, &ssd->gc_src[nr]);
+        }
     }
 
-    ppa.g.blk = victim_line->id;
-    ftl_debug("GC-ing line:%d,ipc=%d,victim=%d,full=%d,free=%d\n", ppa.g.blk,
-              victim_line->ipc, ssd->lm.victim_line_cnt, ssd->lm.full_line_cnt,
-              ssd->lm.free_line_cnt);
+    /* copy back valid data: all reads, then the programs per LUN */
+    for (int i = 0; i < nr; i++) {
+        gc_read_page(ssd, &ssd->gc_src[i]);
+    }
+    for (int i = 0; i < nr; i++) {
+        ssd->gc_dst[i] = gc_move_page(ssd, &ssd->gc_src[i]);
+    }
+    if (spp->enable_gc_delay) {
+        gc_write_pages(ssd, nr);
+    }
 
-    /* copy back valid data */
     for (ch = 0; ch < spp->nchs; ch++) {
         for (lun = 0; lun < spp->luns_per_ch; lun++) {
             ppa.g.ch = ch;
             ppa.g.lun = lun;
-            ppa.g.pl = 0;
-            lunp = get_lun(ssd, &ppa);
-            clean_one_block(ssd, &ppa);
+            bad = &ssd->nand.blk_bad[ppa2blkidx(ssd, &ppa)];
+            if (*bad == BLK_BAD) {
+                continue;
+            }
             mark_block_free(ssd, &ppa);
+            if (*bad == BLK_FAILING) {
+                ssd_retire_block(ssd, &ppa);
+                continue;
+            }
 
             if (spp->enable_gc_delay) {
                 struct nand_cmd gce;
@@ -890,33 +1583,256 @@ static int do_gc(struct ssd *ssd, bool force)
                 gce.stime = 0;
                 ssd_advance_status(ssd, &ppa, &gce);
             }
-
-            lunp->gc_endtime = lunp->next_lun_avail_time;
+            if (ssd_nand_fails(ssd, spp->ers_fail_ppm)) {
+                ssd->nr_ers_fails++;
+                ssd_retire_block(ssd, &ppa);
+            }
         }
     }
 
     /* update line status */
     mark_line_free(ssd, &ppa);
+}
+
+static int do_gc(struct ssd *ssd, bool force)
+{
+    struct line *victim_line = NULL;
+
+    victim_line = select_victim_line(ssd, force);
+    if (!victim_line) {
+        return -1;
+    }
+
+    ssd->nr_gc++;
+    if (force) {
+        ssd->nr_gc_forced++;
+    }
+
+    ftl_debug("GC-ing line:%d,ipc=%d,victim=%d,full=%d,free=%d\n",
+              victim_line->id, victim_line->ipc, ssd->lm.victim_line_cnt,
+              ssd->lm.full_line_cnt, ssd->lm.free_line_cnt);
+    ssd_reclaim_line(ssd, victim_line);
 
     return 0;
 }
 
-static uint64_t ssd_read(struct ssd *ssd, NvmeRequest *req)
+/*
+ * Static wear leveling: a line that is still full was never overwritten and
+ * holds cold data, its blocks sit out the rotation of the free lists. Once
+ * the least worn full line trails the most worn line by wl_thres erases, its
+ * data is moved away like GC moves it, charged to the dies the same way, and
+ * the line goes back to the head of its free list. Checked once per line
+ * erase, not per request, and the full lines are only scanned once the lower
+ * bound lm->full_min_erase_cnt says the gap may have reached wl_thres.
+ */
+static bool ssd_wear_level(struct ssd *ssd)
+{
+    struct line_mgmt *lm = &ssd->lm;
+    struct line *line, *cold = NULL;
+
+    if (!ssd->sp.wl_thres || ssd->wl_erases == lm->nr_erases ||
+        should_gc(ssd)) {
+        return false;
+    }
+    ssd->wl_erases = lm->nr_erases;
+    if (lm->max_erase_cnt - lm->full_min_erase_cnt < ssd->sp.wl_thres) {
+        return false;
+    }
+
+    QTAILQ_FOREACH(line, &lm->full_line_list, entry) {
+        if (!cold || line->erase_cnt < cold->erase_cnt) {
+            cold = line;
+        }
+    }
+    /* lines leaving the list only raise the minimum, new ones lower it */
+    lm->full_min_erase_cnt = cold ? cold->erase_cnt : lm->max_erase_cnt;
+    if (!cold || lm->max_erase_cnt - cold->erase_cnt < ssd->sp.wl_thres) {
+        return false;
+    }
+
+    ftl_debug("WL-ing line:%d,erase_cnt=%d,max=%d\n", cold->id,
+              cold->erase_cnt, lm->max_erase_cnt);
+    QTAILQ_REMOVE(&lm->full_line_list, cold, entry);
+    lm->full_line_cnt--;
+    ssd->nr_wl++;
+    ssd_reclaim_line(ssd, cold);
+
+    return true;
+}
+
+/*
+ * Unmap [start_lpn, end_lpn]; returns how many pages were mapped. Pages and
+ * blocks are invalidated as we go, lines once at the end, so a large range
+ * costs one victim queue update per line rather than one per page.
+ */
+static uint64_t ssd_unmap_lpns(struct ssd *ssd, uint64_t start_lpn,
+                               uint64_t end_lpn)
+{
+    struct line_mgmt *lm = &ssd->lm;
+    struct line *line;
+    struct ppa ppa;
+    uint64_t lpn;
+    uint64_t trimmed_pages = 0;
+    int nr_lines = 0;
+
+    for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
+        ppa = get_maptbl_ent(ssd, lpn);
+
+        // Skip already unmapped/invalid pages
+        if (!mapped_ppa(&ppa) || !valid_ppa(ssd, &ppa)) {
+            continue;
+        }
+
+        // Invalidate the existing mapped page, its line is done below
+        line = mark_page_invalid_nl(ssd, &ppa);
+        if (!ssd->unmap_ipc[line->id]++) {
+            ssd->unmap_lines[nr_lines++] = line->id;
+        }
+
+        // Clear reverse mapping
+        set_rmap_ent(ssd, INVALID_LPN, &ppa);
+
+        // Set mapping table entry as unmapped
+        ppa.ppa = UNMAPPED_PPA;
+        set_maptbl_ent(ssd, lpn, &ppa);
+
+        trimmed_pages++;
+    }
+
+    for (int i = 0; i < nr_lines; i++) {
+        int id = ssd->unmap_lines[i];
+
+        mark_line_invalid(ssd, &lm->lines[id], ssd->unmap_ipc[id]);
+        ssd->unmap_ipc[id] = 0;
+    }
+
+    return trimmed_pages;
+}
+
+/* Unmap [start_lpn, end_lpn] on behalf of @ns, which may be SSD_UNMAP_NONS */
+static uint64_t ssd_unmap_ns(struct ssd *ssd, uint64_t start_lpn,
+                             uint64_t end_lpn, int ns)
+{
+    uint64_t trimmed_pages = ssd_unmap_lpns(ssd, start_lpn, end_lpn);
+
+    if (ns != SSD_UNMAP_NONS) {
+        ssd->ns_st[ns].valid_pgs -= trimmed_pages;
+    }
+
+    return trimmed_pages;
+}
+
+/* Unmap the rest of queued unmap @i now and drop it from the queue */
+static void ssd_unmap_finish(struct ssd *ssd, int i)
+{
+    struct ssd_unmap *u = &ssd->unmap_q[i];
+
+    ssd_unmap_ns(ssd, u->start_lpn, u->end_lpn, u->ns);
+    ssd->unmap_q[i] = ssd->unmap_q[--ssd->nr_unmap];
+}
+
+/*
+ * Unmap the part of the queued unmaps overlapping [start_lpn, end_lpn] before
+ * I/O to it. What lies either side stays queued: the head in place, the tail
+ * in a new slot, or unmapped right away when the queue is full.
+ */
+static inline void ssd_unmap_sync(struct ssd *ssd, uint64_t start_lpn,
+                                  uint64_t end_lpn)
+{
+    int i = 0;
+
+    while (i < ssd->nr_unmap) {
+        struct ssd_unmap *u = &ssd->unmap_q[i];
+        struct ssd_unmap tail = *u;
+
+        if (u->start_lpn > end_lpn || start_lpn > u->end_lpn) {
+            i++;
+            continue;
+        }
+
+        ssd_unmap_ns(ssd, MAX(u->start_lpn, start_lpn),
+                     MIN(u->end_lpn, end_lpn), u->ns);
+        tail.start_lpn = end_lpn + 1;
+
+        if (u->start_lpn < start_lpn) {
+            u->end_lpn = start_lpn - 1;
+            i++;
+        } else {
+            ssd->unmap_q[i] = ssd->unmap_q[--ssd->nr_unmap];
+        }
+
+        if (tail.start_lpn > tail.end_lpn) {
+            continue;
+        }
+        if (ssd->nr_unmap < SSD_UNMAP_QDEPTH) {
+            ssd->unmap_q[ssd->nr_unmap++] = tail;
+        } else {
+            ssd_unmap_ns(ssd, tail.start_lpn, tail.end_lpn, tail.ns);
+        }
+    }
+}
+
+/* Queue [start_lpn, end_lpn] of @ns for the FTL thread to unmap */
+static void ssd_unmap_queue(struct ssd *ssd, uint64_t start_lpn,
+                            uint64_t end_lpn, int ns)
+{
+    if (ssd->nr_unmap == SSD_UNMAP_QDEPTH) {
+        ssd_unmap_finish(ssd, 0);
+    }
+    ssd->unmap_q[ssd->nr_unmap++] = (struct ssd_unmap) {
+        .start_lpn = start_lpn,
+        .end_lpn = end_lpn,
+        .ns = ns,
+    };
+}
+
+/* Unmap [start_lpn, end_lpn] of namespace @ns, in the background if large */
+static uint64_t ssd_unmap(struct ssd *ssd, uint64_t start_lpn,
+                          uint64_t end_lpn, int ns)
+{
+    if (end_lpn - start_lpn < SSD_UNMAP_BATCH) {
+        ssd_unmap_sync(ssd, start_lpn, end_lpn);
+        return ssd_unmap_ns(ssd, start_lpn, end_lpn, ns);
+    }
+
+    ssd_unmap_queue(ssd, start_lpn, end_lpn, ns);
+
+    return 0;
+}
+
+/* Unmap up to SSD_UNMAP_BATCH queued pages; false if there was nothing */
+bool ssd_bg_unmap(struct ssd *ssd)
+{
+    struct ssd_unmap *u;
+    uint64_t end_lpn;
+
+    if (!ssd->nr_unmap) {
+        return false;
+    }
+
+    u = &ssd->unmap_q[ssd->nr_unmap - 1];
+    end_lpn = MIN(u->end_lpn, u->start_lpn + SSD_UNMAP_BATCH - 1);
+    ssd_unmap_ns(ssd, u->start_lpn, end_lpn, u->ns);
+    u->start_lpn = end_lpn + 1;
+    if (u->start_lpn > u->end_lpn) {
+        ssd->nr_unmap--;
+    }
+
+    return true;
+}
+
+/* Read the mapped pages of [start_lpn, end_lpn] issued at @stime */
+static uint64_t ssd_read_lpns(struct ssd *ssd, uint64_t start_lpn,
+                              uint64_t end_lpn, int64_t stime)
 {
-    struct ssdparams *spp = &ssd->sp;
-    uint64_t lba = req->slba;
-    int nsecs = req->nlb;
     struct ppa ppa;
-    uint64_t start_lpn = lba / spp->secs_per_pg;
-    uint64_t end_lpn = (lba + nsecs - 1) / spp->secs_per_pg;
     uint64_t lpn;
     uint64_t sublat, maxlat = 0;
 
-    if (end_lpn >= spp->tt_pgs) {
-        ftl_err("start_lpn=%"PRIu64",tt_pgs=%d\n", start_lpn, ssd->sp.tt_pgs);
+    if (ssd->nr_unmap) {
+        ssd_unmap_sync(ssd, start_lpn, end_lpn);
     }
 
-    /* normal IO read path */
     for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
         ppa = get_maptbl_ent(ssd, lpn);
         if (!mapped_ppa(&ppa) || !valid_ppa(ssd, &ppa)) {
@@ -926,42 +1842,144 @@ static uint64_t ssd_read(struct ssd *ssd, NvmeRequest *req)
             continue;
         }
 
-        struct nand_cmd srd;
-        srd.type = USER_IO;
-        srd.cmd = NAND_READ;
-        srd.stime = req->stime;
-        sublat = ssd_advance_status(ssd, &ppa, &srd);
+        sublat = ssd_user_page(ssd, &ppa, NAND_READ, stime);
         maxlat = (sublat > maxlat) ? sublat : maxlat;
     }
 
     return maxlat;
 }
 
-static uint64_t ssd_write(struct ssd *ssd, NvmeRequest *req)
+static uint64_t ssd_read(struct ssd *ssd, NvmeRequest *req)
 {
-    uint64_t lba = req->slba;
     struct ssdparams *spp = &ssd->sp;
-    int len = req->nlb;
+    uint64_t lba = ssd_req_lba(req, req->slba);
+    int nsecs = req->nlb;
     uint64_t start_lpn = lba / spp->secs_per_pg;
-    uint64_t end_lpn = (lba + len - 1) / spp->secs_per_pg;
-    struct ppa ppa;
-    uint64_t lpn;
-    uint64_t curlat = 0, maxlat = 0;
-    int r;
+    uint64_t end_lpn = (lba + nsecs - 1) / spp->secs_per_pg;
 
-    if (end_lpn >= spp->tt_pgs) {
-        ftl_err("start_lpn=%"PRIu64",tt_pgs=%d\n", start_lpn, ssd->sp.tt_pgs);
+    if (end_lpn >= spp->tt_lpns) {
+        ftl_err("start_lpn=%"PRIu64",tt_lpns=%"PRIu64"\n", start_lpn,
+                ssd->sp.tt_lpns);
+        return 0;
     }
 
+    /* normal IO read path */
+    return ssd_read_lpns(ssd, start_lpn, end_lpn, req->stime);
+}
+
+static void ssd_gc_before_write(struct ssd *ssd)
+{
     while (should_gc_high(ssd)) {
         /* perform GC here until !should_gc(ssd) */
-        r = do_gc(ssd, true);
-        if (r == -1)
+        if (do_gc(ssd, true) == -1) {
             break;
+        }
     }
+}
+
+/*
+ * Injected program failure of the page just written at @ppa: the page is
+ * dropped and its block takes no more writes, to be retired on its erase
+ */
+static bool ssd_program_failed(struct ssd *ssd, struct ppa *ppa)
+{
+    if (!ssd_nand_fails(ssd, ssd->sp.pgm_fail_ppm)) {
+        return false;
+    }
+
+    ssd->nr_pgm_fails++;
+    mark_page_invalid(ssd, ppa);
+    set_rmap_ent(ssd, INVALID_LPN, ppa);
+    ssd->nand.blk_bad[ppa2blkidx(ssd, ppa)] = BLK_FAILING;
+
+    return true;
+}
+
+/* Program [start_lpn, end_lpn] of @req's namespace into @ru, at @stime */
+static uint64_t ssd_write_lpns(struct ssd *ssd, NvmeRequest *req,
+                               fdp_ru_t *ru, uint64_t start_lpn,
+                               uint64_t end_lpn, int64_t stime)
+{
+    struct ssd_ns_stats *nst = &ssd->ns_st[ssd_req_ns(req)];
+    struct ssdparams *spp = &ssd->sp;
+    bool fdp_enabled = ssd->fdp_cfg.enabled;
+    struct ppa ppa;
+    uint64_t lpn;
+    uint64_t curlat = 0, maxlat = 0;
+    bool slc = false;
+
+    if (ssd->nr_unmap) {
+        ssd_unmap_sync(ssd, start_lpn, end_lpn);
+    }
+
+    for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
+        ppa = get_maptbl_ent(ssd, lpn);
+        if (mapped_ppa(&ppa)) {
+            /* update old page information first */
+            mark_page_invalid(ssd, &ppa);
+            set_rmap_ent(ssd, INVALID_LPN, &ppa);
+        } else {
+            nst->valid_pgs++;
+        }
+        ssd->nr_host_pgs_wr++;
+        nst->host_pgs_wr++;
+
+        /* a failed program is retried on the next page */
+        do {
+            /* FDP: Get new page from RU-specific or global write pointer */
+            if (fdp_enabled) {
+                ppa = fdp_get_new_page(ssd, ru);
+            } else if ((slc = slc_get_new_page(ssd, &ppa))) {
+                /* absorbed by the SLC cache */
+            } else {
+                ppa = get_new_page(ssd);
+            }
+
+            /* update maptbl */
+            set_maptbl_ent(ssd, lpn, &ppa);
+            /* update rmap */
+            set_rmap_ent(ssd, lpn, &ppa);
+
+            mark_page_valid(ssd, &ppa);
+
+            /* FDP: Advance RU-specific or global write pointer */
+            if (fdp_enabled) {
+                fdp_advance_write_pointer(ssd, ru);
+                ru->bytes_written += spp->secsz * spp->secs_per_pg;
+                ssd->fdp_cfg.total_host_writes++;
+            } else if (slc) {
+                slc_advance_write_pointer(ssd);
+            } else {
+                ssd_advance_write_pointer(ssd);
+            }
+
+            /* get latency statistics */
+            curlat = ssd_user_page(ssd, &ppa, NAND_WRITE, stime);
+            maxlat = (curlat > maxlat) ? curlat : maxlat;
+        } while (ssd_program_failed(ssd, &ppa));
+    }
+
+    return maxlat;
+}
+
+static uint64_t ssd_write(struct ssd *ssd, NvmeRequest *req)
+{
+    uint64_t lba = ssd_req_lba(req, req->slba);
+    struct ssdparams *spp = &ssd->sp;
+    int len = req->nlb;
+    uint64_t start_lpn = lba / spp->secs_per_pg;
+    uint64_t end_lpn = (lba + len - 1) / spp->secs_per_pg;
+
+    if (end_lpn >= spp->tt_lpns) {
+        ftl_err("start_lpn=%"PRIu64",tt_lpns=%"PRIu64"\n", start_lpn,
+                ssd->sp.tt_lpns);
+        return 0;
+    }
+
+    ssd_gc_before_write(ssd);
 
     /* FDP: Get Reclaim Unit based on Placement Handle */
-    fdp_ru_t *ru = fdp_get_ru_by_ph(ssd, req->fdp_ph);
+    fdp_ru_t *ru = fdp_get_ru_by_ph(ssd, req->fdp_ph, ssd_req_ns(req));
     bool fdp_enabled = ssd->fdp_cfg.enabled;
     
     /* Log FDP writes (visible in guest dmesg via femu_log) */
@@ -975,47 +1993,52 @@ static uint64_t ssd_write(struct ssd *ssd, NvmeRequest *req)
                   req->fdp_ph, ru->ruhid, start_lpn, end_lpn);
     }
 
-    for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
-        ppa = get_maptbl_ent(ssd, lpn);
-        if (mapped_ppa(&ppa)) {
-            /* update old page information first */
-            mark_page_invalid(ssd, &ppa);
-            set_rmap_ent(ssd, INVALID_LPN, &ppa);
-        }
-
-        /* FDP: Get new page from RU-specific or global write pointer */
-        if (fdp_enabled) {
-            ppa = fdp_get_new_page(ssd, ru);
-        } else {
-            ppa = get_new_page(ssd);
-        }
-        
-        /* update maptbl */
-        set_maptbl_ent(ssd, lpn, &ppa);
-        /* update rmap */
-        set_rmap_ent(ssd, lpn, &ppa);
+    return ssd_write_lpns(ssd, req, ru, start_lpn, end_lpn, req->stime);
+}
 
-        mark_page_valid(ssd, &ppa);
+/*
+ * Copy: read the source ranges, then program the destination once the last
+ * read is done, into the RU of the copy's placement handle. nvme_copy()
+ * already moved the data.
+ */
+static uint64_t ssd_copy(struct ssd *ssd, NvmeRequest *req)
+{
+    struct ssdparams *spp = &ssd->sp;
+    NvmeDsmRange *ranges = req->dsm_ranges;
+    uint64_t lba, start_lpn, end_lpn, total = 0;
+    uint64_t lat, rdlat = 0, wrlat = 0;
+    fdp_ru_t *ru;
+
+    for (int i = 0; i < req->dsm_nr_ranges; i++) {
+        uint32_t nlb = le32_to_cpu(ranges[i].nlb);
+
+        lba = ssd_req_lba(req, le64_to_cpu(ranges[i].slba));
+        start_lpn = lba / spp->secs_per_pg;
+        end_lpn = MIN((lba + nlb - 1) / spp->secs_per_pg, spp->tt_lpns - 1);
+        lat = ssd_read_lpns(ssd, start_lpn, end_lpn, req->stime);
+        rdlat = MAX(rdlat, lat);
+        total += nlb;
+    }
 
-        /* FDP: Advance RU-specific or global write pointer */
-        if (fdp_enabled) {
-            fdp_advance_write_pointer(ssd, ru);
-            ru->bytes_written += spp->secsz * spp->secs_per_pg;
-            ssd->fdp_cfg.total_host_writes++;
-        } else {
-            ssd_advance_write_pointer(ssd);
-        }
+    g_free(ranges);
+    req->dsm_ranges = NULL;
+    req->dsm_nr_ranges = 0;
 
-        struct nand_cmd swr;
-        swr.type = USER_IO;
-        swr.cmd = NAND_WRITE;
-        swr.stime = req->stime;
-        /* get latency statistics */
-        curlat = ssd_advance_status(ssd, &ppa, &swr);
-        maxlat = (curlat > maxlat) ? curlat : maxlat;
+    lba = ssd_req_lba(req, req->slba);
+    start_lpn = lba / spp->secs_per_pg;
+    end_lpn = (lba + total - 1) / spp->secs_per_pg;
+    if (!total || end_lpn >= spp->tt_lpns) {
+        ftl_err("copy: start_lpn=%"PRIu64",tt_lpns=%"PRIu64"\n", start_lpn,
+                spp->tt_lpns);
+        return rdlat;
     }
 
-    return maxlat;
+    ssd_gc_before_write(ssd);
+    ru = fdp_get_ru_by_ph(ssd, req->fdp_ph, ssd_req_ns(req));
+    wrlat = ssd_write_lpns(ssd, req, ru, start_lpn, end_lpn,
+                           req->stime + rdlat);
+
+    return rdlat + wrlat;
 }
 
 static uint64_t ssd_trim(struct ssd *ssd, NvmeRequest *req)
@@ -1025,8 +2048,8 @@ static uint64_t ssd_trim(struct ssd *ssd, NvmeRequest *req)
     int nr_ranges = req->dsm_nr_ranges;
     // uint32_t attributes = req->dsm_attributes;
     
-    int total_trimmed_pages = 0;
-    int total_already_invalid = 0;
+    uint64_t total_trimmed_pages = 0;
+    uint64_t total_already_invalid = 0;
     int total_out_of_bounds = 0;
     
     if (!ranges || nr_ranges <= 0) {
@@ -1037,51 +2060,29 @@ static uint64_t ssd_trim(struct ssd *ssd, NvmeRequest *req)
     // printf("TRIM: Processing %d ranges (attributes=0x%x)\n", nr_ranges, attributes);
     
     for (int range_idx = 0; range_idx < nr_ranges; range_idx++) {
-        uint64_t slba = le64_to_cpu(ranges[range_idx].slba);
+        uint64_t slba = ssd_req_lba(req, le64_to_cpu(ranges[range_idx].slba));
         uint32_t nlb = le32_to_cpu(ranges[range_idx].nlb);
         // uint32_t cattr = le32_to_cpu(ranges[range_idx].cattr);
         
         uint64_t start_lpn = slba / spp->secs_per_pg;
         uint64_t end_lpn = (slba + nlb - 1) / spp->secs_per_pg;
-        uint64_t lpn;
-        struct ppa ppa;
-        int trimmed_pages = 0;
-        int already_invalid = 0;
+        uint64_t trimmed_pages;
+        uint64_t already_invalid;
 
         // ftl_debug("TRIM Range %d: LBA %lu + %u sectors, LPN range %lu-%lu (%lu pages), cattr=0x%x\n", 
         //        range_idx, slba, nlb, start_lpn, end_lpn, end_lpn - start_lpn + 1, cattr);
 
         // Boundary check
-        if (end_lpn >= spp->tt_pgs) {
-            ftl_err("TRIM: Range %d exceeds FTL capacity - end_lpn=%lu, tt_pgs=%d\n", 
-                   range_idx, end_lpn, spp->tt_pgs);
+        if (end_lpn >= spp->tt_lpns) {
+            ftl_err("TRIM: Range %d exceeds FTL capacity - end_lpn=%lu, tt_lpns=%"PRIu64"\n", 
+                   range_idx, end_lpn, spp->tt_lpns);
             total_out_of_bounds++;
             continue;  // Skip this range, continue with others
         }
 
-        // Process each LPN in this range
-        for (lpn = start_lpn; lpn <= end_lpn; lpn++) {
-            ppa = get_maptbl_ent(ssd, lpn);
-            
-            // Skip already unmapped/invalid pages
-            if (!mapped_ppa(&ppa) || !valid_ppa(ssd, &ppa)) {
-                already_invalid++;
-                continue;
-            }
+        trimmed_pages = ssd_unmap(ssd, start_lpn, end_lpn, ssd_req_ns(req));
+        already_invalid = end_lpn - start_lpn + 1 - trimmed_pages;
 
-            // Invalidate the existing mapped page
-            mark_page_invalid(ssd, &ppa);
-            
-            // Clear reverse mapping
-            set_rmap_ent(ssd, INVALID_LPN, &ppa);
-            
-            // Set mapping table entry as unmapped
-            ppa.ppa = UNMAPPED_PPA;
-            set_maptbl_ent(ssd, lpn, &ppa);
-            
-            trimmed_pages++;
-        }
-        
         total_trimmed_pages += trimmed_pages;
         total_already_invalid += already_invalid;
         
@@ -1101,14 +2102,329 @@ static uint64_t ssd_trim(struct ssd *ssd, NvmeRequest *req)
     return 0;  // Assume TRIM operations have no NAND latency
 }
 
+/*
+ * Write Zeroes: with DEAC the range is just unmapped, like a trim; without
+ * it the zeroes are programmed. nvme_write_zeros() zeroed the backend.
+ */
+static uint64_t ssd_write_zeroes(struct ssd *ssd, NvmeRequest *req)
+{
+    struct ssdparams *spp = &ssd->sp;
+    uint64_t lba = ssd_req_lba(req, le64_to_cpu(req->dsm_ranges[0].slba));
+    uint32_t nlb = le32_to_cpu(req->dsm_ranges[0].nlb);
+    uint64_t start_lpn = lba / spp->secs_per_pg;
+    uint64_t end_lpn = (lba + nlb - 1) / spp->secs_per_pg;
+    fdp_ru_t *ru;
+
+    if (req->dsm_attributes & NVME_DSMGMT_AD) {
+        return ssd_trim(ssd, req);
+    }
+
+    g_free(req->dsm_ranges);
+    req->dsm_ranges = NULL;
+    req->dsm_nr_ranges = 0;
+
+    if (end_lpn >= spp->tt_lpns) {
+        ftl_err("start_lpn=%"PRIu64",tt_lpns=%"PRIu64"\n", start_lpn,
+                ssd->sp.tt_lpns);
+        return 0;
+    }
+
+    ssd_gc_before_write(ssd);
+    ru = fdp_get_ru_by_ph(ssd, req->fdp_ph, ssd_req_ns(req));
+
+    return ssd_write_lpns(ssd, req, ru, start_lpn, end_lpn, req->stime);
+}
+
+/* Run @req through the FTL and return its NAND latency */
+uint64_t ssd_io(struct ssd *ssd, NvmeRequest *req)
+{
+    switch (req->cmd_opcode) {
+    case NVME_CMD_WRITE:
+        return ssd_write(ssd, req);
+    case NVME_CMD_READ:
+        return ssd_read(ssd, req);
+    case NVME_CMD_DSM:
+        if (req->dsm_ranges && req->dsm_nr_ranges > 0) {
+            return ssd_trim(ssd, req);
+        }
+        return 0;
+    case NVME_CMD_COPY:
+        return ssd_copy(ssd, req);
+    case NVME_CMD_WRITE_ZEROES:
+        if (req->dsm_ranges) {
+            return ssd_write_zeroes(ssd, req);
+        }
+        return 0;
+    default:
+        //ftl_err("FTL received unkown request type, ERROR\n");
+        return 0;
+    }
+}
+
+/*
+ * Unmap the LPNs of namespaces deleted since the last call (ns->busy set by
+ * bb_ns_delete()). Runs on the FTL thread, which owns the mapping.
+ */
+void ssd_reclaim_ns(FemuCtrl *n)
+{
+    struct ssd *ssd = n->ssd;
+    struct ssdparams *spp = &ssd->sp;
+    uint64_t start_lpn, end_lpn;
+
+    for (int i = 0; i < n->num_namespaces; i++) {
+        NvmeNamespace *ns = &n->namespaces[i];
+
+        if (!qatomic_read(&ns->busy)) {
+            continue;
+        }
+
+        start_lpn = ns->start_block / spp->secs_per_pg;
+        end_lpn = MIN((ns->start_block + (n->ns_size >> BDRV_SECTOR_BITS)) /
+                      spp->secs_per_pg, spp->tt_lpns) - 1;
+        /* the deleted namespace's stats go now, its pages in the background */
+        for (int j = 0; j < ssd->nr_unmap; j++) {
+            if (ssd->unmap_q[j].ns == i) {
+                ssd->unmap_q[j].ns = SSD_UNMAP_NONS;
+            }
+        }
+        if (start_lpn <= end_lpn) {
+            ssd_unmap_sync(ssd, start_lpn, end_lpn);
+            ssd_unmap_queue(ssd, start_lpn, end_lpn, SSD_UNMAP_NONS);
+        }
+        memset(&ssd->ns_st[i], 0, sizeof(ssd->ns_st[i]));
+
+        qatomic_set(&ns->busy, false);
+        qatomic_dec(&ssd->ns_reclaim);
+    }
+}
+
+/* A line some write pointer is still filling */
+static bool ssd_line_open(struct ssd *ssd, struct line *line)
+{
+    fdp_config_t *cfg = &ssd->fdp_cfg;
+
+    if (line == ssd->wp.curline || line == ssd->slc.wp.curline) {
+        return true;
+    }
+    if (cfg->enabled) {
+        for (int i = 0; i < cfg->nruh; i++) {
+            if (line == cfg->rgs[0].rus[i].wp.curline) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Relocate one line queued by the read retry model, wherever it is waiting.
+ * Lines still open, or freed by GC meanwhile, are dropped; more reads queue
+ * them again.
+ */
+static bool ssd_read_reclaim(struct ssd *ssd)
+{
+    struct line_mgmt *lm = &ssd->lm;
+    struct line *line;
+
+    while (ssd->nr_rr_q && !should_gc_high(ssd)) {
+        line = &lm->lines[ssd->rr_q[--ssd->nr_rr_q]];
+        if (!line->reclaim) {
+            continue;
+        }
+        line->reclaim = false;
+        if (ssd_line_open(ssd, line)) {
+            continue;
+        }
+
+        if (line->pos) {
+            pqueue_remove(lm->victim_line_pq, line);
+            line->pos = 0;
+            lm->victim_line_cnt--;
+        } else if (line->slc) {
+            QTAILQ_REMOVE(&ssd->slc.fold_list, line, entry);
+            ssd->slc.fold_cnt--;
+        } else if (line->vpc == line->pgs) {
+            QTAILQ_REMOVE(&lm->full_line_list, line, entry);
+            lm->full_line_cnt--;
+        } else {
+            continue;
+        }
+
+        ftl_debug("Read-reclaiming line:%d,vpc=%d\n", line->id, line->vpc);
+        ssd->nr_read_reclaims++;
+        ssd_reclaim_line(ssd, line);
+        return true;
+    }
+
+    return false;
+}
+
+void ssd_bg_gc(struct ssd *ssd)
+{
+    if (should_gc(ssd)) {
+        do_gc(ssd, false);
+    }
+    ssd_bg_fold(ssd, false);
+    ssd_read_reclaim(ssd);
+    ssd_wear_level(ssd);
+}
+
+/*
+ * Fold the oldest closed SLC line into regular lines: its valid pages are
+ * read in SLC mode and programmed through the GC write pointer, charged to
+ * the dies like GC. Done while the host is @idle, otherwise only once the
+ * cache cannot take any more writes; until then host writes bypass it and
+ * run at regular program latency (the write cliff).
+ */
+bool ssd_bg_fold(struct ssd *ssd, bool idle)
+{
+    struct slc_cache *sc = &ssd->slc;
+    struct line *line;
+
+    if (!sc->fold_cnt || should_gc_high(ssd)) {
+        return false;
+    }
+    if (!idle && (sc->wp.curline || slc_can_open(ssd))) {
+        return false;
+    }
+
+    line = QTAILQ_FIRST(&sc->fold_list);
+    QTAILQ_REMOVE(&sc->fold_list, line, entry);
+    sc->fold_cnt--;
+    sc->nr_folds++;
+    ftl_debug("Folding SLC line:%d,vpc=%d\n", line->id, line->vpc);
+    ssd_reclaim_line(ssd, line);
+
+    return true;
+}
+
+/* A read may not go ahead of a write or any other update queued before it */
+static bool ssd_read_blocked(struct ftl_batch *b, int k)
+{
+    NvmeRequest *rd = b[k].req;
+    uint64_t rs = ssd_req_lba(rd, rd->slba), re = rs + rd->nlb;
+
+    for (int j = 0; j < k; j++) {
+        NvmeRequest *req = b[j].req;
+        uint64_t ws, we;
+
+        if (!req || req->cmd_opcode == NVME_CMD_READ) {
+            continue;
+        }
+        if (req->cmd_opcode != NVME_CMD_WRITE) {
+            return true;
+        }
+        ws = ssd_req_lba(req, req->slba);
+        we = ws + req->nlb;
+        if (ws < re && rs < we) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Hand @b's request back to its poller, done with its slowest page */
+static void ftl_complete(FemuCtrl *n, struct ssd *ssd, struct ftl_batch *b)
+{
+    NvmeRequest *req = b->req;
+    int rc;
+
+    req->reqlat = b->lat;
+    req->expire_time += b->lat;
+
+    rc = femu_ring_enqueue(ssd->to_poller[b->poller], (void *)&req, 1);
+    if (rc != 1) {
+        ftl_err("FTL to_poller enqueue failed\n");
+    }
+    femu_idle_kick(&n->poller_idle[b->poller]);
+    b->req = NULL;
+}
+
+/*
+ * Run @b's request through the FTL mapping. Reads and writes leave their
+ * page ops on the LUN queues, anything else is charged (and completes) here.
+ */
+static void ftl_submit(FemuCtrl *n, struct ssd *ssd, struct ftl_batch *b)
+{
+    NvmeRequest *req = b->req;
+
+    b->pending = 0;
+    if (req->cmd_opcode == NVME_CMD_READ || req->cmd_opcode == NVME_CMD_WRITE) {
+        ssd->split = b;
+    }
+    b->lat = ssd_io(ssd, req);
+    ssd->split = NULL;
+
+    if (!b->pending) {
+        ftl_complete(n, ssd, b);
+    }
+}
+
+/*
+ * Charge the queued page ops round robin over the LUNs, one sub-operation
+ * (a request's consecutive ops on that LUN) per LUN and turn. A request
+ * completes with its last sub-operation, so a small read of an idle LUN is
+ * handed back before a large write queued ahead of it on other LUNs.
+ */
+static void ftl_dispatch(FemuCtrl *n, struct ssd *ssd)
+{
+    bool more;
+
+    do {
+        more = false;
+        for (int l = 0; l < ssd->sp.tt_luns; l++) {
+            struct ftl_lunq *q = &ssd->lunq[l];
+            struct ftl_batch *b;
+
+            if (q->head == q->nr) {
+                continue;
+            }
+
+            b = q->op[q->head].parent;
+            while (q->head < q->nr && q->op[q->head].parent == b) {
+                struct ftl_subop *op = &q->op[q->head++];
+                struct nand_cmd ncmd = {
+                    .type = USER_IO,
+                    .cmd = op->cmd,
+                    .stime = b->req->stime,
+                };
+                uint64_t lat = ssd_advance_status(ssd, &op->ppa, &ncmd);
+
+                b->lat = MAX(b->lat, lat);
+                b->pending--;
+            }
+            if (!b->pending) {
+                ftl_complete(n, ssd, b);
+            }
+
+            if (q->head == q->nr) {
+                q->head = q->nr = 0;
+            } else {
+                more = true;
+            }
+        }
+    } while (more);
+}
+
+/*
+ * Requests are taken off the rings FTL_BATCH at a time, round robin over
+ * the pollers. Reads that no earlier update of the batch overlaps are mapped
+ * and dispatched first, then the rest in arrival order. Mapping splits a
+ * read or write into per-LUN page ops, which ftl_dispatch() charges LUN by
+ * LUN; each request completes with its own last op.
+ */
 static void *ftl_thread(void *arg)
 {
     FemuCtrl *n = (FemuCtrl *)arg;
     struct ssd *ssd = n->ssd;
+    struct ftl_batch *batch = ssd->batch;
     NvmeRequest *req = NULL;
-    uint64_t lat = 0;
+    int nr, last;
+    int work;
     int rc;
-    int i;
+    int i, k;
 
     while (!*(ssd->dataplane_started_ptr)) {
         usleep(100000);
@@ -1119,47 +2435,78 @@ static void *ftl_thread(void *arg)
     ssd->to_poller = n->to_poller;
 
     while (1) {
-        for (i = 1; i <= n->nr_pollers; i++) {
-            if (!ssd->to_ftl[i] || !femu_ring_count(ssd->to_ftl[i]))
-                continue;
-
-            rc = femu_ring_dequeue(ssd->to_ftl[i], (void *)&req, 1);
-            if (rc != 1) {
-                printf("FEMU: FTL to_ftl dequeue failed\n");
-            }
+        if (qatomic_read(&ssd->ns_reclaim)) {
+            ssd_reclaim_ns(n);
+        }
 
-            ftl_assert(req);
-            switch (req->cmd.opcode) {
-            case NVME_CMD_WRITE:
-                lat = ssd_write(ssd, req);
-                break;
-            case NVME_CMD_READ:
-                lat = ssd_read(ssd, req);
-                break;
-            case NVME_CMD_DSM:
-                if (req->dsm_ranges && req->dsm_nr_ranges > 0) {
-                    lat = ssd_trim(ssd, req);
+        nr = 0;
+        do {
+            last = nr;
+            for (i = 1; i <= n->nr_pollers && nr < FTL_BATCH; i++) {
+                if (!ssd->to_ftl[i] || !femu_ring_count(ssd->to_ftl[i]))
+                    continue;
+
+                rc = femu_ring_dequeue(ssd->to_ftl[i], (void *)&req, 1);
+                if (rc != 1) {
+                    printf("FEMU: FTL to_ftl dequeue failed\n");
+                    continue;
                 }
-                break;
-            default:
-                //ftl_err("FTL received unkown request type, ERROR\n");
-                ;
-            }
-
-            req->reqlat = lat;
-            req->expire_time += lat;
 
-            rc = femu_ring_enqueue(ssd->to_poller[i], (void *)&req, 1);
-            if (rc != 1) {
-                ftl_err("FTL to_poller enqueue failed\n");
+                ftl_assert(req);
+                batch[nr].req = req;
+                batch[nr++].poller = i;
             }
+        } while (nr > last && nr < FTL_BATCH);
 
-            /* clean one line if needed (in the background) */
-            if (should_gc(ssd)) {
-                do_gc(ssd, false);
+        for (k = 0; k < nr; k++) {
+            if (batch[k].req->cmd_opcode == NVME_CMD_READ &&
+                !ssd_read_blocked(batch, k)) {
+                ftl_submit(n, ssd, &batch[k]);
             }
         }
+        ftl_dispatch(n, ssd);
+        for (k = 0; k < nr; k++) {
+            if (batch[k].req) {
+                ftl_submit(n, ssd, &batch[k]);
+            }
+        }
+        ftl_dispatch(n, ssd);
+        if (nr) {
+            ssd_bg_gc(ssd);
+        }
+
+        work = nr;
+        work += ssd_bg_unmap(ssd);
+        if (!work) {
+            /* nothing came in, fold the SLC cache meanwhile */
+            work = ssd_bg_fold(ssd, true);
+        }
+        femu_ftl_idle(n, ssd->to_ftl, work);
     }
 
     return NULL;
 }
+
+/*
+ * SMART health, read racily from the admin path. Wear is the mean line erase
+ * count against the rated endurance. Spare is what retired blocks left of
+ * the good blocks beyond the exported capacity.
+ */
+void ssd_health(struct ssd *ssd, uint8_t *pct_used, uint8_t *spare)
+{
+    struct ssdparams *spp = &ssd->sp;
+    uint64_t erases = qatomic_read(&ssd->lm.nr_erases);
+    int64_t spare_blks, retired;
+
+    *pct_used = MIN(erases * 100 / ((uint64_t)spp->tt_lines * spp->endurance),
+                    255);
+
+    spare_blks = spp->tt_blks - ssd->nr_factory_bad_blks -
+                 (int64_t)DIV_ROUND_UP(spp->tt_lpns, spp->pgs_per_blk);
+    retired = qatomic_read(&ssd->nr_bad_blks) - ssd->nr_factory_bad_blks;
+    if (spare_blks <= 0) {
+        *spare = retired ? 0 : 100;
+    } else {
+        *spare = MAX(spare_blks - retired, 0) * 100 / spare_blks;
+    }
+}
@@ -14,25 +14,26 @@
 #define FDP_DEFAULT_RUHS            4
 
 enum {
-    NAND_READ =  0,
-    NAND_WRITE = 1,
-    NAND_ERASE = 2,
-
     NAND_READ_LATENCY = 40000,
     NAND_PROG_LATENCY = 200000,
     NAND_ERASE_LATENCY = 2000000,
 };
 
+/* How NAND latencies are derived for each page (pg_type_mode) */
 enum {
-    USER_IO = 0,
-    GC_IO = 1,
+    SSD_PGTYPE_FLAT = 0,        /* pg_rd_lat/pg_wr_lat for every page */
+    SSD_PGTYPE_MULTI_PASS = 1,  /* flash_type page pairing, per-page program */
+    SSD_PGTYPE_ONE_SHOT = 2,    /* all pages of a wordline programmed at once */
 };
 
+/* SLC cache modes */
 enum {
-    SEC_FREE = 0,
-    SEC_INVALID = 1,
-    SEC_VALID = 2,
+    SSD_SLC_OFF     = 0,
+    SSD_SLC_STATIC  = 1,    /* slc_lines lines set aside for good */
+    SSD_SLC_DYNAMIC = 2,    /* up to slc_lines free lines, while GC is not due */
+};
 
+enum {
     PG_FREE = 0,
     PG_INVALID = 1,
     PG_VALID = 2
@@ -51,6 +52,10 @@ enum {
     
     FEMU_ENABLE_FDP = 8,
     FEMU_DISABLE_FDP = 9,
+
+    FEMU_PRINT_DIE_UTIL = 10,
+    FEMU_PRINT_IDLE_STATS = 11,
+    FEMU_PRINT_NS_STATS = 12,
 };
 
 
@@ -78,43 +83,38 @@ struct ppa {
     };
 };
 
-typedef int nand_sec_status_t;
-
-struct nand_page {
-    nand_sec_status_t *sec;
-    int nsecs;
-    int status;
-};
-
-struct nand_block {
-    struct nand_page *pg;
-    int npgs;
-    int ipc; /* invalid page count */
-    int vpc; /* valid page count */
-    int erase_cnt;
-    int wp; /* current write pointer */
+/*
+ * NAND state, as flat arrays instead of a ch/lun/pl/blk/pg tree: the PG_*
+ * status of every page packed 2 bits per page and indexed by ppa2pgidx(),
+ * and the block counters indexed by ppa2blkidx().
+ */
+#define PG_ST_BITS      (2)
+#define PG_ST_PER_WORD  (64 / PG_ST_BITS)
+
+struct nand_state {
+    uint64_t *pg_st;
+    int *blk_vpc;       /* valid page count */
+    int *blk_ipc;       /* invalid page count */
+    int *blk_erase_cnt;
+    /* read retry model only: reads since the erase, last program time */
+    uint32_t *blk_rd_cnt;
+    uint64_t *blk_prog_time;
+    uint8_t *blk_bad;   /* BLK_* */
 };
 
-struct nand_plane {
-    struct nand_block *blk;
-    int nblks;
-};
-
-struct nand_lun {
-    struct nand_plane *pl;
-    int npls;
-    uint64_t next_lun_avail_time;
-    bool busy;
-    uint64_t gc_endtime;
+enum {
+    BLK_GOOD    = 0,
+    BLK_BAD     = 1,    /* factory bad or retired, not part of its line */
+    BLK_FAILING = 2,    /* program failed: no more writes, retired on erase */
 };
 
-struct ssd_channel {
-    struct nand_lun *lun;
-    int nluns;
-    uint64_t next_ch_avail_time;
-    bool busy;
-    uint64_t gc_endtime;
-};
+/*
+ * Read retry model (rr_lat != 0): mean retries above which, or rr_reads reads
+ * after which, a block's line is relocated; retries a read gives up after
+ */
+#define SSD_RR_RECLAIM      (4)
+#define SSD_RR_MAX_RETRIES  (16)
+#define SSD_RR_QDEPTH       (64)
 
 struct ssdparams {
     int secsz;        /* sector size in bytes */
@@ -131,24 +131,53 @@ struct ssdparams {
     int ch_xfer_lat;  /* channel transfer latency for one page in nanoseconds
                        * this defines the channel bandwith
                        */
+    int flash_type;   /* SLC/MLC/TLC/QLC, bits per cell */
+    int pg_type_mode; /* SSD_PGTYPE_* */
+    int suspend_lat;  /* program/erase suspend overhead in nanoseconds */
+    int resume_lat;   /* program/erase resume overhead in nanoseconds */
+    int max_suspend;  /* # of reads that may suspend one program/erase */
+    int die_sched;    /* NAND_SCHED_*, how a LUN orders host and GC ops */
 
     double gc_thres_pcent;
     int gc_thres_lines;
     double gc_thres_pcent_high;
     int gc_thres_lines_high;
     bool enable_gc_delay;
-
-    /* below are all calculated values */
+    int op_pcent;     /* over-provisioning over the exported pages, -1: none */
+    int endurance;    /* rated P/E cycles, 100% used in the SMART log */
+    int wl_thres;     /* erase count gap starting wear leveling, 0: off */
+    int slc_mode;     /* SSD_SLC_* */
+    int slc_lines;    /* SLC cache size (static) or limit (dynamic) in lines */
+    int slc_pgs_per_blk; /* pages of a block programmed in SLC mode */
+
+    /*
+     * read retry model: ns per retry (0: off), and the P/E cycles, data age
+     * in seconds and block reads that each cost one retry on average
+     */
+    int rr_lat;
+    int rr_pe_cycles;
+    int rr_retention;
+    int rr_reads;
+
+    /* injected program/erase failures, per million operations */
+    int pgm_fail_ppm;
+    int ers_fail_ppm;
+
+    /*
+     * below are all calculated values, anything counting pages or sectors
+     * beyond a block is 64-bit: multi-TB geometries overflow an int
+     */
     int secs_per_blk; /* # of sectors per block */
-    int secs_per_pl;  /* # of sectors per plane */
-    int secs_per_lun; /* # of sectors per LUN */
-    int secs_per_ch;  /* # of sectors per channel */
-    int tt_secs;      /* # of sectors in the SSD */
+    uint64_t secs_per_pl;  /* # of sectors per plane */
+    uint64_t secs_per_lun; /* # of sectors per LUN */
+    uint64_t secs_per_ch;  /* # of sectors per channel */
+    uint64_t tt_secs;      /* # of sectors in the SSD */
 
-    int pgs_per_pl;   /* # of pages per plane */
-    int pgs_per_lun;  /* # of pages per LUN (Die) */
-    int pgs_per_ch;   /* # of pages per channel */
-    int tt_pgs;       /* total # of pages in the SSD */
+    uint64_t pgs_per_pl;   /* # of pages per plane */
+    uint64_t pgs_per_lun;  /* # of pages per LUN (Die) */
+    uint64_t pgs_per_ch;   /* # of pages per channel */
+    uint64_t tt_pgs;       /* total # of pages in the SSD */
+    uint64_t tt_lpns;      /* # of logical pages, the L2P size */
 
     int blks_per_lun; /* # of blocks per LUN */
     int blks_per_ch;  /* # of blocks per channel */
@@ -169,6 +198,10 @@ typedef struct line {
     int id;  /* line id, the same as corresponding block id */
     int ipc; /* invalid page count in this line */
     int vpc; /* valid page count in this line */
+    int erase_cnt; /* # of times the line's blocks were erased */
+    int pgs; /* usable pages: pgs_per_line less those of bad blocks */
+    bool slc; /* blocks are programmed in SLC mode, see struct slc_cache */
+    bool reclaim; /* queued for read reclaim */
     uint8_t ru_owner; /* FDP: which RU owns this line (0xFF = global/no owner) */
     QTAILQ_ENTRY(line) entry; /* in either {free,victim,full} list */
     /* position in the priority queue for victim lines */
@@ -187,7 +220,10 @@ struct write_pointer {
 
 struct line_mgmt {
     struct line *lines;
-    /* free line list, we only need to maintain a list of blk numbers */
+    /*
+     * free line list, we only need to maintain a list of blk numbers; with
+     * wear leveling on, kept in erase_cnt order, least worn first
+     */
     QTAILQ_HEAD(free_line_list, line) free_line_list;
     pqueue_t *victim_line_pq;
     //QTAILQ_HEAD(victim_line_list, line) victim_line_list;
@@ -196,6 +232,11 @@ struct line_mgmt {
     int free_line_cnt;
     int victim_line_cnt;
     int full_line_cnt;
+    /* highest line erase_cnt, and # of line erases so far */
+    int max_erase_cnt;
+    uint64_t nr_erases;
+    /* no full line has fewer erases (a lower bound, exact after a scan) */
+    int full_min_erase_cnt;
 };
 
 struct nand_cmd {
@@ -204,6 +245,53 @@ struct nand_cmd {
     int64_t stime; /* Coperd: request arrival time */
 };
 
+/*
+ * Deallocated LPN range still to be unmapped. Trims larger than
+ * SSD_UNMAP_BATCH pages complete right away and are unmapped by the FTL
+ * thread SSD_UNMAP_BATCH pages at a time; I/O touching a queued range unmaps
+ * the part it overlaps first. Deleted namespaces are reclaimed the same way.
+ */
+#define SSD_UNMAP_BATCH     (65536)
+#define SSD_UNMAP_QDEPTH    (64)
+/* ssd_unmap.ns of a deleted namespace's range: no stats to update */
+#define SSD_UNMAP_NONS      (-1)
+
+struct ssd_unmap {
+    uint64_t start_lpn;
+    uint64_t end_lpn;
+    int ns;
+};
+
+/* Requests the FTL thread takes off the rings per round */
+#define FTL_BATCH           (64)
+
+/*
+ * A request the FTL thread took off a ring. Reads and writes are split into
+ * per-page ops queued on their LUN; the request completes once the last of
+ * them is charged.
+ */
+struct ftl_batch {
+    NvmeRequest *req;
+    int poller;
+    int pending;        /* page ops still queued on their LUNs */
+    uint64_t lat;       /* slowest page op charged so far */
+};
+
+/* One page op of a split request */
+struct ftl_subop {
+    struct ppa ppa;
+    int cmd;            /* NAND_READ / NAND_WRITE */
+    struct ftl_batch *parent;
+};
+
+/* Page ops queued on one LUN, in the order the requests were mapped */
+struct ftl_lunq {
+    struct ftl_subop *op;
+    int head;
+    int nr;
+    int cap;
+};
+
 /* FDP Reclaim Unit (RU) structure */
 typedef struct fdp_ru {
     uint16_t ruid;              /* Reclaim Unit ID */
@@ -219,7 +307,7 @@ typedef struct fdp_ru {
     uint64_t ru_open_time;      /* Time when RU was opened */
     
     int free_line_cnt;          /* Free lines in this RU */
-    QTAILQ_HEAD(ru_free_line_list, line) free_line_list;
+    struct free_line_list free_line_list;
 } fdp_ru_t;
 
 /* FDP Reclaim Group (RG) structure */
@@ -246,14 +334,44 @@ typedef struct fdp_config {
     uint32_t ru_switches;       /* Number of RU switches */
 } fdp_config_t;
 
+/*
+ * SLC cache: without FDP, host writes go to lines whose blocks are programmed
+ * in SLC mode, i.e. only slc_pgs_per_blk pages per block at SLC latencies.
+ * Closed SLC lines are folded, oldest first, into regular lines by
+ * ssd_bg_fold(). Static mode keeps its lines on a private free list, dynamic
+ * mode borrows them from the global one.
+ */
+struct slc_cache {
+    struct write_pointer wp;    /* wp.curline is NULL while no line is open */
+    struct free_line_list free_line_list;
+    int free_line_cnt;
+    QTAILQ_HEAD(slc_fold_list, line) fold_list;
+    int fold_cnt;
+    int nr_lines;               /* lines in SLC mode, whatever their state */
+    uint64_t nr_folds;
+};
+
+/* Per-namespace FTL accounting, in flash pages */
+struct ssd_ns_stats {
+    uint64_t host_pgs_wr;
+    uint64_t valid_pgs;
+};
+
 struct ssd {
     char *ssdname;
     struct ssdparams sp;
-    struct ssd_channel *ch;
+    struct nand_state nand;
+    /*
+     * Both tables hold the complement of their entries, so that the zeroed
+     * memory of a fresh table reads as UNMAPPED_PPA/INVALID_LPN and is only
+     * faulted in where the FTL writes it, see get_maptbl_ent()
+     */
     struct ppa *maptbl; /* page level mapping table */
     uint64_t *rmap;     /* reverse mapptbl, assume it's stored in OOB */
     struct write_pointer wp;
     struct line_mgmt lm;
+    struct slc_cache slc;
+    NandTiming nt;      /* channel/LUN timing state */
 
     /* lockless ring for communication with NVMe IO thread */
     struct rte_ring **to_ftl;
@@ -263,9 +381,77 @@ struct ssd {
     
     /* FDP (Flexible Data Placement) configuration */
     fdp_config_t fdp_cfg;
+
+    /* NAND pages programmed for the host and by GC, for WAF */
+    uint64_t nr_host_pgs_wr;
+    uint64_t nr_gc_pgs_wr;
+    /* GC runs, and how many of them were forced by a write */
+    uint64_t nr_gc;
+    uint64_t nr_gc_forced;
+    /* lines moved by static wear leveling, lm.nr_erases at its last check */
+    uint64_t nr_wl;
+    uint64_t wl_erases;
+
+    /* read retry model: lines to read-reclaim, retries so far */
+    int rr_q[SSD_RR_QDEPTH];
+    int nr_rr_q;
+    uint64_t nr_read_retries;
+    uint64_t nr_read_reclaims;
+
+    /* bad blocks, factory and retired, and injected NAND failures */
+    int nr_bad_blks;
+    int nr_factory_bad_blks;
+    uint64_t nr_pgm_fails;
+    uint64_t nr_ers_fails;
+
+    /* xorshift64* state for the read retry and failure models */
+    uint64_t rng;
+
+    /*
+     * Namespaces share the FTL: namespace i owns the LPNs behind its slot of
+     * the device LBA space (start_block), and with FDP enabled its own slice
+     * of the RU handles. ns_reclaim counts deleted namespaces whose LPNs the
+     * FTL thread has yet to unmap.
+     */
+    int nr_ns;
+    struct ssd_ns_stats *ns_st;
+    int ns_reclaim;
+
+    /* queued unmaps, and per-line invalidations batched by ssd_unmap_lpns() */
+    struct ssd_unmap unmap_q[SSD_UNMAP_QDEPTH];
+    int nr_unmap;
+    int *unmap_ipc;
+    int *unmap_lines;
+
+    /*
+     * do_gc() scratch: valid pages of the victim line (pgs_per_line each for
+     * the sources and their new locations), per-LUN counts for grouping
+     */
+    struct ppa *gc_src;
+    struct ppa *gc_dst;
+    int *gc_lun_cnt;
+
+    /*
+     * FTL thread: the requests of the current round, the one being split
+     * (NULL outside ftl_submit(), e.g. in the FTL simulator) and the page
+     * ops queued per LUN (tt_luns, channel major)
+     */
+    struct ftl_batch batch[FTL_BATCH];
+    struct ftl_batch *split;
+    struct ftl_lunq *lunq;
 };
 
 void ssd_init(FemuCtrl *n);
+void ssd_init_ftl(FemuCtrl *n);
+void ssd_update_timing(struct ssd *ssd);
+uint64_t ssd_io(struct ssd *ssd, NvmeRequest *req);
+void ssd_bg_gc(struct ssd *ssd);
+bool ssd_bg_unmap(struct ssd *ssd);
+bool ssd_bg_fold(struct ssd *ssd, bool idle);
+void ssd_health(struct ssd *ssd, uint8_t *pct_used, uint8_t *spare);
+void fdp_init_config(struct ssd *ssd);
+void fdp_distribute_lines(struct ssd *ssd);
+void ssd_reclaim_ns(FemuCtrl *n);
 
 #ifdef FEMU_DEBUG_FTL
 #define ftl_debug(fmt, ...) \
@@ -199,6 +199,13 @@ static void nvme_process_db_io(FemuCtrl *n, hwaddr addr, int val)
     NvmeSQueue *sq;
 
     if (n->dataplane_started) {
+        /* SQ doorbell: wake its poller if it went to sleep */
+        if (!(((addr - 0x1000) >> (2 + n->db_stride)) & 1)) {
+            qid = (addr - 0x1000) >> (3 + n->db_stride);
+            if (qid >= 1 && qid <= n->nr_io_queues) {
+                femu_idle_kick(&n->poller_idle[nvme_poller_of(n, qid)]);
+            }
+        }
         return;
     }
 
@@ -373,14 +380,13 @@ static int nvme_init_namespaces(FemuCtrl *n, Error **errp)
 {
     int i;
 
-    /* FIXME: FEMU only supports 1 namesapce now */
-    assert(n->num_namespaces == 1);
-
+    /* equal slots back to back, all created and attached at power on */
     for (i = 0; i < n->num_namespaces; i++) {
         NvmeNamespace *ns = &n->namespaces[i];
         ns->size = n->ns_size;
         ns->start_block = i * n->ns_size >> BDRV_SECTOR_BITS;
         ns->id = i + 1;
+        ns->allocated = ns->attached = true;
 
         if (nvme_init_namespace(n, ns, errp)) {
             return 1;
@@ -407,8 +413,11 @@ static void nvme_init_ctrl(FemuCtrl *n)
     id->cmic         = 0;
     id->mdts         = n->mdts;
     id->ver          = 0x00010300;
-    /* TODO: NVME_OACS_NS_MGMT */
     id->oacs         = cpu_to_le16(n->oacs | NVME_OACS_DBBUF);
+    if (BBSSD(n) || NOSSD(n)) {
+        id->oacs    |= cpu_to_le16(NVME_OACS_NS_MGMT);
+        stq_le_p(id->tnvmcap, n->ns_size * n->num_namespaces);
+    }
     id->acl          = n->acl;
     id->aerl         = n->aerl;
     id->frmw         = 7 << 1 | 1;
@@ -442,6 +451,7 @@ static void nvme_init_ctrl(FemuCtrl *n)
     n->features.async_config    = 0x0;
     n->features.sw_prog_marker  = 0;
 
+    /* intc=1 sets CD, i.e. disables coalescing, on every vector */
     for (i = 0; i <= n->nr_io_queues; i++) {
         n->features.int_vector_config[i] = i | (n->intc << 16);
     }
@@ -540,10 +550,34 @@ static void femu_realize(PCIDevice *pci_dev, Error **errp)
     if (nvme_check_constraints(n)) {
         return;
     }
+    if (n->num_namespaces > 1 && !BBSSD(n) && !NOSSD(n)) {
+        error_setg(errp, "femu: multiple namespaces need femu_mode=1 or 2");
+        return;
+    }
+
+    CPU_ZERO(&n->poller_cpuset);
+    CPU_ZERO(&n->ftl_cpuset);
+    if (n->poller_cpus && femu_cpulist_parse(n->poller_cpus, &n->poller_cpuset)) {
+        error_setg(errp, "femu: invalid poller_cpus \"%s\"", n->poller_cpus);
+        return;
+    }
+    if (n->ftl_cpus && femu_cpulist_parse(n->ftl_cpus, &n->ftl_cpuset)) {
+        error_setg(errp, "femu: invalid ftl_cpus \"%s\"", n->ftl_cpus);
+        return;
+    }
 
     bs_size = ((int64_t)n->memsz) * 1024 * 1024;
+    if (BBSSD(n) && n->bb_params.op_pcent >= 0) {
+        /* capacity follows the flash geometry, whole pages per namespace */
+        int64_t pg_size = (int64_t)n->bb_params.secsz * n->bb_params.secs_per_pg;
+        uint64_t ns_pgs = bb_logical_pgs(&n->bb_params) / n->num_namespaces;
+
+        bs_size = ns_pgs * n->num_namespaces * pg_size;
+        femu_debug("op_pcent=%d: exporting %" PRId64 " MB, devsz_mb ignored\n",
+                   n->bb_params.op_pcent, bs_size >> 20);
+    }
 
-    init_dram_backend(&n->mbe, bs_size);
+    init_dram_backend(&n->mbe, bs_size, n->numa_node);
     n->mbe->femu_mode = n->femu_mode;
 
     n->completed = 0;
@@ -557,6 +591,9 @@ static void femu_realize(PCIDevice *pci_dev, Error **errp)
     n->namespaces = g_malloc0(sizeof(*n->namespaces) * n->num_namespaces);
     n->elpes = g_malloc0(sizeof(*n->elpes) * (n->elpe + 1));
     n->aer_reqs = g_malloc0(sizeof(*n->aer_reqs) * (n->aerl + 1));
+    n->smart_cnt = qemu_memalign(__alignof__(NvmeSmartCnt),
+                                 sizeof(*n->smart_cnt) * (n->nr_io_queues + 1));
+    memset(n->smart_cnt, 0, sizeof(*n->smart_cnt) * (n->nr_io_queues + 1));
     n->features.int_vector_config = g_malloc0(sizeof(*n->features.int_vector_config) * (n->nr_io_queues + 1));
 
     nvme_init_pci(n);
@@ -583,9 +620,10 @@ static void nvme_destroy_poller(FemuCtrl *n)
         pqueue_free(n->pq[i]);
         femu_ring_free(n->to_poller[i]);
         femu_ring_free(n->to_ftl[i]);
+        femu_idle_cleanup(&n->poller_idle[i]);
     }
-
-    g_free(n->should_isr);
+    femu_idle_cleanup(&n->ftl_idle);
+    g_free(n->poller_idle);
 }
 
 static void femu_exit(PCIDevice *pci_dev)
@@ -605,6 +643,7 @@ static void femu_exit(PCIDevice *pci_dev)
     g_free(n->namespaces);
     g_free(n->features.int_vector_config);
     g_free(n->aer_reqs);
+    qemu_vfree(n->smart_cnt);
     g_free(n->elpes);
     g_free(n->cq);
     g_free(n->sq);
@@ -623,6 +662,14 @@ static const Property femu_props[] = {
     DEFINE_PROP_UINT32("queues", FemuCtrl, nr_io_queues, 8),
     DEFINE_PROP_UINT32("entries", FemuCtrl, max_q_ents, 0x7ff),
     DEFINE_PROP_UINT8("multipoller_enabled", FemuCtrl, multipoller_enabled, 0),
+    DEFINE_PROP_UINT32("pollers", FemuCtrl, pollers, 0),
+    DEFINE_PROP_UINT32("qos_iops", FemuCtrl, qos_iops, 0),
+    DEFINE_PROP_UINT32("qos_mbps", FemuCtrl, qos_mbps, 0),
+    DEFINE_PROP_UINT8("qos_wfq", FemuCtrl, qos_wfq, 0),
+    DEFINE_PROP_STRING("poller_cpus", FemuCtrl, poller_cpus),
+    DEFINE_PROP_STRING("ftl_cpus", FemuCtrl, ftl_cpus),
+    DEFINE_PROP_INT32("numa_node", FemuCtrl, numa_node, -1),
+    DEFINE_PROP_UINT32("idle_spin_us", FemuCtrl, idle_spin_us, 0),
     DEFINE_PROP_UINT8("max_cqes", FemuCtrl, max_cqes, 0x4),
     DEFINE_PROP_UINT8("max_sqes", FemuCtrl, max_sqes, 0x6),
     DEFINE_PROP_UINT8("stride", FemuCtrl, db_stride, 0),
@@ -680,8 +727,25 @@ static const Property femu_props[] = {
     DEFINE_PROP_INT32("pg_wr_lat", FemuCtrl, bb_params.pg_wr_lat, 200000),
     DEFINE_PROP_INT32("blk_er_lat", FemuCtrl, bb_params.blk_er_lat, 2000000),
     DEFINE_PROP_INT32("ch_xfer_lat", FemuCtrl, bb_params.ch_xfer_lat, 0),
+    DEFINE_PROP_INT32("pg_type_mode", FemuCtrl, bb_params.pg_type_mode, 0),
+    DEFINE_PROP_INT32("suspend_lat", FemuCtrl, bb_params.suspend_lat, 20000),
+    DEFINE_PROP_INT32("resume_lat", FemuCtrl, bb_params.resume_lat, 20000),
+    DEFINE_PROP_INT32("max_suspend", FemuCtrl, bb_params.max_suspend, 0),
+    DEFINE_PROP_INT32("die_sched", FemuCtrl, bb_params.die_sched, 0),
     DEFINE_PROP_INT32("gc_thres_pcent", FemuCtrl, bb_params.gc_thres_pcent, 75),
     DEFINE_PROP_INT32("gc_thres_pcent_high", FemuCtrl, bb_params.gc_thres_pcent_high, 95),
+    DEFINE_PROP_INT32("op_pcent", FemuCtrl, bb_params.op_pcent, -1),
+    DEFINE_PROP_INT32("endurance", FemuCtrl, bb_params.endurance, 3000),
+    DEFINE_PROP_INT32("wl_thres", FemuCtrl, bb_params.wl_thres, 0),
+    DEFINE_PROP_INT32("slc_mode", FemuCtrl, bb_params.slc_mode, 0),
+    DEFINE_PROP_INT32("slc_lines", FemuCtrl, bb_params.slc_lines, 16),
+    DEFINE_PROP_INT32("rr_lat", FemuCtrl, bb_params.rr_lat, 0),
+    DEFINE_PROP_INT32("rr_pe_cycles", FemuCtrl, bb_params.rr_pe_cycles, 3000),
+    DEFINE_PROP_INT32("rr_retention", FemuCtrl, bb_params.rr_retention, 86400),
+    DEFINE_PROP_INT32("rr_reads", FemuCtrl, bb_params.rr_reads, 100000),
+    DEFINE_PROP_INT32("pgm_fail_ppm", FemuCtrl, bb_params.pgm_fail_ppm, 0),
+    DEFINE_PROP_INT32("ers_fail_ppm", FemuCtrl, bb_params.ers_fail_ppm, 0),
+    DEFINE_PROP_STRING("bbt_fname", FemuCtrl, bb_params.bbt_fname),
 };
 
 static const VMStateDescription femu_vmstate = {
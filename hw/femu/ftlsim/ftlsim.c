@@ -0,0 +1,345 @@
+#include "ftlsim.h"
+
+/* bb_params knobs, with the defaults of the matching femu device properties */
+typedef struct FtlSimParam {
+    const char *name;
+    size_t     off;
+    int32_t    def;
+} FtlSimParam;
+
+#define FTLSIM_PARAM(_name, _def) \
+    { #_name, offsetof(BbCtrlParams, _name), _def }
+
+static const FtlSimParam ftlsim_params[] = {
+    FTLSIM_PARAM(secsz, 512),
+    FTLSIM_PARAM(secs_per_pg, 8),
+    FTLSIM_PARAM(pgs_per_blk, 256),
+    FTLSIM_PARAM(blks_per_pl, 256),
+    FTLSIM_PARAM(pls_per_lun, 1),
+    FTLSIM_PARAM(luns_per_ch, 8),
+    FTLSIM_PARAM(nchs, 8),
+    FTLSIM_PARAM(pg_rd_lat, 40000),
+    FTLSIM_PARAM(pg_wr_lat, 200000),
+    FTLSIM_PARAM(blk_er_lat, 2000000),
+    FTLSIM_PARAM(ch_xfer_lat, 0),
+    FTLSIM_PARAM(pg_type_mode, 0),
+    FTLSIM_PARAM(suspend_lat, 20000),
+    FTLSIM_PARAM(resume_lat, 20000),
+    FTLSIM_PARAM(max_suspend, 0),
+    FTLSIM_PARAM(die_sched, 0),
+    FTLSIM_PARAM(gc_thres_pcent, 75),
+    FTLSIM_PARAM(gc_thres_pcent_high, 95),
+    FTLSIM_PARAM(op_pcent, -1),
+    FTLSIM_PARAM(endurance, 3000),
+    FTLSIM_PARAM(wl_thres, 0),
+    FTLSIM_PARAM(slc_mode, 0),
+    FTLSIM_PARAM(slc_lines, 16),
+    FTLSIM_PARAM(rr_lat, 0),
+    FTLSIM_PARAM(rr_pe_cycles, 3000),
+    FTLSIM_PARAM(rr_retention, 86400),
+    FTLSIM_PARAM(rr_reads, 100000),
+    FTLSIM_PARAM(pgm_fail_ppm, 0),
+    FTLSIM_PARAM(ers_fail_ppm, 0),
+};
+
+static const char *ftlsim_op_names[FTLSIM_NR_OPS] = {
+    [FTLSIM_READ]  = "read",
+    [FTLSIM_WRITE] = "write",
+    [FTLSIM_TRIM]  = "trim",
+};
+
+static uint64_t ftlsim_clock(void *opaque)
+{
+    FtlSim *s = opaque;
+
+    return s->now;
+}
+
+FtlSim *ftlsim_new(void)
+{
+    FtlSim *s = g_malloc0(sizeof(FtlSim));
+
+    /* only the fields the bbssd FTL looks at, no QOM/PCI state */
+    s->n = g_malloc0(sizeof(FemuCtrl));
+    pstrcpy(s->n->devname, sizeof(s->n->devname), "ftlsim");
+    s->n->flash_type = MLC;
+    for (int i = 0; i < ARRAY_SIZE(ftlsim_params); i++) {
+        *(int32_t *)((char *)&s->n->bb_params + ftlsim_params[i].off) =
+            ftlsim_params[i].def;
+    }
+
+    return s;
+}
+
+/* Set one device property, before ftlsim_init(). Returns -1 if unknown. */
+int ftlsim_set_param(FtlSim *s, const char *name, int64_t val)
+{
+    if (!strcmp(name, "flash_type")) {
+        s->n->flash_type = val;
+        return 0;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(ftlsim_params); i++) {
+        if (!strcmp(name, ftlsim_params[i].name)) {
+            *(int32_t *)((char *)&s->n->bb_params + ftlsim_params[i].off) = val;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void ftlsim_list_params(FILE *out)
+{
+    fprintf(out, "  %-20s %d\n", "flash_type", MLC);
+    for (int i = 0; i < ARRAY_SIZE(ftlsim_params); i++) {
+        fprintf(out, "  %-20s %d\n", ftlsim_params[i].name,
+                ftlsim_params[i].def);
+    }
+}
+
+void ftlsim_init(FtlSim *s, bool fdp)
+{
+    struct ssd *ssd = s->n->ssd = s->ssd = g_malloc0(sizeof(struct ssd));
+
+    ssd->ssdname = s->n->devname;
+    ssd_init_ftl(s->n);
+    ssd->nt.clock = ftlsim_clock;
+    ssd->nt.clock_opaque = s;
+
+    fdp_init_config(ssd);
+    if (fdp) {
+        ssd->fdp_cfg.enabled = true;
+        fdp_distribute_lines(ssd);
+    }
+    s->fdp = fdp;
+
+    ftlsim_reset_stats(s);
+}
+
+void ftlsim_free(FtlSim *s)
+{
+    if (s->ssd) {
+        nand_timing_exit(&s->ssd->nt);
+    }
+    /* the rest of the FTL has no teardown, exit reclaims it */
+    g_free(s->n);
+    g_free(s);
+}
+
+/* Logical capacity in sectors */
+uint64_t ftlsim_capacity(FtlSim *s)
+{
+    return s->ssd->sp.tt_lpns * s->ssd->sp.secs_per_pg;
+}
+
+int ftlsim_nr_handles(FtlSim *s)
+{
+    return s->fdp ? s->ssd->fdp_cfg.nruh : 1;
+}
+
+/*
+ * Run one request, submitted at emulated time @stime (not before the previous
+ * submission), through the FTL and return its completion time. Background GC
+ * runs after it, as in ftl_thread().
+ */
+uint64_t ftlsim_submit(FtlSim *s, int op, uint64_t slba, uint32_t nlb,
+                       uint8_t ph, uint64_t stime)
+{
+    NvmeRequest req = { 0 };
+    uint64_t lat;
+
+    assert(op >= 0 && op < FTLSIM_NR_OPS && nlb > 0);
+    assert(op == FTLSIM_TRIM || nlb <= UINT16_MAX);
+    assert(slba + nlb <= ftlsim_capacity(s));
+
+    if (stime > s->now) {
+        s->now = stime;
+    }
+    req.stime = s->now;
+    req.slba = slba;
+    req.nlb = nlb;
+    req.fdp_ph = ph;
+    switch (op) {
+    case FTLSIM_READ:
+        req.cmd_opcode = NVME_CMD_READ;
+        break;
+    case FTLSIM_WRITE:
+        req.cmd_opcode = NVME_CMD_WRITE;
+        break;
+    case FTLSIM_TRIM:
+        req.cmd_opcode = NVME_CMD_DSM;
+        req.dsm_ranges = g_malloc0(sizeof(NvmeDsmRange));
+        req.dsm_ranges[0].slba = cpu_to_le64(slba);
+        req.dsm_ranges[0].nlb = cpu_to_le32(nlb);
+        req.dsm_nr_ranges = 1;
+        break;
+    }
+
+    lat = ssd_io(s->ssd, &req);
+    ssd_bg_gc(s->ssd);
+    ssd_bg_unmap(s->ssd);
+
+    s->st.nr_reqs[op]++;
+    s->st.nr_secs[op] += nlb;
+    ftlsim_hist_add(&s->st.lat[op], lat);
+
+    return req.stime + lat;
+}
+
+void ftlsim_reset_stats(FtlSim *s)
+{
+    struct ssd *ssd = s->ssd;
+
+    memset(&s->st, 0, sizeof(s->st));
+    s->st.host_pgs_wr = ssd->nr_host_pgs_wr;
+    s->st.gc_pgs_wr = ssd->nr_gc_pgs_wr;
+    s->st.nr_gc = ssd->nr_gc;
+    s->st.nr_gc_forced = ssd->nr_gc_forced;
+    s->st.nr_wl = ssd->nr_wl;
+    s->st.nr_folds = ssd->slc.nr_folds;
+    s->st.nr_read_retries = ssd->nr_read_retries;
+    s->st.nr_read_reclaims = ssd->nr_read_reclaims;
+    s->st.nr_pgm_fails = ssd->nr_pgm_fails;
+    s->st.nr_ers_fails = ssd->nr_ers_fails;
+    s->st.stime = s->now;
+    nand_timing_reset_stats(&ssd->nt);
+}
+
+/* Write amplification since the last reset */
+double ftlsim_waf(FtlSim *s)
+{
+    uint64_t host = s->ssd->nr_host_pgs_wr - s->st.host_pgs_wr;
+    uint64_t gc = s->ssd->nr_gc_pgs_wr - s->st.gc_pgs_wr;
+
+    return host ? (double)(host + gc) / host : 0;
+}
+
+void ftlsim_report(FtlSim *s, FILE *out, double wall_secs)
+{
+    struct ssd *ssd = s->ssd;
+    uint64_t nr_reqs = 0;
+    double emu_secs = (s->now - s->st.stime) / 1e9;
+    double util[NAND_NR_CLASSES];
+    int min_erase = INT_MAX;
+    uint8_t pct_used, spare;
+
+    for (int op = 0; op < FTLSIM_NR_OPS; op++) {
+        nr_reqs += s->st.nr_reqs[op];
+    }
+
+    fprintf(out, "requests:      %" PRIu64 "\n", nr_reqs);
+    fprintf(out, "ftl ops/sec:   %.0f (wall %.3fs)\n",
+            wall_secs > 0 ? nr_reqs / wall_secs : 0, wall_secs);
+    fprintf(out, "emulated IOPS: %.0f (emulated %.3fs)\n",
+            emu_secs > 0 ? nr_reqs / emu_secs : 0, emu_secs);
+    fprintf(out, "WAF:           %.3f (host pages %" PRIu64 ", GC pages %"
+            PRIu64 ")\n", ftlsim_waf(s),
+            ssd->nr_host_pgs_wr - s->st.host_pgs_wr,
+            ssd->nr_gc_pgs_wr - s->st.gc_pgs_wr);
+    if (ssd->sp.op_pcent >= 0) {
+        fprintf(out, "OP:            %d%% (%" PRIu64 " of %" PRIu64 " pages "
+                "exported)\n", ssd->sp.op_pcent, ssd->sp.tt_lpns,
+                ssd->sp.tt_pgs);
+    }
+    fprintf(out, "GC:            %" PRIu64 " lines (%" PRIu64 " forced)\n",
+            ssd->nr_gc - s->st.nr_gc, ssd->nr_gc_forced - s->st.nr_gc_forced);
+    for (int i = 0; i < ssd->lm.tt_lines; i++) {
+        min_erase = MIN(min_erase, ssd->lm.lines[i].erase_cnt);
+    }
+    fprintf(out, "wear:          line erases min %d, max %d (%" PRIu64
+            " lines wear-leveled)\n", min_erase, ssd->lm.max_erase_cnt,
+            ssd->nr_wl - s->st.nr_wl);
+    ssd_health(ssd, &pct_used, &spare);
+    fprintf(out, "health:        %d%% used, %d%% spare\n", pct_used, spare);
+    if (ssd->sp.slc_mode) {
+        fprintf(out, "SLC cache:     %" PRIu64 " lines folded, %d of %d "
+                "lines waiting\n", ssd->slc.nr_folds - s->st.nr_folds,
+                ssd->slc.fold_cnt, ssd->slc.nr_lines);
+    }
+    if (ssd->sp.rr_lat) {
+        fprintf(out, "read retry:    %" PRIu64 " retries, %" PRIu64
+                " lines read-reclaimed\n",
+                ssd->nr_read_retries - s->st.nr_read_retries,
+                ssd->nr_read_reclaims - s->st.nr_read_reclaims);
+    }
+    if (ssd->nr_bad_blks || ssd->sp.pgm_fail_ppm || ssd->sp.ers_fail_ppm) {
+        fprintf(out, "bad blocks:    %d of %d (%" PRIu64 " program, %" PRIu64
+                " erase failures)\n", ssd->nr_bad_blks, ssd->sp.tt_blks,
+                ssd->nr_pgm_fails - s->st.nr_pgm_fails,
+                ssd->nr_ers_fails - s->st.nr_ers_fails);
+    }
+
+    nand_timing_util(&ssd->nt, util);
+    fprintf(out, "LUN util:      host read %.3f, host write %.3f, GC %.3f\n",
+            util[NAND_CLS_USER_READ], util[NAND_CLS_USER_WRITE],
+            util[NAND_CLS_GC]);
+
+    for (int op = 0; op < FTLSIM_NR_OPS; op++) {
+        FtlSimHist *h = &s->st.lat[op];
+
+        if (!h->nr) {
+            continue;
+        }
+        fprintf(out, "%-5s lat(us):  avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+                "p99.9 %.1f, p99.99 %.1f, max %.1f\n", ftlsim_op_names[op],
+                h->sum / 1e3 / h->nr,
+                ftlsim_hist_pct(h, 50) / 1e3, ftlsim_hist_pct(h, 90) / 1e3,
+                ftlsim_hist_pct(h, 99) / 1e3, ftlsim_hist_pct(h, 99.9) / 1e3,
+                ftlsim_hist_pct(h, 99.99) / 1e3, h->max / 1e3);
+    }
+}
+
+static inline int ftlsim_hist_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < (1ULL << FTLSIM_HIST_SUB_BITS)) {
+        return v;
+    }
+    e = 63 - clz64(v);
+
+    return ((e - FTLSIM_HIST_SUB_BITS + 1) << FTLSIM_HIST_SUB_BITS) +
+           ((v >> (e - FTLSIM_HIST_SUB_BITS)) &
+            ((1 << FTLSIM_HIST_SUB_BITS) - 1));
+}
+
+/* Largest value falling into bucket @b */
+static inline uint64_t ftlsim_hist_value(int b)
+{
+    int g = b >> FTLSIM_HIST_SUB_BITS;
+    int e = g + FTLSIM_HIST_SUB_BITS - 1;
+    uint64_t sub = b & ((1 << FTLSIM_HIST_SUB_BITS) - 1);
+
+    if (!g) {
+        return b;
+    }
+
+    return (1ULL << e) + (sub << (e - FTLSIM_HIST_SUB_BITS)) +
+           (1ULL << (e - FTLSIM_HIST_SUB_BITS)) - 1;
+}
+
+void ftlsim_hist_add(FtlSimHist *h, uint64_t v)
+{
+    h->cnt[ftlsim_hist_bucket(v)]++;
+    h->nr++;
+    h->sum += v;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+uint64_t ftlsim_hist_pct(FtlSimHist *h, double pct)
+{
+    uint64_t target = (uint64_t)(h->nr * pct / 100);
+    uint64_t seen = 0;
+
+    for (int b = 0; b < FTLSIM_HIST_BUCKETS; b++) {
+        seen += h->cnt[b];
+        if (seen > target) {
+            return MIN(ftlsim_hist_value(b), h->max);
+        }
+    }
+
+    return h->max;
+}
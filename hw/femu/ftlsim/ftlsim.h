@@ -0,0 +1,78 @@
+#ifndef __FEMU_FTLSIM_H
+#define __FEMU_FTLSIM_H
+
+#include "../bbssd/ftl.h"
+
+/*
+ * Standalone bbssd FTL simulator
+ *
+ * Drives ssd_init_ftl()/ssd_io()/ssd_bg_gc() of the black-box SSD directly
+ * from a stub FemuCtrl, on an emulated clock, without a guest or the NVMe
+ * dataplane. Requests are charged exactly as the FTL thread would charge them.
+ */
+
+enum {
+    FTLSIM_READ  = 0,
+    FTLSIM_WRITE = 1,
+    FTLSIM_TRIM  = 2,
+    FTLSIM_NR_OPS,
+};
+
+/* Log-linear histogram: 2^FTLSIM_HIST_SUB_BITS buckets per power of two */
+#define FTLSIM_HIST_SUB_BITS    (5)
+#define FTLSIM_HIST_BUCKETS     ((64 - FTLSIM_HIST_SUB_BITS + 1) << FTLSIM_HIST_SUB_BITS)
+
+typedef struct FtlSimHist {
+    uint64_t cnt[FTLSIM_HIST_BUCKETS];
+    uint64_t nr;
+    uint64_t sum;
+    uint64_t max;
+} FtlSimHist;
+
+typedef struct FtlSimStats {
+    uint64_t   nr_reqs[FTLSIM_NR_OPS];
+    uint64_t   nr_secs[FTLSIM_NR_OPS];
+    FtlSimHist lat[FTLSIM_NR_OPS];
+
+    /* FTL counters when the stats were reset */
+    uint64_t   host_pgs_wr;
+    uint64_t   gc_pgs_wr;
+    uint64_t   nr_gc;
+    uint64_t   nr_gc_forced;
+    uint64_t   nr_wl;
+    uint64_t   nr_folds;
+    uint64_t   nr_read_retries;
+    uint64_t   nr_read_reclaims;
+    uint64_t   nr_pgm_fails;
+    uint64_t   nr_ers_fails;
+    uint64_t   stime;
+} FtlSimStats;
+
+typedef struct FtlSim {
+    FemuCtrl    *n;
+    struct ssd  *ssd;
+    bool        fdp;
+    /* emulated clock in ns, the submission time of the current request */
+    uint64_t    now;
+    FtlSimStats st;
+} FtlSim;
+
+FtlSim *ftlsim_new(void);
+int ftlsim_set_param(FtlSim *s, const char *name, int64_t val);
+void ftlsim_list_params(FILE *out);
+void ftlsim_init(FtlSim *s, bool fdp);
+void ftlsim_free(FtlSim *s);
+
+uint64_t ftlsim_submit(FtlSim *s, int op, uint64_t slba, uint32_t nlb,
+                       uint8_t ph, uint64_t stime);
+uint64_t ftlsim_capacity(FtlSim *s);
+int ftlsim_nr_handles(FtlSim *s);
+
+void ftlsim_reset_stats(FtlSim *s);
+double ftlsim_waf(FtlSim *s);
+void ftlsim_report(FtlSim *s, FILE *out, double wall_secs);
+
+void ftlsim_hist_add(FtlSimHist *h, uint64_t v);
+uint64_t ftlsim_hist_pct(FtlSimHist *h, double pct);
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * femu-ftlsim: run synthetic workloads or replay block traces against the
+ * bbssd FTL without a VM
+ *
+ *   femu-ftlsim -w zipf -n 2000000 -q 32 -o blks_per_pl=128
+ *   femu-ftlsim -T msr.csv -f msr --timeline tl.csv
+ */
+
+#include "trace.h"
+#include <getopt.h>
+#include <math.h>
+
+enum {
+    WL_UNIFORM = 0,
+    WL_ZIPF,
+    WL_SEQ,
+    WL_FDP,
+    WL_NR,
+};
+
+static const char *wl_names[WL_NR] = {
+    [WL_UNIFORM] = "uniform",
+    [WL_ZIPF]    = "zipf",
+    [WL_SEQ]     = "seq",
+    [WL_FDP]     = "fdp",
+};
+
+typedef struct FtlSimArgs {
+    int      wl;
+    uint64_t nr_ops;
+    uint32_t bs;            /* request size in bytes */
+    int      qd;
+    int      read_pct;
+    int      trim_pct;
+    int      prefill_pct;
+    double   theta;
+    int      streams;
+    bool     placement;
+    uint64_t seed;
+    bool     verbose;
+
+    /* trace replay instead of a synthetic workload */
+    const char  *trace;
+    int         fmt;
+    int64_t     dev;
+    char        action;
+    TraceReplay rp;
+    const char  *timeline;
+} FtlSimArgs;
+
+typedef struct Workload {
+    FtlSimArgs *a;
+    uint64_t   rng;
+    uint64_t   nr_blks;     /* capacity in requests of a.bs */
+    uint32_t   nlb;
+    int        nr_handles;
+    uint64_t   seq_next;
+
+    /* zipf over [0, nr_blks) */
+    double     zetan;
+    double     zeta2;
+    double     alpha;
+    double     eta;
+
+    /* fdp: stream i owns blocks [i * stream_blks, (i + 1) * stream_blks) */
+    uint64_t   stream_blks;
+    double     *stream_cdf;
+} Workload;
+
+/* xorshift64*, deterministic per --seed */
+static inline uint64_t wl_rand(Workload *w)
+{
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return w->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double wl_rand_double(Workload *w)
+{
+    return (wl_rand(w) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+
+    for (uint64_t i = 1; i <= n; i++) {
+        sum += 1.0 / pow(i, theta);
+    }
+
+    return sum;
+}
+
+/* Gray et al., "Quickly Generating Billion-Record Synthetic Databases" */
+static uint64_t wl_zipf(Workload *w)
+{
+    double u = wl_rand_double(w);
+    double uz = u * w->zetan;
+    uint64_t rank;
+
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, w->a->theta)) {
+        rank = 1;
+    } else {
+        rank = (uint64_t)(w->nr_blks * pow(w->eta * u - w->eta + 1, w->alpha));
+    }
+    if (rank >= w->nr_blks) {
+        rank = w->nr_blks - 1;
+    }
+
+    /* scatter the hot ranks over the LBA space (FNV-1a) */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        h ^= (rank >> (i * 8)) & 0xff;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h % w->nr_blks;
+}
+
+static void wl_init(Workload *w, FtlSimArgs *a, FtlSim *s)
+{
+    memset(w, 0, sizeof(*w));
+    w->a = a;
+    w->rng = a->seed ? a->seed : 1;
+    w->nlb = a->bs / s->ssd->sp.secsz;
+    w->nr_blks = ftlsim_capacity(s) / w->nlb;
+    w->nr_handles = ftlsim_nr_handles(s);
+
+    if (a->wl == WL_ZIPF) {
+        w->zetan = zeta(w->nr_blks, a->theta);
+        w->zeta2 = zeta(2, a->theta);
+        w->alpha = 1.0 / (1.0 - a->theta);
+        w->eta = (1 - pow(2.0 / w->nr_blks, 1 - a->theta)) /
+                 (1 - w->zeta2 / w->zetan);
+    }
+
+    if (a->wl == WL_FDP) {
+        double sum = 0;
+
+        /* stream i gets 1/(i+1) of the writes: a few hot, many cold ones */
+        w->stream_blks = w->nr_blks / a->streams;
+        w->stream_cdf = g_new(double, a->streams);
+        for (int i = 0; i < a->streams; i++) {
+            sum += 1.0 / (i + 1);
+            w->stream_cdf[i] = sum;
+        }
+        for (int i = 0; i < a->streams; i++) {
+            w->stream_cdf[i] /= sum;
+        }
+    }
+}
+
+static void wl_next(Workload *w, int *op, uint64_t *slba, uint8_t *ph)
+{
+    FtlSimArgs *a = w->a;
+    int pct = wl_rand(w) % 100;
+    uint64_t blk = 0;
+
+    if (pct < a->read_pct) {
+        *op = FTLSIM_READ;
+    } else if (pct < a->read_pct + a->trim_pct) {
+        *op = FTLSIM_TRIM;
+    } else {
+        *op = FTLSIM_WRITE;
+    }
+    *ph = 0;
+
+    switch (a->wl) {
+    case WL_UNIFORM:
+        blk = wl_rand(w) % w->nr_blks;
+        break;
+    case WL_ZIPF:
+        blk = wl_zipf(w);
+        break;
+    case WL_SEQ:
+        blk = w->seq_next++ % w->nr_blks;
+        break;
+    case WL_FDP:
+    {
+        double u = wl_rand_double(w);
+        int i = 0;
+
+        while (i < a->streams - 1 && u > w->stream_cdf[i]) {
+            i++;
+        }
+        blk = i * w->stream_blks + wl_rand(w) % w->stream_blks;
+        *ph = i % w->nr_handles;
+        break;
+    }
+    }
+
+    *slba = blk * w->nlb;
+}
+
+/*
+ * Closed loop at queue depth a->qd on the emulated clock: the next request is
+ * issued when the earliest outstanding one completes
+ */
+static void run(FtlSim *s, Workload *w, uint64_t nr_ops, bool prefill)
+{
+    int qd = w->a->qd;
+    uint64_t *slot = g_new0(uint64_t, qd);
+    uint64_t nr_blks = w->nr_blks * w->a->prefill_pct / 100;
+
+    for (int i = 0; i < qd; i++) {
+        slot[i] = s->now;
+    }
+
+    for (uint64_t i = 0; i < nr_ops; i++) {
+        int op = FTLSIM_WRITE, k = 0;
+        uint64_t slba;
+        uint8_t ph = 0;
+
+        for (int j = 1; j < qd; j++) {
+            if (slot[j] < slot[k]) {
+                k = j;
+            }
+        }
+
+        if (prefill) {
+            if (i >= nr_blks) {
+                break;
+            }
+            slba = i * w->nlb;
+            if (w->a->wl == WL_FDP) {
+                ph = MIN(i / w->stream_blks, w->a->streams - 1) % w->nr_handles;
+            }
+        } else {
+            wl_next(w, &op, &slba, &ph);
+        }
+
+        slot[k] = ftlsim_submit(s, op, slba, w->nlb, ph, slot[k]);
+    }
+
+    g_free(slot);
+}
+
+static int replay(FtlSim *s, FtlSimArgs *a, Workload *w, FILE *out,
+                  uint64_t max_recs)
+{
+    TraceReader tr;
+    uint64_t nr;
+    int64_t t0;
+    int ret;
+
+    ret = trace_open(&tr, a->trace, a->fmt);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", a->trace, strerror(-ret));
+        return 1;
+    }
+    tr.dev = a->dev;
+    tr.action = a->action;
+
+    a->rp.qd = a->qd;
+    a->rp.max_recs = max_recs;
+    if (a->timeline) {
+        a->rp.timeline = fopen(a->timeline, "w");
+        if (!a->rp.timeline) {
+            fprintf(stderr, "Failed to create %s: %s\n", a->timeline,
+                    strerror(errno));
+            trace_close(&tr);
+            return 1;
+        }
+    }
+
+    fprintf(out, "trace %s, %s loop, capacity %" PRIu64 " MiB\n", a->trace,
+            a->rp.closed ? "closed" : "open",
+            ftlsim_capacity(s) * s->ssd->sp.secsz >> 20);
+
+    if (a->prefill_pct) {
+        run(s, w, UINT64_MAX, true);
+        ftlsim_reset_stats(s);
+    }
+
+    t0 = g_get_monotonic_time();
+    nr = trace_replay(s, &tr, &a->rp);
+    fprintf(out, "trace lines:   %" PRIu64 " (%" PRIu64 " skipped, %" PRIu64
+            " replayed)\n", tr.nr_lines, tr.nr_skipped, nr);
+    ftlsim_report(s, out, (g_get_monotonic_time() - t0) / 1e6);
+
+    if (a->rp.timeline) {
+        fclose(a->rp.timeline);
+    }
+    trace_close(&tr);
+    fclose(out);
+    ftlsim_free(s);
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -w, --workload NAME   uniform, zipf, seq or fdp (default uniform)\n"
+            "  -n, --ops N           requests to run (default 1000000)\n"
+            "  -b, --bs BYTES        request size (default 4096)\n"
+            "  -q, --qd N            queue depth (default 1)\n"
+            "  -r, --read-pct P      percentage of reads (default 0)\n"
+            "  -t, --trim-pct P      percentage of trims (default 0)\n"
+            "  -p, --prefill-pct P   sequentially fill P%% first (default 100)\n"
+            "  -z, --theta T         zipf skew, != 1 (default 0.99)\n"
+            "  -s, --streams N       fdp write streams (default 8)\n"
+            "  -P, --no-placement    fdp streams without FDP placement\n"
+            "  -S, --seed N          random seed (default 1)\n"
+            "  -o, --param NAME=VAL  device property, see below\n"
+            "  -v, --verbose         keep the FTL log on stdout\n"
+            "Trace replay:\n"
+            "  -T, --trace FILE      replay FILE instead of a workload\n"
+            "  -f, --format FMT      blkparse, msr or alibaba (default blkparse)\n"
+            "  -d, --dev N           only records of MSR disk/Alibaba device N\n"
+            "  -a, --action C        blkparse action to replay (default Q)\n"
+            "  -c, --closed          closed loop at --qd, ignore trace time\n"
+            "  -x, --speed X         open loop time scale (default 1)\n"
+            "  -i, --interval MS     timeline interval (default 1000)\n"
+            "  -l, --timeline FILE   write the per-interval timeline as CSV\n"
+            "  (with a trace, --ops caps the replayed records, 0 = all)\n"
+            "Device properties and defaults:\n", name);
+    ftlsim_list_params(stderr);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "workload",     required_argument, NULL, 'w' },
+        { "ops",          required_argument, NULL, 'n' },
+        { "bs",           required_argument, NULL, 'b' },
+        { "qd",           required_argument, NULL, 'q' },
+        { "read-pct",     required_argument, NULL, 'r' },
+        { "trim-pct",     required_argument, NULL, 't' },
+        { "prefill-pct",  required_argument, NULL, 'p' },
+        { "theta",        required_argument, NULL, 'z' },
+        { "streams",      required_argument, NULL, 's' },
+        { "no-placement", no_argument,       NULL, 'P' },
+        { "seed",         required_argument, NULL, 'S' },
+        { "param",        required_argument, NULL, 'o' },
+        { "verbose",      no_argument,       NULL, 'v' },
+        { "trace",        required_argument, NULL, 'T' },
+        { "format",       required_argument, NULL, 'f' },
+        { "dev",          required_argument, NULL, 'd' },
+        { "action",       required_argument, NULL, 'a' },
+        { "closed",       no_argument,       NULL, 'c' },
+        { "speed",        required_argument, NULL, 'x' },
+        { "interval",     required_argument, NULL, 'i' },
+        { "timeline",     required_argument, NULL, 'l' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    FtlSimArgs a = {
+        .wl = WL_UNIFORM,
+        .nr_ops = 1000000,
+        .bs = 4096,
+        .qd = 1,
+        .prefill_pct = 100,
+        .theta = 0.99,
+        .streams = 8,
+        .placement = true,
+        .seed = 1,
+        .fmt = TRACE_FMT_BLKPARSE,
+        .dev = -1,
+        .action = 'Q',
+        .rp = {
+            .speed = 1,
+            .interval = 1000 * 1000 * 1000ULL,
+        },
+    };
+    FtlSim *s = ftlsim_new();
+    bool nr_ops_set = false;
+    Workload w;
+    FILE *out;
+    int64_t t0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "w:n:b:q:r:t:p:z:s:PS:o:vT:f:d:a:cx:i:l:h",
+                            longopts, NULL)) != -1) {
+        switch (c) {
+        case 'w':
+            a.wl = -1;
+            for (int i = 0; i < WL_NR; i++) {
+                if (!strcmp(optarg, wl_names[i])) {
+                    a.wl = i;
+                }
+            }
+            if (a.wl < 0) {
+                fprintf(stderr, "Unknown workload: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            a.nr_ops = strtoull(optarg, NULL, 0);
+            nr_ops_set = true;
+            break;
+        case 'b':
+            a.bs = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            a.qd = atoi(optarg);
+            break;
+        case 'r':
+            a.read_pct = atoi(optarg);
+            break;
+        case 't':
+            a.trim_pct = atoi(optarg);
+            break;
+        case 'p':
+            a.prefill_pct = atoi(optarg);
+            break;
+        case 'z':
+            a.theta = strtod(optarg, NULL);
+            break;
+        case 's':
+            a.streams = atoi(optarg);
+            break;
+        case 'P':
+            a.placement = false;
+            break;
+        case 'S':
+            a.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+        {
+            char *eq = strchr(optarg, '=');
+
+            if (!eq) {
+                fprintf(stderr, "Expected NAME=VALUE: %s\n", optarg);
+                return 1;
+            }
+            *eq = '\0';
+            if (ftlsim_set_param(s, optarg, strtoll(eq + 1, NULL, 0)) < 0) {
+                fprintf(stderr, "Unknown device property: %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'v':
+            a.verbose = true;
+            break;
+        case 'T':
+            a.trace = optarg;
+            break;
+        case 'f':
+            a.fmt = trace_fmt_parse(optarg);
+            if (a.fmt < 0) {
+                fprintf(stderr, "Unknown trace format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            a.dev = strtoll(optarg, NULL, 0);
+            break;
+        case 'a':
+            a.action = optarg[0];
+            break;
+        case 'c':
+            a.rp.closed = true;
+            break;
+        case 'x':
+            a.rp.speed = strtod(optarg, NULL);
+            break;
+        case 'i':
+            a.rp.interval = strtoull(optarg, NULL, 0) * 1000 * 1000;
+            break;
+        case 'l':
+            a.timeline = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (a.qd < 1 || a.streams < 1 || a.theta == 1.0 || a.theta <= 0 ||
+        a.read_pct < 0 || a.trim_pct < 0 || a.read_pct + a.trim_pct > 100 ||
+        a.prefill_pct < 0 || a.prefill_pct > 100 || a.rp.speed <= 0 ||
+        !a.rp.interval) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* the FTL logs to stdout, keep the report apart from it */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!a.verbose) {
+        int fd = open("/dev/null", O_WRONLY);
+
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    ftlsim_init(s, a.wl == WL_FDP && a.placement);
+    if (a.bs < s->ssd->sp.secsz || a.bs % s->ssd->sp.secsz ||
+        a.bs / s->ssd->sp.secsz > UINT16_MAX) {
+        fprintf(stderr, "Invalid request size %u\n", a.bs);
+        return 1;
+    }
+    wl_init(&w, &a, s);
+    if (a.wl == WL_FDP && w.stream_blks == 0) {
+        fprintf(stderr, "Too many streams for the capacity\n");
+        return 1;
+    }
+
+    if (a.trace) {
+        return replay(s, &a, &w, out, nr_ops_set ? a.nr_ops : 0);
+    }
+
+    fprintf(out, "workload %s, %" PRIu64 " requests of %u bytes at QD %d, "
+            "%d%% read, %d%% trim, capacity %" PRIu64 " MiB\n",
+            wl_names[a.wl], a.nr_ops, a.bs, a.qd, a.read_pct, a.trim_pct,
+            ftlsim_capacity(s) * s->ssd->sp.secsz >> 20);
+
+    if (a.prefill_pct) {
+        run(s, &w, UINT64_MAX, true);
+        ftlsim_reset_stats(s);
+    }
+
+    t0 = g_get_monotonic_time();
+    run(s, &w, a.nr_ops, false);
+    ftlsim_report(s, out, (g_get_monotonic_time() - t0) / 1e6);
+
+    fclose(out);
+    g_free(w.stream_cdf);
+    ftlsim_free(s);
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include "trace.h"
+
+#include <sys/mman.h>
+
+/* Give parsed pages back once this much of the mapping is behind us */
+#define TRACE_RELEASE_CHUNK (64ULL << 20)
+
+static const char *trace_fmt_names[TRACE_NR_FMTS] = {
+    [TRACE_FMT_BLKPARSE] = "blkparse",
+    [TRACE_FMT_MSR]      = "msr",
+    [TRACE_FMT_ALIBABA]  = "alibaba",
+};
+
+int trace_fmt_parse(const char *name)
+{
+    for (int i = 0; i < TRACE_NR_FMTS; i++) {
+        if (!strcmp(name, trace_fmt_names[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int trace_open(TraceReader *tr, const char *path, int fmt)
+{
+    struct stat st;
+
+    memset(tr, 0, sizeof(*tr));
+    tr->fmt = fmt;
+    tr->dev = -1;
+    tr->action = 'Q';
+
+    tr->fd = open(path, O_RDONLY);
+    if (tr->fd < 0) {
+        return -errno;
+    }
+    if (fstat(tr->fd, &st) < 0) {
+        close(tr->fd);
+        return -errno;
+    }
+    tr->size = st.st_size;
+    if (!tr->size) {
+        return 0;
+    }
+
+    tr->base = mmap(NULL, tr->size, PROT_READ, MAP_PRIVATE, tr->fd, 0);
+    if (tr->base == MAP_FAILED) {
+        tr->base = NULL;
+        close(tr->fd);
+        return -errno;
+    }
+    madvise(tr->base, tr->size, MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+void trace_close(TraceReader *tr)
+{
+    if (tr->base) {
+        munmap(tr->base, tr->size);
+    }
+    close(tr->fd);
+}
+
+/* Start of the comma separated field @i after @p, NULL if the line is short */
+static inline const char *csv_field(const char *p, const char *end, int i)
+{
+    while (i-- > 0) {
+        p = memchr(p, ',', end - p);
+        if (!p) {
+            return NULL;
+        }
+        p++;
+    }
+
+    return p;
+}
+
+static inline bool parse_u64(const char *p, const char *end, uint64_t *v)
+{
+    uint64_t x = 0;
+    const char *s = p;
+
+    while (p < end && *p == ' ') {
+        p++;
+        s++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        x = x * 10 + (*p++ - '0');
+    }
+    *v = x;
+
+    return p != s;
+}
+
+/* Timestamp,Hostname,DiskNumber,Type,Offset,Size,ResponseTime */
+static bool trace_parse_msr(TraceReader *tr, const char *p, const char *end,
+                            TraceRec *r)
+{
+    const char *f;
+    uint64_t ts, dev, off, len;
+
+    if (!parse_u64(p, end, &ts) ||
+        !(f = csv_field(p, end, 2)) || !parse_u64(f, end, &dev) ||
+        !(f = csv_field(f, end, 1))) {
+        return false;
+    }
+    if (end - f >= 4 && !strncasecmp(f, "Read", 4)) {
+        r->op = FTLSIM_READ;
+    } else if (end - f >= 5 && !strncasecmp(f, "Write", 5)) {
+        r->op = FTLSIM_WRITE;
+    } else {
+        return false;
+    }
+    if (!(f = csv_field(f, end, 1)) || !parse_u64(f, end, &off) ||
+        !(f = csv_field(f, end, 1)) || !parse_u64(f, end, &len)) {
+        return false;
+    }
+    if (tr->dev >= 0 && dev != (uint64_t)tr->dev) {
+        return false;
+    }
+
+    /* Windows filetime, 100ns units */
+    r->ts = ts * 100;
+    r->off = off;
+    r->len = len;
+
+    return true;
+}
+
+/* device_id,opcode,offset,length,timestamp (us) */
+static bool trace_parse_alibaba(TraceReader *tr, const char *p,
+                                const char *end, TraceRec *r)
+{
+    const char *f;
+    uint64_t dev, off, len, ts;
+
+    if (!parse_u64(p, end, &dev) || !(f = csv_field(p, end, 1)) || f >= end) {
+        return false;
+    }
+    switch (*f) {
+    case 'R':
+    case 'r':
+        r->op = FTLSIM_READ;
+        break;
+    case 'W':
+    case 'w':
+        r->op = FTLSIM_WRITE;
+        break;
+    default:
+        return false;
+    }
+    if (!(f = csv_field(f, end, 1)) || !parse_u64(f, end, &off) ||
+        !(f = csv_field(f, end, 1)) || !parse_u64(f, end, &len) ||
+        !(f = csv_field(f, end, 1)) || !parse_u64(f, end, &ts)) {
+        return false;
+    }
+    if (tr->dev >= 0 && dev != (uint64_t)tr->dev) {
+        return false;
+    }
+
+    r->ts = ts * 1000;
+    r->off = off;
+    r->len = len;
+
+    return true;
+}
+
+/* "  8,0    3     1     0.000000000   697  Q   W 223490 + 8 [kworker/3:1]" */
+static bool trace_parse_blkparse(TraceReader *tr, const char *p,
+                                 const char *end, TraceRec *r)
+{
+    char line[256], action[8], rwbs[8];
+    unsigned major, minor, cpu, pid;
+    uint64_t seq, sector, nsecs;
+    double t;
+    size_t len = MIN(end - p, sizeof(line) - 1);
+
+    memcpy(line, p, len);
+    line[len] = '\0';
+    if (sscanf(line, "%u,%u %u %" SCNu64 " %lf %u %7s %7s %" SCNu64 " + %"
+               SCNu64, &major, &minor, &cpu, &seq, &t, &pid, action, rwbs,
+               &sector, &nsecs) != 10) {
+        return false;
+    }
+    if (action[0] != tr->action || action[1] != '\0' || !nsecs) {
+        return false;
+    }
+
+    if (strchr(rwbs, 'D')) {
+        r->op = FTLSIM_TRIM;
+    } else if (strchr(rwbs, 'W')) {
+        r->op = FTLSIM_WRITE;
+    } else if (strchr(rwbs, 'R')) {
+        r->op = FTLSIM_READ;
+    } else {
+        return false;
+    }
+
+    r->ts = (uint64_t)(t * 1e9);
+    r->off = sector << 9;
+    r->len = nsecs << 9;
+
+    return true;
+}
+
+/*
+ * Parse up to @max records into @recs. Returns how many were parsed, 0 once
+ * the trace is exhausted. Lines that are not I/O records (headers, other
+ * blkparse actions, other devices, ...) are skipped.
+ */
+int trace_read(TraceReader *tr, TraceRec *recs, int max)
+{
+    int nr = 0;
+
+    while (nr < max && tr->pos < tr->size) {
+        const char *p = tr->base + tr->pos;
+        const char *end = memchr(p, '\n', tr->size - tr->pos);
+        bool ok;
+
+        if (!end) {
+            end = tr->base + tr->size;
+        }
+        tr->pos = end - tr->base + 1;
+        tr->nr_lines++;
+
+        switch (tr->fmt) {
+        case TRACE_FMT_MSR:
+            ok = trace_parse_msr(tr, p, end, &recs[nr]);
+            break;
+        case TRACE_FMT_ALIBABA:
+            ok = trace_parse_alibaba(tr, p, end, &recs[nr]);
+            break;
+        default:
+            ok = trace_parse_blkparse(tr, p, end, &recs[nr]);
+        }
+        if (ok && recs[nr].len) {
+            nr++;
+        } else {
+            tr->nr_skipped++;
+        }
+    }
+
+    /* drop what we parsed from the page cache mapping */
+    if (tr->pos - tr->released >= TRACE_RELEASE_CHUNK) {
+        size_t upto = QEMU_ALIGN_DOWN(MIN(tr->pos, tr->size),
+                                      qemu_real_host_page_size());
+
+        madvise(tr->base + tr->released, upto - tr->released, MADV_DONTNEED);
+        tr->released = upto;
+    }
+
+    return nr;
+}
+
+#define TRACE_BATCH         (4096)
+
+typedef struct TraceInterval {
+    uint64_t   stime;
+    uint64_t   nr_reqs[FTLSIM_NR_OPS];
+    uint64_t   bytes[FTLSIM_NR_OPS];
+    FtlSimHist lat;
+
+    /* FTL counters at stime */
+    uint64_t   host_pgs_wr;
+    uint64_t   gc_pgs_wr;
+    uint64_t   nr_gc;
+} TraceInterval;
+
+static void trace_interval_start(FtlSim *s, TraceInterval *iv, uint64_t stime)
+{
+    memset(iv, 0, sizeof(*iv));
+    iv->stime = stime;
+    iv->host_pgs_wr = s->ssd->nr_host_pgs_wr;
+    iv->gc_pgs_wr = s->ssd->nr_gc_pgs_wr;
+    iv->nr_gc = s->ssd->nr_gc;
+}
+
+static void trace_interval_emit(FtlSim *s, TraceReplay *rp, TraceInterval *iv,
+                                uint64_t t0)
+{
+    double secs = rp->interval / 1e9;
+    uint64_t host = s->ssd->nr_host_pgs_wr - iv->host_pgs_wr;
+    uint64_t gc = s->ssd->nr_gc_pgs_wr - iv->gc_pgs_wr;
+
+    fprintf(rp->timeline, "%.3f,%.0f,%.0f,%.0f,%.2f,%.2f,%.3f,%" PRIu64
+            ",%.1f,%.1f,%.1f\n", (iv->stime - t0) / 1e9,
+            iv->nr_reqs[FTLSIM_READ] / secs, iv->nr_reqs[FTLSIM_WRITE] / secs,
+            iv->nr_reqs[FTLSIM_TRIM] / secs,
+            iv->bytes[FTLSIM_READ] / secs / 1e6,
+            iv->bytes[FTLSIM_WRITE] / secs / 1e6,
+            host ? (double)(host + gc) / host : 0, s->ssd->nr_gc - iv->nr_gc,
+            iv->lat.nr ? iv->lat.sum / 1e3 / iv->lat.nr : 0,
+            ftlsim_hist_pct(&iv->lat, 99) / 1e3, iv->lat.max / 1e3);
+}
+
+/* Submit @r at @stime, split to what one NvmeRequest can carry */
+static uint64_t trace_submit(FtlSim *s, TraceRec *r, uint64_t stime)
+{
+    struct ssdparams *spp = &s->ssd->sp;
+    uint64_t cap = ftlsim_capacity(s);
+    uint32_t max_nlb = UINT16_MAX / spp->secs_per_pg * spp->secs_per_pg;
+    uint64_t slba = r->off / spp->secsz;
+    uint64_t nlb = DIV_ROUND_UP(r->len, spp->secsz);
+    uint64_t etime = stime, t;
+
+    /* traces of larger devices wrap around the emulated one */
+    nlb = MIN(nlb, cap);
+    slba %= cap;
+    if (slba + nlb > cap) {
+        slba = cap - nlb;
+    }
+
+    while (nlb) {
+        uint32_t n = MIN(nlb, max_nlb);
+
+        t = ftlsim_submit(s, r->op, slba, n, 0, stime);
+        etime = MAX(etime, t);
+        slba += n;
+        nlb -= n;
+    }
+
+    return etime;
+}
+
+/*
+ * Replay the records of @tr against @s, returning how many were replayed.
+ * Open loop submits each record at its trace time offset (scaled by speed)
+ * from the start of the replay, whatever the device keeps up with; closed
+ * loop keeps qd records outstanding and ignores trace time.
+ */
+uint64_t trace_replay(FtlSim *s, TraceReader *tr, TraceReplay *rp)
+{
+    TraceRec *recs = g_new(TraceRec, TRACE_BATCH);
+    TraceInterval *iv = g_new(TraceInterval, 1);
+    int qd = rp->closed ? rp->qd : 1;
+    uint64_t *slot = g_new(uint64_t, qd);
+    uint64_t t0 = s->now, ts0 = 0, nr_recs = 0;
+    int nr;
+
+    for (int i = 0; i < qd; i++) {
+        slot[i] = t0;
+    }
+    if (rp->timeline) {
+        fprintf(rp->timeline, "time_s,read_iops,write_iops,trim_iops,"
+                "read_mbps,write_mbps,waf,gc,lat_avg_us,lat_p99_us,"
+                "lat_max_us\n");
+    }
+    trace_interval_start(s, iv, t0);
+
+    while ((nr = trace_read(tr, recs, TRACE_BATCH)) > 0) {
+        for (int i = 0; i < nr; i++) {
+            TraceRec *r = &recs[i];
+            uint64_t stime, etime;
+            int k = 0;
+
+            if (rp->max_recs && nr_recs == rp->max_recs) {
+                goto out;
+            }
+
+            if (rp->closed) {
+                for (int j = 1; j < qd; j++) {
+                    if (slot[j] < slot[k]) {
+                        k = j;
+                    }
+                }
+                stime = slot[k];
+            } else {
+                if (!nr_recs) {
+                    ts0 = r->ts;
+                }
+                /* records slightly out of order go out right away */
+                stime = t0 + (r->ts > ts0 ? (r->ts - ts0) / rp->speed : 0);
+            }
+            stime = MAX(stime, s->now);
+
+            while (rp->timeline && stime >= iv->stime + rp->interval) {
+                trace_interval_emit(s, rp, iv, t0);
+                trace_interval_start(s, iv, iv->stime + rp->interval);
+            }
+
+            etime = trace_submit(s, r, stime);
+            slot[k] = etime;
+
+            iv->nr_reqs[r->op]++;
+            iv->bytes[r->op] += r->len;
+            ftlsim_hist_add(&iv->lat, etime - stime);
+            nr_recs++;
+        }
+    }
+
+out:
+    if (rp->timeline && nr_recs) {
+        trace_interval_emit(s, rp, iv, t0);
+    }
+    g_free(slot);
+    g_free(iv);
+    g_free(recs);
+
+    return nr_recs;
+}
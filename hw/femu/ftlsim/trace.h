@@ -0,0 +1,66 @@
+#ifndef __FEMU_FTLSIM_TRACE_H
+#define __FEMU_FTLSIM_TRACE_H
+
+#include "ftlsim.h"
+
+/*
+ * Streaming block trace reader and replay
+ *
+ * The trace file is mmap()ed and parsed a batch of records at a time; pages
+ * already parsed are dropped again, so traces far larger than RAM replay in
+ * constant memory. Records are fed to the standalone FTL (ftlsim.h).
+ */
+
+enum {
+    TRACE_FMT_BLKPARSE = 0,  /* default blkparse text output */
+    TRACE_FMT_MSR,           /* SNIA MSR Cambridge CSV */
+    TRACE_FMT_ALIBABA,       /* Alibaba block trace CSV */
+    TRACE_NR_FMTS,
+};
+
+typedef struct TraceRec {
+    uint64_t ts;        /* ns, trace clock */
+    uint64_t off;       /* bytes */
+    uint32_t len;       /* bytes */
+    uint8_t  op;        /* FTLSIM_READ / FTLSIM_WRITE / FTLSIM_TRIM */
+} TraceRec;
+
+typedef struct TraceReader {
+    int      fmt;
+    int      fd;
+    char     *base;
+    size_t   size;
+    size_t   pos;
+    /* everything below this offset has been given back to the kernel */
+    size_t   released;
+
+    /* only records of this device (MSR disk / Alibaba device id), -1 = all */
+    int64_t  dev;
+    /* blkparse action to take records from, 'Q' by default */
+    char     action;
+
+    uint64_t nr_lines;
+    uint64_t nr_skipped;
+} TraceReader;
+
+typedef struct TraceReplay {
+    /* closed loop at qd, otherwise open loop on the trace timestamps */
+    bool     closed;
+    int      qd;
+    /* open loop: trace inter-arrival times are divided by this */
+    double   speed;
+    /* stop after this many records, 0 = whole trace */
+    uint64_t max_recs;
+
+    /* one timeline row per interval ns of emulated time, to timeline */
+    uint64_t interval;
+    FILE     *timeline;
+} TraceReplay;
+
+int trace_fmt_parse(const char *name);
+int trace_open(TraceReader *tr, const char *path, int fmt);
+int trace_read(TraceReader *tr, TraceRec *recs, int max);
+void trace_close(TraceReader *tr);
+uint64_t trace_replay(FtlSim *s, TraceReader *tr, TraceReplay *rp);
+
+#endif
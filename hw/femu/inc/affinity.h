@@ -0,0 +1,17 @@
+#ifndef __FEMU_AFFINITY_H
+#define __FEMU_AFFINITY_H
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include <sched.h>
+
+/* Parse a host CPU list such as "2-5,8". Returns -1 if malformed. */
+int femu_cpulist_parse(const char *str, cpu_set_t *set);
+
+/*
+ * Pin a thread to the nth CPU of @set (wrapping around), or to the whole set
+ * if nth < 0. An empty set leaves the thread alone.
+ */
+int femu_thread_pin(QemuThread *t, const cpu_set_t *set, int nth);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __FEMU_IDLE_H
+#define __FEMU_IDLE_H
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/event_notifier.h"
+#include "qemu/timer.h"
+
+/*
+ * Adaptive idling for the dataplane threads (pollers and FTL thread)
+ *
+ * A thread keeps spinning for spin_ns after it last had work, then blocks on
+ * an eventfd until a producer kicks it. Producers only pay for the eventfd
+ * write while the consumer is actually asleep, and nothing at all when
+ * spin_ns is 0 (always spin, the default).
+ *
+ * Sleeping side:
+ *
+ *     femu_idle_prepare(w);
+ *     if (work appeared meanwhile) femu_idle_cancel(w); else femu_idle_sleep(w);
+ *
+ * Producing side: make the work visible, then femu_idle_kick(w).
+ */
+typedef struct FemuIdle {
+    EventNotifier e;
+    int64_t     spin_ns;
+    /* when the owner last had work */
+    int64_t     last_busy;
+    int         sleeping;
+    /* when the sleeper was kicked, for the wake-up latency */
+    int64_t     kick_ns;
+
+    uint64_t    nr_sleeps;
+    uint64_t    nr_wakeups;
+    int64_t     wake_lat_sum;
+    int64_t     wake_lat_max;
+} FemuIdle;
+
+void femu_idle_init(FemuIdle *w, int64_t spin_ns);
+void femu_idle_cleanup(FemuIdle *w);
+void femu_idle_sleep(FemuIdle *w);
+void femu_idle_cancel(FemuIdle *w);
+void femu_idle_reset_stats(FemuIdle *w);
+
+static inline void femu_idle_busy(FemuIdle *w, int64_t now)
+{
+    w->last_busy = now;
+}
+
+/* Idle for longer than the spin budget: time to prepare for sleeping */
+static inline bool femu_idle_expired(FemuIdle *w, int64_t now)
+{
+    return w->spin_ns && now - w->last_busy >= w->spin_ns;
+}
+
+/* Announce the sleep; the caller must look for work once more afterwards */
+static inline void femu_idle_prepare(FemuIdle *w)
+{
+    qatomic_set(&w->sleeping, 1);
+    smp_mb();
+}
+
+static inline void femu_idle_kick(FemuIdle *w)
+{
+    if (!w->spin_ns) {
+        return;
+    }
+
+    /* pairs with femu_idle_prepare(): work is visible before the check */
+    smp_mb();
+    if (qatomic_read(&w->sleeping)) {
+        qatomic_set(&w->kick_ns, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+        if (qatomic_xchg(&w->sleeping, 0)) {
+            event_notifier_set(&w->e);
+        }
+    }
+}
+
+#endif
@@ -199,6 +199,35 @@ void nvme_isr_notify_io(void *opaque)
     nvme_isr_notify_legacy(opaque);
 }
 
+/*
+ * Interrupt coalescing: hold back the interrupt of an I/O CQ until more than
+ * THR CQEs are pending on it or the oldest one has waited TIME * 100us. A
+ * TIME of 0 means no delay; vectors with CD set in the Interrupt Vector
+ * Configuration feature are never coalesced. The admin CQ is not coalesced.
+ *
+ * Called by the poller after posting CQEs (cq->intc_pending counts them) and
+ * on every idle loop, so a held back interrupt fires when its time is up.
+ */
+void nvme_isr_coalesce_io(FemuCtrl *n, NvmeCQueue *cq, int64_t now)
+{
+    uint32_t intc = n->features.int_coalescing;
+    uint32_t ivc;
+
+    if (!cq->intc_pending) {
+        return;
+    }
+
+    ivc = cq->vector <= n->nr_io_queues ?
+          n->features.int_vector_config[cq->vector] : 0;
+    if (!NVME_INTVC_CD(ivc) && cq->intc_pending <= NVME_INTC_THR(intc) &&
+        now - cq->intc_stime < NVME_INTC_TIME(intc) * NVME_INTC_TIME_NS) {
+        return;
+    }
+
+    cq->intc_pending = 0;
+    nvme_isr_notify_io(cq);
+}
+
 int nvme_setup_virq(FemuCtrl *n, NvmeCQueue *cq)
 {
     int ret;
@@ -0,0 +1,64 @@
+#include "../inc/affinity.h"
+
+int femu_cpulist_parse(const char *str, cpu_set_t *set)
+{
+    const char *p = str;
+    unsigned long lo, hi;
+    char *end;
+
+    CPU_ZERO(set);
+    while (*p) {
+        lo = strtoul(p, &end, 10);
+        if (end == p) {
+            return -1;
+        }
+        hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtoul(p, &end, 10);
+            if (end == p || hi < lo) {
+                return -1;
+            }
+        }
+        if (hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (; lo <= hi; lo++) {
+            CPU_SET(lo, set);
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        p = end;
+    }
+
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+int femu_thread_pin(QemuThread *t, const cpu_set_t *set, int nth)
+{
+    cpu_set_t one;
+    int nr = CPU_COUNT(set);
+    int cpu;
+
+    if (!nr) {
+        return 0;
+    }
+
+    if (nth >= 0) {
+        nth %= nr;
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, set) && !nth--) {
+                break;
+            }
+        }
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        set = &one;
+    }
+
+    return -pthread_setaffinity_np(t->thread, sizeof(cpu_set_t), set);
+}
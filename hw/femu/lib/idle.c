@@ -0,0 +1,70 @@
+#include "../inc/idle.h"
+
+void femu_idle_init(FemuIdle *w, int64_t spin_ns)
+{
+    memset(w, 0, sizeof(*w));
+    w->spin_ns = spin_ns;
+    if (spin_ns && event_notifier_init(&w->e, 0)) {
+        fprintf(stderr, "FEMU: idle eventfd init failed, spinning instead\n");
+        w->spin_ns = 0;
+    }
+}
+
+void femu_idle_cleanup(FemuIdle *w)
+{
+    if (w->spin_ns) {
+        event_notifier_cleanup(&w->e);
+        w->spin_ns = 0;
+    }
+}
+
+/* Block until kicked, after femu_idle_prepare() found no work */
+void femu_idle_sleep(FemuIdle *w)
+{
+    GPollFD pfd = {
+        .fd = event_notifier_get_fd(&w->e),
+        .events = G_IO_IN,
+    };
+    int64_t now;
+
+    w->nr_sleeps++;
+    /* a stale write from a kick that lost against femu_idle_cancel() only
+     * ends this sleep early */
+    while (qatomic_read(&w->sleeping)) {
+        qemu_poll_ns(&pfd, 1, -1);
+        if (pfd.revents & G_IO_IN) {
+            break;
+        }
+    }
+    event_notifier_test_and_clear(&w->e);
+    qatomic_set(&w->sleeping, 0);
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (qatomic_read(&w->kick_ns)) {
+        int64_t lat = now - qatomic_read(&w->kick_ns);
+
+        w->nr_wakeups++;
+        w->wake_lat_sum += lat;
+        w->wake_lat_max = MAX(w->wake_lat_max, lat);
+        qatomic_set(&w->kick_ns, 0);
+    }
+    w->last_busy = now;
+}
+
+/* Work showed up after femu_idle_prepare(), stay awake */
+void femu_idle_cancel(FemuIdle *w)
+{
+    if (!qatomic_xchg(&w->sleeping, 0)) {
+        /* raced with a kick */
+        event_notifier_test_and_clear(&w->e);
+    }
+    qatomic_set(&w->kick_ns, 0);
+}
+
+void femu_idle_reset_stats(FemuIdle *w)
+{
+    w->nr_sleeps = 0;
+    w->nr_wakeups = 0;
+    w->wake_lat_sum = 0;
+    w->wake_lat_max = 0;
+}
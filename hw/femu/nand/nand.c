@@ -1,5 +1,13 @@
 #include "../nvme.h"
 
+NandFlashTiming nand_flash_timing;
+
+/* Lower/Upper page format within one block */
+int slc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+int mlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+int tlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+int qlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+
 /*
  * Lower/Upper page pairing in one block
  * Shadow page programming sequence to reduce cell-to-cell interference
@@ -100,7 +100,7 @@ typedef struct NandFlashTiming {
     int64_t chnl_pg_xfer_lat[MAX_FLASH_TYPE];
 } NandFlashTiming;
 
-static struct NandFlashTiming nand_flash_timing;
+extern NandFlashTiming nand_flash_timing;
 
 struct NandFlash {
     uint8_t flash_type;
@@ -118,10 +118,10 @@ struct NandFlash {
 #define PPA_SEC(ln, ppa) ((ppa & ln->ppaf.sec_mask) >> ln->ppaf.sec_offset)
 
 /* Lower/Upper page format within one block */
-static int slc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
-static int mlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
-static int tlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
-static int qlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+extern int slc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+extern int mlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+extern int tlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
+extern int qlc_tbl[MAX_SUPPORTED_PAGES_PER_BLOCK];
 
 static inline uint8_t get_page_type(int flash_type, int pg)
 {
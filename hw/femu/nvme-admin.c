@@ -68,7 +68,6 @@ static const uint32_t nvme_cse_iocs_zoned[256] = {
 static uint16_t nvme_del_sq(FemuCtrl *n, NvmeCmd *cmd)
 {
     NvmeDeleteQ *c = (NvmeDeleteQ *)cmd;
-    NvmeRequest *req, *next;
     NvmeSQueue *sq;
     NvmeCQueue *cq;
     uint16_t qid = le16_to_cpu(c->qid);
@@ -85,12 +84,6 @@ static uint16_t nvme_del_sq(FemuCtrl *n, NvmeCmd *cmd)
         QTAILQ_REMOVE(&cq->sq_list, sq, entry);
 
         nvme_post_cqes_io(cq);
-        QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
-            if (req->sq == sq) {
-                QTAILQ_REMOVE(&cq->req_list, req, entry);
-                QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
-            }
-        }
     }
 
     nvme_free_sq(sq, n);
@@ -231,44 +224,55 @@ static void set_pos(void *a, size_t pos)
     ((NvmeRequest *)a)->pos = pos;
 }
 
-static void nvme_init_poller(FemuCtrl *n)
+/*
+ * Rings and pqueue of one poller. Called by the poller itself once it is
+ * pinned, so their memory is first touched on its NUMA node.
+ */
+void nvme_init_poller_queues(FemuCtrl *n, int i)
 {
-    int i;
-
-    n->should_isr = g_malloc0(sizeof(bool) * (n->nr_io_queues + 1));
-
-    n->nr_pollers = n->multipoller_enabled ? n->nr_io_queues : 1;
     /* Coperd: we put NvmeRequest into these rings */
-    n->to_ftl = g_malloc0(sizeof(struct rte_ring *) * (n->nr_pollers + 1));
-    for (i = 1; i <= n->nr_pollers; i++) {
-        n->to_ftl[i] = femu_ring_create(FEMU_RING_TYPE_MP_SC, FEMU_MAX_INF_REQS);
-        if (!n->to_ftl[i]) {
-            femu_err("Failed to create ring (n->to_ftl) ...\n");
-            abort();
-        }
-        assert(rte_ring_empty(n->to_ftl[i]));
+    n->to_ftl[i] = femu_ring_create(FEMU_RING_TYPE_MP_SC, FEMU_MAX_INF_REQS);
+    if (!n->to_ftl[i]) {
+        femu_err("Failed to create ring (n->to_ftl) ...\n");
+        abort();
     }
+    assert(rte_ring_empty(n->to_ftl[i]));
 
-    n->to_poller = g_malloc0(sizeof(struct rte_ring *) * (n->nr_pollers + 1));
-    for (i = 1; i <= n->nr_pollers; i++) {
-        n->to_poller[i] = femu_ring_create(FEMU_RING_TYPE_MP_SC, FEMU_MAX_INF_REQS);
-        if (!n->to_poller[i]) {
-            femu_err("Failed to create ring (n->to_poller) ...\n");
-            abort();
-        }
-        assert(rte_ring_empty(n->to_poller[i]));
+    n->to_poller[i] = femu_ring_create(FEMU_RING_TYPE_MP_SC, FEMU_MAX_INF_REQS);
+    if (!n->to_poller[i]) {
+        femu_err("Failed to create ring (n->to_poller) ...\n");
+        abort();
+    }
+    assert(rte_ring_empty(n->to_poller[i]));
+
+    n->pq[i] = pqueue_init(FEMU_MAX_INF_REQS, cmp_pri, get_pri, set_pri,
+                           get_pos, set_pos);
+    if (!n->pq[i]) {
+        femu_err("Failed to create pqueue (n->pq) ...\n");
+        abort();
     }
+}
+
+static void nvme_init_poller(FemuCtrl *n)
+{
+    int i;
 
+    if (n->pollers) {
+        n->nr_pollers = MIN(n->pollers, n->nr_io_queues);
+    } else {
+        n->nr_pollers = n->multipoller_enabled ? n->nr_io_queues : 1;
+    }
+    n->to_ftl = g_malloc0(sizeof(struct rte_ring *) * (n->nr_pollers + 1));
+    n->to_poller = g_malloc0(sizeof(struct rte_ring *) * (n->nr_pollers + 1));
     n->pq = g_malloc0(sizeof(pqueue_t *) * (n->nr_pollers + 1));
+
+    n->poller_idle = g_new0(FemuIdle, n->nr_pollers + 1);
     for (i = 1; i <= n->nr_pollers; i++) {
-        n->pq[i] = pqueue_init(FEMU_MAX_INF_REQS, cmp_pri, get_pri, set_pri,
-                               get_pos, set_pos);
-        if (!n->pq[i]) {
-            femu_err("Failed to create pqueue (n->pq) ...\n");
-            abort();
-        }
+        femu_idle_init(&n->poller_idle[i], n->idle_spin_us * 1000LL);
     }
+    femu_idle_init(&n->ftl_idle, n->idle_spin_us * 1000LL);
 
+    qemu_sem_init(&n->poller_ready, 0);
     n->poller = g_malloc0(sizeof(QemuThread) * (n->nr_pollers + 1));
     NvmePollerThreadArgument *args = malloc(sizeof(NvmePollerThreadArgument) *
                                             (n->nr_pollers + 1));
@@ -279,6 +283,11 @@ static void nvme_init_poller(FemuCtrl *n)
                 &args[i], QEMU_THREAD_JOINABLE);
         femu_debug("femu-nvme-poller [%d] created ...\n", i - 1);
     }
+
+    /* the FTL thread picks up the rings once the dataplane starts */
+    for (i = 1; i <= n->nr_pollers; i++) {
+        qemu_sem_wait(&n->poller_ready);
+    }
 }
 
 static uint16_t nvme_set_db_memory(FemuCtrl *n, const NvmeCmd *cmd)
@@ -345,9 +354,20 @@ static bool nvme_nsid_valid(FemuCtrl *n, uint32_t nsid)
     return nsid && (nsid == NVME_NSID_BROADCAST || nsid <= n->num_namespaces);
 }
 
+/* Active namespace: allocated and attached to this controller */
 static inline NvmeNamespace *nvme_ns(FemuCtrl *n, uint32_t nsid)
 {
-    if (!nsid || nsid > n->num_namespaces) {
+    if (!nsid || nsid > n->num_namespaces || !n->namespaces[nsid - 1].attached) {
+        return NULL;
+    }
+
+    return &n->namespaces[nsid - 1];
+}
+
+/* Allocated namespace, attached or not */
+static inline NvmeNamespace *nvme_ns_present(FemuCtrl *n, uint32_t nsid)
+{
+    if (!nsid || nsid > n->num_namespaces || !n->namespaces[nsid - 1].allocated) {
         return NULL;
     }
 
@@ -375,7 +395,7 @@ static inline bool nvme_csi_has_nvm_support(NvmeNamespace *ns)
     return false;
 }
 
-static uint16_t nvme_identify_ns(FemuCtrl *n, NvmeCmd *cmd)
+static uint16_t nvme_identify_ns(FemuCtrl *n, NvmeCmd *cmd, bool present)
 {
     NvmeNamespace *ns;
     NvmeIdentify *c = (NvmeIdentify *)cmd;
@@ -387,7 +407,7 @@ static uint16_t nvme_identify_ns(FemuCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_NSID | NVME_DNR;
     }
 
-    ns = nvme_ns(n, nsid);
+    ns = present ? nvme_ns_present(n, nsid) : nvme_ns(n, nsid);
     if (unlikely(!ns)) {
         return nvme_rpt_empty_id_struct(n, cmd);
     }
@@ -400,7 +420,7 @@ static uint16_t nvme_identify_ns(FemuCtrl *n, NvmeCmd *cmd)
     return NVME_INVALID_CMD_SET | NVME_DNR;
 }
 
-static uint16_t nvme_identify_ns_csi(FemuCtrl *n, NvmeCmd *cmd)
+static uint16_t nvme_identify_ns_csi(FemuCtrl *n, NvmeCmd *cmd, bool present)
 {
     NvmeNamespace *ns;
     NvmeIdentify *c = (NvmeIdentify *)cmd;
@@ -413,7 +433,7 @@ static uint16_t nvme_identify_ns_csi(FemuCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_NSID | NVME_DNR;
     }
 
-    ns = nvme_ns(n, nsid);
+    ns = present ? nvme_ns_present(n, nsid) : nvme_ns(n, nsid);
     if (unlikely(!ns)) {
         return nvme_rpt_empty_id_struct(n, cmd);
     }
@@ -461,7 +481,7 @@ static uint16_t nvme_identify_ctrl_csi(FemuCtrl *n, NvmeCmd *cmd)
     return NVME_INVALID_FIELD | NVME_DNR;
 }
 
-static uint16_t nvme_identify_nslist(FemuCtrl *n, NvmeCmd *cmd)
+static uint16_t nvme_identify_nslist(FemuCtrl *n, NvmeCmd *cmd, bool present)
 {
     NvmeNamespace *ns;
     NvmeIdentify *c = (NvmeIdentify *)cmd;
@@ -484,7 +504,7 @@ static uint16_t nvme_identify_nslist(FemuCtrl *n, NvmeCmd *cmd)
     }
 
     for (i = 1; i <= n->num_namespaces; i++) {
-        ns = nvme_ns(n, i);
+        ns = present ? nvme_ns_present(n, i) : nvme_ns(n, i);
         if (!ns) {
             continue;
         }
@@ -500,7 +520,8 @@ static uint16_t nvme_identify_nslist(FemuCtrl *n, NvmeCmd *cmd)
     return dma_read_prp(n, list, data_len, prp1, prp2);
 }
 
-static uint16_t nvme_identify_nslist_csi(FemuCtrl *n, NvmeCmd *cmd)
+static uint16_t nvme_identify_nslist_csi(FemuCtrl *n, NvmeCmd *cmd,
+                                         bool present)
 {
     NvmeNamespace *ns;
     NvmeIdentify *c = (NvmeIdentify *)cmd;
@@ -521,7 +542,7 @@ static uint16_t nvme_identify_nslist_csi(FemuCtrl *n, NvmeCmd *cmd)
     }
 
     for (i = 1; i <= n->num_namespaces; i++) {
-        ns = nvme_ns(n, i);
+        ns = present ? nvme_ns_present(n, i) : nvme_ns(n, i);
         if (!ns) {
             continue;
         }
@@ -599,21 +620,25 @@ static uint16_t nvme_identify(FemuCtrl *n, NvmeCmd *cmd)
 
     switch (cns) {
     case NVME_ID_CNS_NS:
+        return nvme_identify_ns(n, cmd, false);
     case NVME_ID_CNS_NS_PRESENT:
-        return nvme_identify_ns(n, cmd);
+        return nvme_identify_ns(n, cmd, true);
     case NVME_ID_CNS_CS_NS:
+        return nvme_identify_ns_csi(n, cmd, false);
     case NVME_ID_CNS_CS_NS_PRESENT:
-        return nvme_identify_ns_csi(n, cmd);
+        return nvme_identify_ns_csi(n, cmd, true);
     case NVME_ID_CNS_CTRL:
         return nvme_identify_ctrl(n, cmd);
     case NVME_ID_CNS_CS_CTRL:
         return nvme_identify_ctrl_csi(n, cmd);
     case NVME_ID_CNS_NS_ACTIVE_LIST:
+        return nvme_identify_nslist(n, cmd, false);
     case NVME_ID_CNS_NS_PRESENT_LIST:
-        return nvme_identify_nslist(n, cmd);
+        return nvme_identify_nslist(n, cmd, true);
     case NVME_ID_CNS_CS_NS_ACTIVE_LIST:
+        return nvme_identify_nslist_csi(n, cmd, false);
     case NVME_ID_CNS_CS_NS_PRESENT_LIST:
-        return nvme_identify_nslist_csi(n, cmd);
+        return nvme_identify_nslist_csi(n, cmd, true);
     case NVME_ID_CNS_NS_DESCR_LIST:
         return nvme_identify_ns_descr_list(n, cmd);
     case NVME_ID_CNS_IO_COMMAND_SET:
@@ -623,6 +648,67 @@ static uint16_t nvme_identify(FemuCtrl *n, NvmeCmd *cmd)
     }
 }
 
+/*
+ * FEMU QoS, a vendor specific feature. cdw11[15:0] selects an I/O SQ, or with
+ * 0xffff all of them and the SQs created later. On Set, cdw12 is the IOPS
+ * limit, cdw13 the MiB/s limit (0: unlimited) and cdw14, if not 0, the SQ's
+ * weight under qos_wfq. Get returns the IOPS limit, or the MiB/s limit if
+ * cdw11 bit 16 is set.
+ */
+static uint16_t nvme_set_qos(FemuCtrl *n, NvmeCmd *cmd)
+{
+    uint32_t sqid = le32_to_cpu(cmd->cdw11) & 0xffff;
+    uint32_t iops = le32_to_cpu(cmd->cdw12);
+    uint32_t mbps = le32_to_cpu(cmd->cdw13);
+    uint32_t weight = le32_to_cpu(cmd->cdw14);
+    uint32_t i, first = sqid, last = sqid;
+
+    if (sqid == 0xffff) {
+        n->qos_iops = iops;
+        n->qos_mbps = mbps;
+        first = 1;
+        last = n->nr_io_queues;
+    } else if (!sqid || nvme_check_sqid(n, sqid)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    for (i = first; i <= last; i++) {
+        NvmeSQueue *sq = n->sq[i];
+
+        if (!sq) {
+            continue;
+        }
+        qatomic_set(&sq->qos.iops, iops);
+        qatomic_set(&sq->qos.mbps, mbps);
+        if (weight) {
+            sq->arb_burst = MIN(weight, UINT8_MAX);
+        }
+    }
+    femu_log("%s,QoS sq %u: %u IOPS, %u MiB/s, weight %u\n", n->devname,
+             sqid, iops, mbps, weight);
+
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_get_qos(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
+{
+    uint32_t dw11 = le32_to_cpu(cmd->cdw11);
+    uint32_t sqid = dw11 & 0xffff;
+    bool bw = dw11 & (1 << 16);
+
+    if (sqid == 0xffff) {
+        cqe->n.result = cpu_to_le32(bw ? n->qos_mbps : n->qos_iops);
+        return NVME_SUCCESS;
+    }
+    if (!sqid || nvme_check_sqid(n, sqid)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    cqe->n.result = cpu_to_le32(bw ? n->sq[sqid]->qos.mbps :
+                                n->sq[sqid]->qos.iops);
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_get_feature(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
 {
     NvmeRangeType *rt;
@@ -684,6 +770,8 @@ static uint16_t nvme_get_feature(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
     case NVME_FDP_EVENTS:
         cqe->n.result = cpu_to_le32(n->features.fdp_events);
         break;
+    case NVME_FEMU_QOS:
+        return nvme_get_qos(n, cmd, cqe);
     default:
         return NVME_INVALID_FIELD | NVME_DNR;
     }
@@ -760,6 +848,8 @@ static uint16_t nvme_set_feature(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
     case NVME_FDP_EVENTS:
         n->features.fdp_events = dw11;
         break;
+    case NVME_FEMU_QOS:
+        return nvme_set_qos(n, cmd);
     default:
         return NVME_INVALID_FIELD | NVME_DNR;
     }
@@ -799,13 +889,32 @@ static uint16_t nvme_smart_info(FemuCtrl *n, NvmeCmd *cmd, uint32_t buf_len)
     uint32_t trans_len;
     time_t current_seconds;
     NvmeSmartLog smart;
+    NvmeSmartCnt cnt = { 0 };
+    int i;
 
     trans_len = MIN(sizeof(smart), buf_len);
     memset(&smart, 0x0, sizeof(smart));
-    smart.data_units_read[0] = cpu_to_le64(0);
-    smart.data_units_written[0] = cpu_to_le64(0);
-    smart.host_read_commands[0] = cpu_to_le64(0);
-    smart.host_write_commands[0] = cpu_to_le64(0);
+
+    for (i = 0; i <= n->nr_io_queues; i++) {
+        NvmeSmartCnt *c = &n->smart_cnt[i];
+
+        cnt.data_units_read += qatomic_read(&c->data_units_read);
+        cnt.data_units_written += qatomic_read(&c->data_units_written);
+        cnt.host_read_commands += qatomic_read(&c->host_read_commands);
+        cnt.host_write_commands += qatomic_read(&c->host_write_commands);
+    }
+    /* data units are thousands of 512-byte units, rounded up */
+    smart.data_units_read[0] =
+        cpu_to_le64(DIV_ROUND_UP(cnt.data_units_read, 1000));
+    smart.data_units_written[0] =
+        cpu_to_le64(DIV_ROUND_UP(cnt.data_units_written, 1000));
+    smart.host_read_commands[0] = cpu_to_le64(cnt.host_read_commands);
+    smart.host_write_commands[0] = cpu_to_le64(cnt.host_write_commands);
+
+    smart.available_spare = 100;
+    if (n->ext_ops.smart_info) {
+        n->ext_ops.smart_info(n, &smart);
+    }
 
     smart.number_of_error_log_entries[0] = cpu_to_le64(n->num_errors);
     smart.temperature[0] = n->temperature & 0xff;
@@ -936,7 +1045,6 @@ static uint16_t nvme_abort_req(FemuCtrl *n, NvmeCmd *cmd, uint32_t *result)
     uint16_t sqid = cmd->cdw10 & 0xffff;
     uint16_t cid = (cmd->cdw10 >> 16) & 0xffff;
     NvmeSQueue *sq;
-    NvmeRequest *req;
 
     *result = 1;
     if (nvme_check_sqid(n, sqid)) {
@@ -958,15 +1066,11 @@ static uint16_t nvme_abort_req(FemuCtrl *n, NvmeCmd *cmd, uint32_t *result)
         }
         nvme_addr_read(n, addr, (void *)&abort_cmd, sizeof(abort_cmd));
         if (abort_cmd.cid == cid) {
+            /*
+             * The request pool belongs to the poller: just mark the SQE, the
+             * poller completes it with NVME_CMD_ABORT_REQ when it fetches it.
+             */
             *result = 0;
-            req = QTAILQ_FIRST(&sq->req_list);
-            QTAILQ_REMOVE(&sq->req_list, req, entry);
-            QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
-
-            memset(&req->cqe, 0, sizeof(req->cqe));
-            req->cqe.cid = cid;
-            req->status = NVME_CMD_ABORT_REQ;
-
             abort_cmd.opcode = NVME_OP_ABORTED;
             nvme_addr_write(n, addr, (void *)&abort_cmd,
                 sizeof(abort_cmd));
@@ -1053,6 +1157,164 @@ static uint16_t nvme_format(FemuCtrl *n, NvmeCmd *cmd)
     return nvme_format_namespace(ns, lba_idx, meta_loc, pil, pi, sec_erase);
 }
 
+/* Unallocated NVM capacity in Identify Controller */
+void nvme_update_unvmcap(FemuCtrl *n)
+{
+    uint64_t free = 0;
+    int i;
+
+    for (i = 0; i < n->num_namespaces; i++) {
+        if (!n->namespaces[i].allocated) {
+            free += n->ns_size;
+        }
+    }
+    stq_le_p(n->id_ctrl.unvmcap, free);
+}
+
+static void nvme_ns_delete(FemuCtrl *n, NvmeNamespace *ns)
+{
+    ns->attached = false;
+    ns->allocated = false;
+    /* the next namespace created in this slot reads zeroes */
+    backend_discard(n->mbe, ns->start_block << BDRV_SECTOR_BITS, n->ns_size);
+    if (n->ext_ops.ns_delete) {
+        n->ext_ops.ns_delete(n, ns);
+    }
+}
+
+/*
+ * Namespace Management. Namespaces live in num_namespaces fixed slots of
+ * ns_size bytes: create takes the first free slot and may use up to all of
+ * it, delete hands the slot back to the backend (ext_ops.ns_delete) to drop
+ * its data. New namespaces start detached.
+ */
+static uint16_t nvme_ns_mgmt(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
+{
+    uint32_t sel = le32_to_cpu(cmd->cdw10) & 0xf;
+    uint32_t nsid = le32_to_cpu(cmd->nsid);
+    uint64_t prp1 = le64_to_cpu(cmd->dptr.prp1);
+    uint64_t prp2 = le64_to_cpu(cmd->dptr.prp2);
+    NvmeNamespace *ns = NULL;
+    NvmeIdNs id;
+    uint64_t nsze;
+    uint8_t lba_idx;
+    uint16_t ret;
+    int i;
+
+    switch (sel) {
+    case NVME_NS_MGMT_CREATE:
+        if (dma_write_prp(n, (uint8_t *)&id, sizeof(id), prp1, prp2)) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        for (i = 0; i < n->num_namespaces; i++) {
+            if (!n->namespaces[i].allocated &&
+                !qatomic_read(&n->namespaces[i].busy)) {
+                ns = &n->namespaces[i];
+                break;
+            }
+        }
+        if (!ns) {
+            return NVME_NS_ID_UNAVAILABLE | NVME_DNR;
+        }
+
+        /* validate before nvme_format_namespace() rewrites the slot */
+        lba_idx = NVME_ID_NS_FLBAS_INDEX(id.flbas);
+        if (lba_idx > ns->id_ns.nlbaf) {
+            return NVME_INVALID_FORMAT | NVME_DNR;
+        }
+        nsze = le64_to_cpu(id.nsze);
+        if (!nsze || le64_to_cpu(id.ncap) > nsze) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        if (nsze > ns_blks(ns, lba_idx)) {
+            return NVME_NS_INSUFFICIENT_CAP | NVME_DNR;
+        }
+        ret = nvme_format_namespace(ns, lba_idx, id.flbas & 0x10,
+                                    id.dps & 0x8, id.dps & 0x7, 0);
+        if (ret) {
+            return ret;
+        }
+
+        ns->ns_blks = nsze;
+        ns->id_ns.nuse = ns->id_ns.ncap = ns->id_ns.nsze = cpu_to_le64(nsze);
+        g_free(ns->util);
+        g_free(ns->uncorrectable);
+        ns->util = bitmap_new(nsze);
+        ns->uncorrectable = bitmap_new(nsze);
+
+        ns->allocated = true;
+        nvme_update_unvmcap(n);
+        cqe->n.result = cpu_to_le32(ns->id);
+        return NVME_SUCCESS;
+    case NVME_NS_MGMT_DELETE:
+        if (nsid == NVME_NSID_BROADCAST) {
+            for (i = 0; i < n->num_namespaces; i++) {
+                if (n->namespaces[i].allocated) {
+                    nvme_ns_delete(n, &n->namespaces[i]);
+                }
+            }
+        } else {
+            ns = nvme_ns_present(n, nsid);
+            if (!ns) {
+                return NVME_INVALID_NSID | NVME_DNR;
+            }
+            nvme_ns_delete(n, ns);
+        }
+        nvme_update_unvmcap(n);
+        return NVME_SUCCESS;
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
+static uint16_t nvme_ns_attach(FemuCtrl *n, NvmeCmd *cmd)
+{
+    uint32_t sel = le32_to_cpu(cmd->cdw10) & 0xf;
+    uint32_t nsid = le32_to_cpu(cmd->nsid);
+    uint64_t prp1 = le64_to_cpu(cmd->dptr.prp1);
+    uint64_t prp2 = le64_to_cpu(cmd->dptr.prp2);
+    uint16_t list[NVME_IDENTIFY_DATA_SIZE / sizeof(uint16_t)];
+    NvmeNamespace *ns;
+    bool found = false;
+    int i;
+
+    ns = nvme_ns_present(n, nsid);
+    if (!ns) {
+        return NVME_INVALID_NSID | NVME_DNR;
+    }
+
+    if (dma_write_prp(n, (uint8_t *)list, sizeof(list), prp1, prp2)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    /* the only controller there is */
+    for (i = 1; i <= le16_to_cpu(list[0]) && i < ARRAY_SIZE(list); i++) {
+        if (le16_to_cpu(list[i]) == le16_to_cpu(n->id_ctrl.cntlid)) {
+            found = true;
+        }
+    }
+    if (!found) {
+        return NVME_NS_CTRL_LIST_INVALID | NVME_DNR;
+    }
+
+    switch (sel) {
+    case NVME_NS_ATTACH:
+        if (ns->attached) {
+            return NVME_NS_ALREADY_ATTACHED | NVME_DNR;
+        }
+        ns->attached = true;
+        return NVME_SUCCESS;
+    case NVME_NS_DETACH:
+        if (!ns->attached) {
+            return NVME_NS_NOT_ATTACHED | NVME_DNR;
+        }
+        ns->attached = false;
+        return NVME_SUCCESS;
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
 static uint16_t nvme_admin_cmd(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
 {
     switch (cmd->opcode) {
@@ -1104,6 +1366,18 @@ static uint16_t nvme_admin_cmd(FemuCtrl *n, NvmeCmd *cmd, NvmeCqe *cqe)
     case NVME_ADM_CMD_SET_DB_MEMORY:
         femu_debug("admin cmd,set_db_memory\n");
         return nvme_set_db_memory(n, cmd);
+    case NVME_ADM_CMD_NS_MGMT:
+        femu_debug("admin cmd,ns_mgmt\n");
+        if (le16_to_cpu(n->id_ctrl.oacs) & NVME_OACS_NS_MGMT) {
+            return nvme_ns_mgmt(n, cmd, cqe);
+        }
+        return NVME_INVALID_OPCODE | NVME_DNR;
+    case NVME_ADM_CMD_NS_ATTACH:
+        femu_debug("admin cmd,ns_attach\n");
+        if (le16_to_cpu(n->id_ctrl.oacs) & NVME_OACS_NS_MGMT) {
+            return nvme_ns_attach(n, cmd);
+        }
+        return NVME_INVALID_OPCODE | NVME_DNR;
     case NVME_ADM_CMD_ACTIVATE_FW:
     case NVME_ADM_CMD_DOWNLOAD_FW:
     case NVME_ADM_CMD_SECURITY_SEND:
@@ -36,31 +36,126 @@ static inline void nvme_copy_cmd(NvmeCmd *dst, NvmeCmd *src)
 #endif
 }
 
-static void nvme_process_sq_io(void *opaque, int index_poller)
+/* Bytes moved by an accepted read, write or compare, 0 for other commands */
+static inline uint64_t nvme_req_data_len(NvmeRequest *req)
+{
+    NvmeRwCmd *rw = (NvmeRwCmd *)&req->cmd;
+    NvmeIdNs *id_ns = &req->ns->id_ns;
+    uint8_t lbads = id_ns->lbaf[NVME_ID_NS_FLBAS_INDEX(id_ns->flbas)].lbads;
+
+    switch (req->cmd_opcode) {
+    case NVME_CMD_READ:
+    case NVME_CMD_WRITE:
+    case NVME_CMD_COMPARE:
+        return (uint64_t)(le16_to_cpu(rw->nlb) + 1) << lbads;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * SMART accounting of a command accepted by poller @c: plain adds, only this
+ * poller ever writes @c, qatomic_set() just keeps the readers from tearing
+ */
+static inline void nvme_smart_account(NvmeSmartCnt *c, NvmeRequest *req)
+{
+    uint64_t units = nvme_req_data_len(req) >> BDRV_SECTOR_BITS;
+
+    switch (req->cmd_opcode) {
+    case NVME_CMD_READ:
+    case NVME_CMD_COMPARE:
+        qatomic_set(&c->host_read_commands, c->host_read_commands + 1);
+        qatomic_set(&c->data_units_read, c->data_units_read + units);
+        break;
+    case NVME_CMD_WRITE:
+        qatomic_set(&c->host_write_commands, c->host_write_commands + 1);
+        qatomic_set(&c->data_units_written, c->data_units_written + units);
+        break;
+    }
+}
+
+static inline bool nvme_qos_on(NvmeQos *q)
+{
+    return qatomic_read(&q->iops) || qatomic_read(&q->mbps);
+}
+
+/* Whether the QoS limits let the SQ fetch another command at @now */
+static inline bool nvme_qos_admit(NvmeQos *q, int64_t now)
+{
+    return (!qatomic_read(&q->iops) || q->tat_io - FEMU_QOS_BURST_NS <= now) &&
+           (!qatomic_read(&q->mbps) || q->tat_bw - FEMU_QOS_BURST_NS <= now);
+}
+
+/* Take the tokens of a command accepted at @now */
+static inline void nvme_qos_charge(NvmeQos *q, NvmeRequest *req, int64_t now)
+{
+    uint32_t iops = qatomic_read(&q->iops);
+    uint32_t mbps = qatomic_read(&q->mbps);
+
+    if (iops) {
+        q->tat_io = MAX(q->tat_io, now) + NANOSECONDS_PER_SECOND / iops;
+    }
+    if (mbps) {
+        q->tat_bw = MAX(q->tat_bw, now) + nvme_req_data_len(req) *
+                    NANOSECONDS_PER_SECOND / ((uint64_t)mbps << 20);
+    }
+}
+
+/*
+ * Complete a command that failed before reaching the FTL with @status: it
+ * is due at once, so nvme_process_cq_cpl() posts its CQE and recycles it
+ */
+static void nvme_req_fail(FemuCtrl *n, NvmeRequest *req, int index_poller,
+                          uint16_t status)
+{
+    req->status = status;
+    if (req->dsm_ranges) {
+        g_free(req->dsm_ranges);
+        req->dsm_ranges = NULL;
+        req->dsm_nr_ranges = 0;
+    }
+    pqueue_insert(n->pq[index_poller], req);
+}
+
+static int nvme_process_sq_io(void *opaque, int index_poller)
 {
     NvmeSQueue *sq = opaque;
     FemuCtrl *n = sq->ctrl;
 
     uint16_t status;
     hwaddr addr;
-    NvmeCmd cmd;
+    NvmeCmd *cmd;
     NvmeRequest *req;
     int processed = 0;
+    /* weighted round robin: at most arb_burst commands per poller pass */
+    int budget = n->qos_wfq ? sq->arb_burst : INT_MAX;
+    bool qos = nvme_qos_on(&sq->qos);
+    int64_t now = qos ? qemu_clock_get_ns(QEMU_CLOCK_REALTIME) : 0;
 
     nvme_update_sq_tail(sq);
-    while (!(nvme_sq_empty(sq))) {
+    while (!(nvme_sq_empty(sq)) && processed < budget) {
+        /* out of tokens: leave the rest in the SQ, it backs up in the guest */
+        if (qos && !nvme_qos_admit(&sq->qos, now)) {
+            break;
+        }
+
+        /* the command is fetched straight into its request */
+        req = nvme_req_get(sq);
+        if (!req) {
+            /* pool drained: the command stays in the SQ until one returns */
+            break;
+        }
+        cmd = &req->cmd;
         if (sq->phys_contig) {
             addr = sq->dma_addr + sq->head * n->sqe_size;
-            nvme_copy_cmd(&cmd, (void *)&(((NvmeCmd *)sq->dma_addr_hva)[sq->head]));
+            nvme_copy_cmd(cmd, (void *)&(((NvmeCmd *)sq->dma_addr_hva)[sq->head]));
         } else {
             addr = nvme_discontig(sq->prp_list, sq->head, n->page_size,
                                   n->sqe_size);
-            nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
+            nvme_addr_read(n, addr, (void *)cmd, sizeof(*cmd));
         }
         nvme_inc_sq_head(sq);
 
-        req = QTAILQ_FIRST(&sq->req_list);
-        QTAILQ_REMOVE(&sq->req_list, req, entry);
         memset(&req->cqe, 0, sizeof(req->cqe));
         req->dsm_ranges = NULL;
         req->dsm_nr_ranges = 0;
@@ -68,38 +163,30 @@ static void nvme_process_sq_io(void *opaque, int index_poller)
         req->fdp_ph = 0;  /* Initialize FDP placement handle */
         /* Coperd: record req->stime at earliest convenience */
         req->expire_time = req->stime = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-        req->cqe.cid = cmd.cid;
-        req->cmd_opcode = cmd.opcode;
-        memcpy(&req->cmd, &cmd, sizeof(NvmeCmd));
+        req->cqe.cid = cmd->cid;
+        req->cmd_opcode = cmd->opcode;
 
         if (n->print_log) {
-            femu_debug("%s,cid:%d\n", __func__, cmd.cid);
+            femu_debug("%s,cid:%d\n", __func__, cmd->cid);
         }
 
-        status = nvme_io_cmd(n, &cmd, req);
+        status = nvme_io_cmd(n, cmd, req);
         if (status == NVME_SUCCESS) {
             req->status = status;
+            nvme_smart_account(&n->smart_cnt[index_poller], req);
+            if (qos) {
+                now = req->stime;
+                nvme_qos_charge(&sq->qos, req, now);
+            }
             int rc = femu_ring_enqueue(n->to_ftl[index_poller], (void *)&req, 1);
             if (rc != 1) {
                 femu_err("enqueue failed, ret=%d\n", rc);
-                // Clean up DSM ranges on enqueue failure
-                if (req->dsm_ranges) {
-                    g_free(req->dsm_ranges);
-                    req->dsm_ranges = NULL;
-                    req->dsm_nr_ranges = 0;
-                }
+                nvme_req_fail(n, req, index_poller, NVME_INTERNAL_DEV_ERROR);
             }
         } else {
-            femu_err("Error IO processed! opcode=0x%x, status=0x%x\n", 
-                     cmd.opcode, status);
-            req->status = status;
-            
-            // Clean up DSM ranges on error
-            if (req->dsm_ranges) {
-                g_free(req->dsm_ranges);
-                req->dsm_ranges = NULL;
-                req->dsm_nr_ranges = 0;
-            }
+            femu_err("Error IO processed! opcode=0x%x, status=0x%x\n",
+                     cmd->opcode, status);
+            nvme_req_fail(n, req, index_poller, status);
         }
 
         processed++;
@@ -107,6 +194,11 @@ static void nvme_process_sq_io(void *opaque, int index_poller)
 
     nvme_update_sq_eventidx(sq);
     sq->completed += processed;
+    if (processed) {
+        femu_idle_kick(&n->ftl_idle);
+    }
+
+    return processed;
 }
 
 static void nvme_post_cqe(NvmeCQueue *cq, NvmeRequest *req)
@@ -135,7 +227,7 @@ static void nvme_post_cqe(NvmeCQueue *cq, NvmeRequest *req)
     nvme_inc_cq_tail(cq);
 }
 
-static void nvme_process_cq_cpl(void *arg, int index_poller)
+static int nvme_process_cq_cpl(void *arg, int index_poller)
 {
     FemuCtrl *n = (FemuCtrl *)arg;
     NvmeCQueue *cq = NULL;
@@ -172,7 +264,7 @@ static void nvme_process_cq_cpl(void *arg, int index_poller)
         if (!cq->is_active)
             continue;
         nvme_post_cqe(cq, req);
-        QTAILQ_INSERT_TAIL(&req->sq->req_list, req, entry);
+        nvme_req_put(req->sq, req);
         pqueue_pop(pq);
         processed++;
         n->nr_tt_ios++;
@@ -184,66 +276,117 @@ static void nvme_process_cq_cpl(void *arg, int index_poller)
                            n->nr_tt_late_ios, n->nr_tt_ios);
             }
         }
-        n->should_isr[req->sq->sqid] = true;
+        if (!cq->intc_pending++) {
+            cq->intc_stime = now;
+        }
     }
 
-    if (processed == 0)
-        return;
+    /* also runs when nothing completed, to fire held back interrupts */
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    for (i = index_poller; i <= n->nr_io_queues; i += n->nr_pollers) {
+        if (n->cq[i]) {
+            nvme_isr_coalesce_io(n, n->cq[i], now);
+        }
+    }
 
-    switch (n->multipoller_enabled) {
-    case 1:
-        nvme_isr_notify_io(n->cq[index_poller]);
-        break;
-    default:
-        for (i = 1; i <= n->nr_io_queues; i++) {
-            if (n->should_isr[i]) {
-                nvme_isr_notify_io(n->cq[i]);
-                n->should_isr[i] = false;
+    return processed;
+}
+
+/* Anything this poller must keep spinning for? */
+static bool nvme_poller_busy(FemuCtrl *n, int index)
+{
+    struct rte_ring *rp = (BBSSD(n) || ZNSSD(n)) ? n->to_poller[index] :
+                          n->to_ftl[index];
+    int i;
+
+    /* in flight: completion times are kept by spinning, not by timers */
+    if (femu_ring_count(rp) || pqueue_size(n->pq[index])) {
+        return true;
+    }
+
+    for (i = index; i <= n->nr_io_queues; i += n->nr_pollers) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && cq->intc_pending) {
+            return true;
+        }
+        if (sq && sq->is_active) {
+            nvme_update_sq_tail(sq);
+            if (!nvme_sq_empty(sq)) {
+                return true;
             }
         }
-        break;
     }
+
+    return false;
+}
+
+/*
+ * Block a poller that has been idle for idle_spin_us. The SQ event indexes
+ * already point at the tails we have seen, so the guest's next submission
+ * rings the MMIO doorbell, which kicks us; the FTL thread kicks us when it
+ * hands back a request.
+ */
+static void nvme_poller_idle(FemuCtrl *n, int index, int work)
+{
+    FemuIdle *w = &n->poller_idle[index];
+    int64_t now;
+
+    if (!w->spin_ns) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (work) {
+        femu_idle_busy(w, now);
+        return;
+    }
+    if (!femu_idle_expired(w, now)) {
+        return;
+    }
+
+    femu_idle_prepare(w);
+    if (nvme_poller_busy(n, index)) {
+        femu_idle_cancel(w);
+        femu_idle_busy(w, now);
+        return;
+    }
+    femu_idle_sleep(w);
 }
 
 void *nvme_poller(void *arg)
 {
     FemuCtrl *n = ((NvmePollerThreadArgument *)arg)->n;
     int index = ((NvmePollerThreadArgument *)arg)->index;
+    QemuThread self;
+    int work;
     int i;
 
-    switch (n->multipoller_enabled) {
-    case 1:
-        while (1) {
-            if ((!n->dataplane_started)) {
-                usleep(1000);
-                continue;
-            }
+    qemu_thread_get_self(&self);
+    if (femu_thread_pin(&self, &n->poller_cpuset, index - 1)) {
+        femu_err("%s,failed to pin poller %d\n", n->devname, index);
+    }
+    nvme_init_poller_queues(n, index);
+    qemu_sem_post(&n->poller_ready);
 
-            NvmeSQueue *sq = n->sq[index];
-            NvmeCQueue *cq = n->cq[index];
-            if (sq && sq->is_active && cq && cq->is_active) {
-                nvme_process_sq_io(sq, index);
-            }
-            nvme_process_cq_cpl(n, index);
+    while (1) {
+        if ((!n->dataplane_started)) {
+            usleep(1000);
+            continue;
         }
-        break;
-    default:
-        while (1) {
-            if ((!n->dataplane_started)) {
-                usleep(1000);
-                continue;
-            }
 
-            for (i = 1; i <= n->nr_io_queues; i++) {
-                NvmeSQueue *sq = n->sq[i];
-                NvmeCQueue *cq = n->cq[i];
-                if (sq && sq->is_active && cq && cq->is_active) {
-                    nvme_process_sq_io(sq, index);
-                }
+        /* M:N: this poller owns queues index, index + nr_pollers, ... */
+        work = 0;
+        for (i = index; i <= n->nr_io_queues; i += n->nr_pollers) {
+            NvmeSQueue *sq = n->sq[i];
+            NvmeCQueue *cq = n->cq[i];
+            if (sq && sq->is_active && cq && cq->is_active) {
+                work += nvme_process_sq_io(sq, index);
             }
-            nvme_process_cq_cpl(n, index);
         }
-        break;
+        work += nvme_process_cq_cpl(n, index);
+        nvme_poller_idle(n, index, work);
     }
 
     return NULL;
@@ -261,7 +404,8 @@ uint16_t nvme_rw(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd, NvmeRequest *req)
     const uint16_t ms = le16_to_cpu(ns->id_ns.lbaf[lba_index].ms);
     const uint8_t data_shift = ns->id_ns.lbaf[lba_index].lbads;
     uint64_t data_size = (uint64_t)nlb << data_shift;
-    uint64_t data_offset = slba << data_shift;
+    uint64_t data_offset = (ns->start_block << BDRV_SECTOR_BITS) +
+                           (slba << data_shift);
     uint64_t meta_size = nlb * ms;
     uint64_t elba = slba + nlb;
     uint16_t err;
@@ -432,6 +576,118 @@ static uint16_t nvme_dsm(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     return NVME_SUCCESS;
 }
 
+/*
+ * Copy: the data is moved inside the backend here, without touching guest
+ * memory; the FTL then charges the NAND reads of the source ranges and the
+ * programs of the destination. Source ranges go to the FTL in
+ * req->dsm_ranges, the destination in req->slba and req->fdp_ph.
+ */
+static uint16_t nvme_copy(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+                          NvmeRequest *req)
+{
+    NvmeCopyCmd *copy = (NvmeCopyCmd *)cmd;
+    uint64_t prp1 = le64_to_cpu(copy->prp1);
+    uint64_t prp2 = le64_to_cpu(copy->prp2);
+    uint64_t sdlba = le64_to_cpu(copy->sdlba);
+    uint16_t dspec = le16_to_cpu(copy->dspec);
+    int nr = copy->nr + 1;
+    const uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    const uint8_t data_shift = ns->id_ns.lbaf[lba_index].lbads;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+    uint8_t *base = (uint8_t *)n->mbe->logical_space +
+                    (ns->start_block << BDRV_SECTOR_BITS);
+    NvmeCopySourceRange *src;
+    NvmeDsmRange *ranges;
+    uint64_t total = 0, off = 0;
+    uint8_t *bounce;
+    int i;
+
+    if (NVME_COPY_FORMAT(copy->control) != NVME_COPY_FORMAT_0) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    if (nr > ns->id_ns.msrc + 1) {
+        nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_CMD_SIZE_LIMIT,
+                            offsetof(NvmeCmd, cdw12), nr, ns->id);
+        return NVME_CMD_SIZE_LIMIT | NVME_DNR;
+    }
+
+    src = g_new(NvmeCopySourceRange, nr);
+    if (dma_write_prp(n, (uint8_t *)src, nr * sizeof(*src), prp1, prp2)) {
+        nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_INVALID_FIELD,
+                            offsetof(NvmeCmd, dptr.prp1), 0, ns->id);
+        g_free(src);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    ranges = g_new0(NvmeDsmRange, nr);
+    for (i = 0; i < nr; i++) {
+        uint64_t slba = le64_to_cpu(src[i].slba);
+        uint32_t nlb = le16_to_cpu(src[i].nlb) + 1;
+
+        if (nlb > le16_to_cpu(ns->id_ns.mssrl)) {
+            nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_CMD_SIZE_LIMIT,
+                                offsetof(NvmeCmd, dptr.prp1), slba, ns->id);
+            g_free(src);
+            g_free(ranges);
+            return NVME_CMD_SIZE_LIMIT | NVME_DNR;
+        }
+        /* written so that a guest slba near 2^64 cannot wrap around */
+        if (slba >= nsze || nlb > nsze - slba) {
+            nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
+                                offsetof(NvmeCmd, dptr.prp1), slba, ns->id);
+            g_free(src);
+            g_free(ranges);
+            return NVME_LBA_RANGE | NVME_DNR;
+        }
+        if (find_next_bit(ns->uncorrectable, slba + nlb, slba) < slba + nlb) {
+            g_free(src);
+            g_free(ranges);
+            return NVME_UNRECOVERED_READ;
+        }
+        ranges[i].slba = cpu_to_le64(slba);
+        ranges[i].nlb = cpu_to_le32(nlb);
+        total += nlb;
+    }
+    g_free(src);
+
+    if (total > le32_to_cpu(ns->id_ns.mcl)) {
+        nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_CMD_SIZE_LIMIT,
+                            offsetof(NvmeCmd, dptr.prp1), total, ns->id);
+        g_free(ranges);
+        return NVME_CMD_SIZE_LIMIT | NVME_DNR;
+    }
+    if (sdlba >= nsze || total > nsze - sdlba) {
+        nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
+                            offsetof(NvmeCmd, cdw10), sdlba, ns->id);
+        g_free(ranges);
+        return NVME_LBA_RANGE | NVME_DNR;
+    }
+
+    /* gather first, sources may overlap the destination */
+    bounce = g_malloc(total << data_shift);
+    for (i = 0; i < nr; i++) {
+        uint64_t len = (uint64_t)le32_to_cpu(ranges[i].nlb) << data_shift;
+
+        memcpy(bounce + off, base + (le64_to_cpu(ranges[i].slba) << data_shift),
+               len);
+        off += len;
+    }
+    memcpy(base + (sdlba << data_shift), bounce, off);
+    g_free(bounce);
+
+    if (NVME_COPY_DTYPE(copy->control) == NVME_DIRECTIVE_DATA_PLACEMENT) {
+        req->fdp_ph = NVME_DSPEC_PH(dspec);
+    }
+    req->slba = sdlba;
+    req->nlb = 0;
+    req->is_write = 1;
+    req->dsm_ranges = ranges;
+    req->dsm_nr_ranges = nr;
+    req->status = NVME_SUCCESS;
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_compare(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
                              NvmeRequest *req)
 {
@@ -446,7 +702,8 @@ static uint16_t nvme_compare(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
     uint8_t data_shift = ns->id_ns.lbaf[lba_index].lbads;
     uint64_t data_size = nlb << data_shift;
-    uint64_t offset  = ns->start_block + (slba << data_shift);
+    uint64_t offset  = (ns->start_block << BDRV_SECTOR_BITS) +
+                       (slba << data_shift);
 
     if ((slba + nlb) > le64_to_cpu(ns->id_ns.nsze)) {
         nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
@@ -495,19 +752,44 @@ static uint16_t nvme_flush(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     return NVME_SUCCESS;
 }
 
+/*
+ * Write Zeroes zeroes the backend here. The FTL gets the range as a single
+ * DSM range, with NVME_DSMGMT_AD set to unmap it instead of programming
+ * zeroes when the host allows deallocation (DEAC).
+ */
 static uint16_t nvme_write_zeros(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
                                  NvmeRequest *req)
 {
     NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
     uint64_t slba = le64_to_cpu(rw->slba);
     uint32_t nlb  = le16_to_cpu(rw->nlb) + 1;
+    const uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    const uint8_t data_shift = ns->id_ns.lbaf[lba_index].lbads;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+    uint64_t offset;
 
-    if ((slba + nlb) > ns->id_ns.nsze) {
+    /* validated before any backend offset is formed, and without wrapping */
+    if (slba >= nsze || nlb > nsze - slba) {
         nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
-                            offsetof(NvmeRwCmd, nlb), slba + nlb, ns->id);
+                            offsetof(NvmeRwCmd, nlb), slba, ns->id);
         return NVME_LBA_RANGE | NVME_DNR;
     }
 
+    offset = (ns->start_block << BDRV_SECTOR_BITS) + (slba << data_shift);
+    memset((uint8_t *)n->mbe->logical_space + offset, 0,
+           (uint64_t)nlb << data_shift);
+    bitmap_clear(ns->uncorrectable, slba, nlb);
+
+    req->dsm_ranges = g_new0(NvmeDsmRange, 1);
+    req->dsm_ranges[0].slba = cpu_to_le64(slba);
+    req->dsm_ranges[0].nlb = cpu_to_le32(nlb);
+    req->dsm_nr_ranges = 1;
+    if (le16_to_cpu(rw->control) & NVME_RW_DEAC) {
+        req->dsm_attributes = NVME_DSMGMT_AD;
+    }
+    req->slba = slba;
+    req->is_write = 1;
+
     return NVME_SUCCESS;
 }
 
@@ -517,10 +799,11 @@ static uint16_t nvme_write_uncor(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
     uint64_t slba = le64_to_cpu(rw->slba);
     uint32_t nlb  = le16_to_cpu(rw->nlb) + 1;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
 
-    if ((slba + nlb) > ns->id_ns.nsze) {
+    if (slba >= nsze || nlb > nsze - slba) {
         nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
-                            offsetof(NvmeRwCmd, nlb), slba + nlb, ns->id);
+                            offsetof(NvmeRwCmd, nlb), slba, ns->id);
         return NVME_LBA_RANGE | NVME_DNR;
     }
 
@@ -534,12 +817,20 @@ static uint16_t nvme_io_cmd(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     NvmeNamespace *ns;
     uint32_t nsid = le32_to_cpu(cmd->nsid);
 
+    /* SQE marked by nvme_abort_req() */
+    if (cmd->opcode == NVME_OP_ABORTED) {
+        return NVME_CMD_ABORT_REQ;
+    }
+
     if (nsid == 0 || nsid > n->num_namespaces) {
         femu_err("%s, NVME_INVALID_NSID %" PRIu32 "\n", __func__, nsid);
         return NVME_INVALID_NSID | NVME_DNR;
     }
 
     req->ns = ns = &n->namespaces[nsid - 1];
+    if (!ns->attached) {
+        return NVME_INVALID_NSID | NVME_DNR;
+    }
 
     switch (cmd->opcode) {
     case NVME_CMD_FLUSH:
@@ -567,6 +858,11 @@ static uint16_t nvme_io_cmd(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
             return nvme_write_uncor(n, ns, cmd, req);
         }
         return NVME_INVALID_OPCODE | NVME_DNR;
+    case NVME_CMD_COPY:
+        if (NVME_ONCS_COPY & n->oncs) {
+            return nvme_copy(n, ns, cmd, req);
+        }
+        return NVME_INVALID_OPCODE | NVME_DNR;
     default:
         if (n->ext_ops.io_cmd) {
             return n->ext_ops.io_cmd(n, ns, cmd, req);
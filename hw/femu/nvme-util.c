@@ -113,8 +113,8 @@ uint16_t femu_nvme_rw_check_req(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
                                 uint32_t nlb, uint16_t ctrl, uint64_t data_size,
                                 uint64_t meta_size)
 {
-
-    if (elba > le64_to_cpu(ns->id_ns.nsze)) {
+    /* elba = slba + nlb wraps for a guest slba near 2^64 */
+    if (elba < slba || elba > le64_to_cpu(ns->id_ns.nsze)) {
         nvme_set_error_page(n, req->sq->sqid, cmd->cid, NVME_LBA_RANGE,
                             offsetof(NvmeRwCmd, nlb), elba, ns->id);
         return NVME_LBA_RANGE | NVME_DNR;
@@ -147,10 +147,36 @@ uint16_t femu_nvme_rw_check_req(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     return 0;
 }
 
+/*
+ * Hand every request of @sq a fixed slice of one buffer for its vector PPA/LBA
+ * list, page buckets and OOB bounce buffer
+ */
+static void nvme_init_sq_vec(NvmeSQueue *sq, FemuCtrl *n)
+{
+    size_t nsecs = n->vec_max_secs;
+    size_t lbal_sz = nsecs * sizeof(uint64_t);
+    size_t bucket_sz = nsecs * sizeof(NvmeAddrBucket);
+    size_t meta_sz = ROUND_UP(nsecs * n->vec_meta_size, sizeof(uint64_t));
+    size_t per_req = lbal_sz + bucket_sz + meta_sz;
+    uint8_t *p;
+
+    p = sq->vec_buf = g_malloc0(per_req * sq->size);
+    for (int i = 0; i < sq->size; i++) {
+        NvmeVecCtx *vec = &sq->io_req[i].vec;
+
+        vec->lbal = (uint64_t *)p;
+        vec->bucket = (NvmeAddrBucket *)(p + lbal_sz);
+        vec->meta = n->vec_meta_size ? p + lbal_sz + bucket_sz : NULL;
+        p += per_req;
+    }
+}
+
 void nvme_free_sq(NvmeSQueue *sq, FemuCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    g_free(sq->io_req);
+    qemu_vfree(sq->io_req);
+    g_free(sq->req_free);
+    g_free(sq->vec_buf);
     if (sq->prp_list) {
         g_free(sq->prp_list);
     }
@@ -185,12 +211,17 @@ uint16_t nvme_init_sq(NvmeSQueue *sq, FemuCtrl *n, uint64_t dma_addr, uint16_t
         }
     }
 
-    sq->io_req = g_malloc0(sq->size * sizeof(*sq->io_req));
-    QTAILQ_INIT(&sq->req_list);
-    QTAILQ_INIT(&sq->out_req_list);
-    for (int i = 0; i < sq->size; i++) {
+    sq->io_req = qemu_memalign(__alignof__(NvmeRequest),
+                               sq->size * sizeof(*sq->io_req));
+    memset(sq->io_req, 0, sq->size * sizeof(*sq->io_req));
+    sq->req_free = g_new(NvmeRequest *, sq->size);
+    sq->nr_req_free = 0;
+    for (int i = sq->size - 1; i >= 0; i--) {
         sq->io_req[i].sq = sq;
-        QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
+        nvme_req_put(sq, &sq->io_req[i]);
+    }
+    if (n->vec_max_secs) {
+        nvme_init_sq_vec(sq, n);
     }
 
     switch (prio) {
@@ -209,6 +240,12 @@ uint16_t nvme_init_sq(NvmeSQueue *sq, FemuCtrl *n, uint64_t dma_addr, uint16_t
         break;
     }
 
+    sq->qos = (NvmeQos) { 0 };
+    if (sqid) {
+        sq->qos.iops = n->qos_iops;
+        sq->qos.mbps = n->qos_mbps;
+    }
+
     if (sqid && n->dbs_addr && n->eis_addr) {
         sq->db_addr = n->dbs_addr + 2 * sqid * dbbuf_entry_sz;
         sq->db_addr_hva = n->dbs_addr_hva + 2 * sqid * dbbuf_entry_sz;
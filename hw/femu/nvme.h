@@ -16,6 +16,8 @@
 #include "backend/dram.h"
 #include "inc/rte_ring.h"
 #include "inc/pqueue.h"
+#include "inc/idle.h"
+#include "inc/affinity.h"
 #include "nand/nand.h"
 #include "timing-model/timing.h"
 
@@ -321,8 +323,10 @@ enum NvmeAdminCommands {
     NVME_ADM_CMD_SET_FEATURES   = 0x09,
     NVME_ADM_CMD_GET_FEATURES   = 0x0a,
     NVME_ADM_CMD_ASYNC_EV_REQ   = 0x0c,
+    NVME_ADM_CMD_NS_MGMT        = 0x0d,
     NVME_ADM_CMD_ACTIVATE_FW    = 0x10,
     NVME_ADM_CMD_DOWNLOAD_FW    = 0x11,
+    NVME_ADM_CMD_NS_ATTACH      = 0x15,
     NVME_ADM_CMD_FORMAT_NVM     = 0x80,
     NVME_ADM_CMD_SECURITY_SEND  = 0x81,
     NVME_ADM_CMD_SECURITY_RECV  = 0x82,
@@ -340,6 +344,7 @@ enum NvmeIoCommands {
     NVME_CMD_WRITE_ZEROES       = 0x08,
     NVME_CMD_DSM                = 0x09,
     NVME_CMD_IO_MGMT_RECV       = 0x12,
+    NVME_CMD_COPY               = 0x19,
     NVME_CMD_IO_MGMT_SEND       = 0x1d,
     NVME_CMD_ZONE_MGMT_SEND     = 0x79,
     NVME_CMD_ZONE_MGMT_RECV     = 0x7a,
@@ -437,6 +442,7 @@ typedef struct NvmeRwCmd {
 enum {
     NVME_RW_LR                  = 1 << 15,
     NVME_RW_FUA                 = 1 << 14,
+    NVME_RW_DEAC                = 1 << 9,
     NVME_RW_DSM_FREQ_UNSPEC     = 0,
     NVME_RW_DSM_FREQ_TYPICAL    = 1,
     NVME_RW_DSM_FREQ_RARE       = 2,
@@ -533,6 +539,43 @@ typedef struct NvmeDsmRange {
     uint64_t    slba;
 } NvmeDsmRange;
 
+typedef struct NvmeCopyCmd {
+    uint8_t     opcode;
+    uint8_t     flags;
+    uint16_t    cid;
+    uint32_t    nsid;
+    uint64_t    rsvd2;
+    uint64_t    mptr;
+    uint64_t    prp1;
+    uint64_t    prp2;
+    uint64_t    sdlba;
+    uint8_t     nr;
+    uint8_t     control[3];
+    uint16_t    rsvd13;
+    uint16_t    dspec;
+    uint32_t    reftag;
+    uint16_t    apptag;
+    uint16_t    appmask;
+} NvmeCopyCmd;
+
+#define NVME_COPY_FORMAT(control)   ((control)[0] & 0xf)
+#define NVME_COPY_DTYPE(control)    (((control)[1] >> 4) & 0xf)
+
+enum NvmeCopyFormat {
+    NVME_COPY_FORMAT_0 = 0x0,
+};
+
+/* Source Range Entry, Copy Descriptor Format 0 */
+typedef struct NvmeCopySourceRange {
+    uint8_t     rsvd0[8];
+    uint64_t    slba;
+    uint16_t    nlb;
+    uint8_t     rsvd18[6];
+    uint32_t    reftag;
+    uint16_t    apptag;
+    uint16_t    appmask;
+} NvmeCopySourceRange;
+
 /* FDP (Flexible Data Placement) Directive Types */
 enum NvmeDirectiveTypes {
     NVME_DIRECTIVE_IDENTIFY         = 0x00,
@@ -631,9 +674,15 @@ enum NvmeStatusCodes {
     NVME_FID_NOT_SAVEABLE       = 0x010d,
     NVME_FID_NOT_NSID_SPEC      = 0x010f,
     NVME_FW_REQ_SUSYSTEM_RESET  = 0x0110,
+    NVME_NS_INSUFFICIENT_CAP    = 0x0115,
+    NVME_NS_ID_UNAVAILABLE      = 0x0116,
+    NVME_NS_ALREADY_ATTACHED    = 0x0118,
+    NVME_NS_NOT_ATTACHED        = 0x011a,
+    NVME_NS_CTRL_LIST_INVALID   = 0x011c,
     NVME_CONFLICTING_ATTRS      = 0x0180,
     NVME_INVALID_PROT_INFO      = 0x0181,
     NVME_WRITE_TO_RO            = 0x0182,
+    NVME_CMD_SIZE_LIMIT         = 0x0183,
     NVME_ZONE_BOUNDARY_ERROR    = 0x01b8,
     NVME_ZONE_FULL              = 0x01b9,
     NVME_ZONE_READ_ONLY         = 0x01ba,
@@ -883,7 +932,7 @@ typedef struct QEMU_PACKED NvmeIdCtrl {
     uint8_t     nvscc;
     uint8_t     rsvd531;
     uint16_t    acwu;
-    uint8_t     rsvd534[2];
+    uint16_t    ocfs;
     uint32_t    sgls;
     uint8_t     rsvd540[228];
     uint8_t     subnqn[256];
@@ -950,9 +999,24 @@ typedef struct NvmeFeatureVal {
 
 #define NVME_INTC_THR(intc)     (intc & 0xff)
 #define NVME_INTC_TIME(intc)    ((intc >> 8) & 0xff)
+/* Aggregation time is in 100us units */
+#define NVME_INTC_TIME_NS       (100000)
+
+#define NVME_INTVC_IV(ivc)      (ivc & 0xffff)
+#define NVME_INTVC_CD(ivc)      ((ivc >> 16) & 0x1)
 
 #define NVME_ERR_REC_DULBE(err_rec) (err_rec & 0x10000)
 
+enum NvmeNsMgmtSel {
+    NVME_NS_MGMT_CREATE = 0x0,
+    NVME_NS_MGMT_DELETE = 0x1,
+};
+
+enum NvmeNsAttachSel {
+    NVME_NS_ATTACH = 0x0,
+    NVME_NS_DETACH = 0x1,
+};
+
 enum NvmeFeatureIds {
     NVME_ARBITRATION                = 0x1,
     NVME_POWER_MANAGEMENT           = 0x2,
@@ -969,6 +1033,7 @@ enum NvmeFeatureIds {
     NVME_FDP_MODE                   = 0x1d,
     NVME_FDP_EVENTS                 = 0x1e,
     NVME_SOFTWARE_PROGRESS_MARKER   = 0x80,
+    NVME_FEMU_QOS                   = 0xc0, /* vendor specific, NvmeQos */
     NVME_FID_MAX                    = 0x100
 };
 
@@ -1030,7 +1095,10 @@ typedef struct NvmeIdNs {
     uint16_t    npdg;
     uint16_t    npda;
     uint16_t    nows;
-    uint8_t     rsvd74[30];
+    uint16_t    mssrl;
+    uint32_t    mcl;
+    uint8_t     msrc;
+    uint8_t     rsvd81[23];
     uint8_t     nguid[16];
     uint64_t    eui64;
     NvmeLBAF    lbaf[16];
@@ -1091,12 +1159,16 @@ static inline void nvme_check_size(void)
     QEMU_BUILD_BUG_ON(sizeof(NvmeIdentify) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeRwCmd) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeDsmCmd) != 64);
+    QEMU_BUILD_BUG_ON(sizeof(NvmeCopyCmd) != 64);
+    QEMU_BUILD_BUG_ON(sizeof(NvmeCopySourceRange) != 32);
     QEMU_BUILD_BUG_ON(sizeof(NvmeRangeType) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeErrorLog) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeFwSlotInfoLog) != 512);
     QEMU_BUILD_BUG_ON(sizeof(NvmeSmartLog) != 512);
     QEMU_BUILD_BUG_ON(sizeof(NvmeIdCtrl) != 4096);
     QEMU_BUILD_BUG_ON(sizeof(NvmeIdNs) != 4096);
+    QEMU_BUILD_BUG_ON(offsetof(NvmeRequest, cqe) != 64);
+    QEMU_BUILD_BUG_ON(offsetof(NvmeRequest, cmd) != 128);
 
     /* Coperd: FIXME, check FEMU OC structure size */
     //oc12_check_size();
@@ -1107,48 +1179,66 @@ typedef struct NvmeAsyncEvent {
     NvmeAerResult result;
 } NvmeAsyncEvent;
 
+/* OCSSD vector I/O: sectors of one command that hit the same NAND page */
+typedef struct NvmeAddrBucket {
+    uint16_t    ch;
+    uint16_t    lun;
+    uint32_t    pg;
+    uint16_t    cnt;
+    uint8_t     page_type;
+} NvmeAddrBucket;
+
+/*
+ * Per-request scratch space for OCSSD vector commands, carved out of one
+ * allocation per SQ at queue creation so the I/O path never hits the heap
+ */
+typedef struct NvmeVecCtx {
+    uint64_t        *lbal;      /* PPA/LBA list, sized to n->vec_max_secs */
+    NvmeAddrBucket  *bucket;    /* NAND pages touched, in list order */
+    uint8_t         *meta;      /* OOB bounce buffer */
+    int             nr_buckets;
+} NvmeVecCtx;
+
+/*
+ * One cache line per role: the first holds what the poller and the FTL
+ * thread touch for every request, the second completion and recycling state,
+ * the third the submitted command. Requests are cache line aligned, so the
+ * FTL working on one request never shares a line with the poller completing
+ * another.
+ */
 typedef struct NvmeRequest {
     struct NvmeSQueue       *sq;
-    struct NvmeCQueue       *cq;
     struct NvmeNamespace    *ns;
-    uint16_t                status;
     uint64_t                slba;
-    uint16_t                is_write;
-    uint16_t                nlb;
-    uint16_t                ctrl;
-    uint64_t                meta_size;
-    uint64_t                mptr;
-    void                    *meta_buf;
-    uint64_t                oc12_slba;
-    uint64_t                *oc12_ppa_list;
-    NvmeCmd                 cmd;
-    NvmeCqe                 cqe;
-    uint8_t                 cmd_opcode;
-    QEMUSGList              qsg;
-    QEMUIOVector            iov;
-    QTAILQ_ENTRY(NvmeRequest)entry;
     int64_t                 stime;
-    int64_t                 reqlat;
-    int64_t                 gcrt;
     int64_t                 expire_time;
-
-    /* OC2.0: sector offset relative to slba where reads become invalid */
-    uint64_t predef;
-
-    /* ZNS */
-    void                    *opaque;
-
+    int64_t                 reqlat;
     /* position in the priority queue for delay emulation */
     size_t                  pos;
+    uint16_t                nlb;
+    uint16_t                status;
+    uint16_t                is_write;
+    uint8_t                 cmd_opcode;
+    /* FDP (Flexible Data Placement) fields */
+    uint8_t         fdp_ph;             // Placement Handle from DSPEC
 
+    NvmeCqe                 cqe;
+    QTAILQ_ENTRY(NvmeRequest)entry;
     // DSM (Dataset Management) related fields
     NvmeDsmRange    *dsm_ranges;        // Array of DSM ranges
     int             dsm_nr_ranges;      // Number of ranges
     uint32_t        dsm_attributes;     // CDW11 attributes (AD, IDR, IDW)
-    
-    /* FDP (Flexible Data Placement) fields */
-    uint8_t         fdp_ph;             // Placement Handle from DSPEC
-} NvmeRequest;
+    /* ZNS */
+    void                    *opaque;
+    /* OC2.0: sector offset relative to slba where reads become invalid */
+    uint64_t predef;
+
+    NvmeCmd                 cmd;
+
+    NvmeVecCtx              vec;
+    QEMUSGList              qsg;
+    QEMUIOVector            iov;
+} QEMU_ALIGNED(64) NvmeRequest;
 
 typedef struct DMAOff {
     QEMUSGList *qsg;
@@ -1157,6 +1247,21 @@ typedef struct DMAOff {
     dma_addr_t len;
 } DMAOff;
 
+/*
+ * Per-SQ QoS: one token bucket per limit, kept as a theoretical arrival time
+ * (GCRA). The SQ may fetch a command while tat - FEMU_QOS_BURST_NS <= now,
+ * and each command fetched pushes tat out by its cost. The admin thread sets
+ * the limits. Everything else belongs to the SQ's poller.
+ */
+#define FEMU_QOS_BURST_NS   (1000000)
+
+typedef struct NvmeQos {
+    uint32_t    iops;   /* commands per second, 0: unlimited */
+    uint32_t    mbps;   /* MiB per second, 0: unlimited */
+    int64_t     tat_io;
+    int64_t     tat_bw;
+} NvmeQos;
+
 typedef struct NvmeSQueue {
     struct FemuCtrl *ctrl;
     uint8_t     phys_contig;
@@ -1170,9 +1275,13 @@ typedef struct NvmeSQueue {
     uint64_t    dma_addr_hva;
     uint64_t    completed;
     uint64_t    *prp_list;
+    /*
+     * request pool, free requests are a LIFO stack only the poller touches;
+     * admin commands (Abort, Delete SQ) must not get or put requests
+     */
     NvmeRequest *io_req;
-    QTAILQ_HEAD(sq_req_list, NvmeRequest) req_list;
-    QTAILQ_HEAD(out_req_list, NvmeRequest) out_req_list;
+    NvmeRequest **req_free;
+    uint32_t    nr_req_free;
     QTAILQ_ENTRY(NvmeSQueue) entry;
 
     uint64_t    db_addr;
@@ -1180,8 +1289,22 @@ typedef struct NvmeSQueue {
     uint64_t    eventidx_addr;
     uint64_t    eventidx_addr_hva;
     bool        is_active;
+    NvmeQos     qos;
+
+    /* backing store for io_req[i].vec (OCSSD only) */
+    void        *vec_buf;
 } NvmeSQueue;
 
+static inline NvmeRequest *nvme_req_get(NvmeSQueue *sq)
+{
+    return sq->nr_req_free ? sq->req_free[--sq->nr_req_free] : NULL;
+}
+
+static inline void nvme_req_put(NvmeSQueue *sq, NvmeRequest *req)
+{
+    sq->req_free[sq->nr_req_free++] = req;
+}
+
 typedef struct NvmeCQueue {
     struct FemuCtrl *ctrl;
     uint8_t     phys_contig;
@@ -1206,6 +1329,10 @@ typedef struct NvmeCQueue {
     uint64_t    eventidx_addr;
     uint64_t    eventidx_addr_hva;
     bool        is_active;
+    /* interrupt coalescing: CQEs posted but not signalled yet, and when the
+     * oldest of them was posted */
+    uint32_t    intc_pending;
+    int64_t     intc_stime;
 } NvmeCQueue;
 
 typedef struct Oc12Bbt Oc12Bbt;
@@ -1224,6 +1351,14 @@ typedef struct NvmeNamespace {
     uint64_t        size; /* Coperd: for ZNS, FIXME */
     uint64_t        ns_blks;
     uint64_t        start_block;
+    /*
+     * Namespace Management: slot nsid-1 is in use (allocated) and visible
+     * to this controller (attached); busy while the backend still reclaims
+     * the slot after a delete.
+     */
+    bool            allocated;
+    bool            attached;
+    bool            busy;
     uint64_t        meta_start_offset;
     uint64_t        tbl_dsk_start_offset;
     uint32_t        tbl_entries;
@@ -1315,11 +1450,44 @@ typedef struct BbCtrlParams {
     int pg_wr_lat;
     int blk_er_lat;
     int ch_xfer_lat;
+    int pg_type_mode;
+    int suspend_lat;
+    int resume_lat;
+    int max_suspend;
+    int die_sched;
 
     int gc_thres_pcent;
     int gc_thres_pcent_high;
+    int op_pcent;
+    int endurance;
+    int wl_thres;
+    int slc_mode;
+    int slc_lines;
+    int rr_lat;
+    int rr_pe_cycles;
+    int rr_retention;
+    int rr_reads;
+    int pgm_fail_ppm;
+    int ers_fail_ppm;
+    /* factory bad blocks, one "ch=N lun=N blk=N" per line */
+    char *bbt_fname;
 } BbCtrlParams;
 
+/*
+ * Pages of the bbssd geometry exported to the host: the flash holds
+ * op_pcent percent more than that. With op_pcent < 0 all of it is exported.
+ */
+static inline uint64_t bb_logical_pgs(BbCtrlParams *bb)
+{
+    uint64_t pgs = (uint64_t)bb->pgs_per_blk * bb->blks_per_pl *
+                   bb->pls_per_lun * bb->luns_per_ch * bb->nchs;
+
+    if (bb->op_pcent < 0) {
+        return pgs;
+    }
+    return pgs * 100 / (100 + bb->op_pcent);
+}
+
 typedef struct ZNSCtrlParams {
     uint8_t  zns_num_ch;
     uint8_t  zns_num_lun;
@@ -1340,6 +1508,17 @@ typedef struct OcCtrlParams {
 } OcCtrlParams;
 
 struct FemuCtrl;
+/*
+ * Host I/O counters for the SMART log. Each poller has its own, written only
+ * by that poller, and nvme_smart_info() adds them up.
+ */
+typedef struct NvmeSmartCnt {
+    uint64_t    data_units_read;    /* in 512-byte units */
+    uint64_t    data_units_written;
+    uint64_t    host_read_commands;
+    uint64_t    host_write_commands;
+} QEMU_ALIGNED(64) NvmeSmartCnt;
+
 typedef struct FemuExtCtrlOps {
     void     *state;
     void     (*init)(struct FemuCtrl *, Error **);
@@ -1349,6 +1528,9 @@ typedef struct FemuExtCtrlOps {
     uint16_t (*admin_cmd)(struct FemuCtrl *, NvmeCmd *);
     uint16_t (*io_cmd)(struct FemuCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
     uint16_t (*get_log)(struct FemuCtrl *, NvmeCmd *);
+    void     (*ns_delete)(struct FemuCtrl *, NvmeNamespace *);
+    /* device health for the SMART log: percentage used, available spare */
+    void     (*smart_info)(struct FemuCtrl *, NvmeSmartLog *);
 } FemuExtCtrlOps;
 
 typedef struct FemuCtrl {
@@ -1471,12 +1653,13 @@ typedef struct FemuCtrl {
     uint8_t         lver; /* Coperd: OCSSD version, 0x1 -> OC1.2, 0x2 -> OC2.0 */
     uint32_t        memsz;
     OcCtrlParams    oc_params;
+    /* Max sectors / OOB bytes per sector of one OCSSD vector command */
+    uint16_t        vec_max_secs;
+    uint16_t        vec_meta_size;
 
     Oc12Ctrl  *oc12_ctrl;
-    volatile int64_t chip_next_avail_time[FEMU_MAX_NUM_CHIPS];
-    pthread_spinlock_t chip_locks[FEMU_MAX_NUM_CHIPS];
-    volatile int64_t chnl_next_avail_time[FEMU_MAX_NUM_CHNLS];
-    pthread_spinlock_t chnl_locks[FEMU_MAX_NUM_CHNLS];
+    /* NAND timing for the whitebox (OCSSD) modes */
+    NandTiming      nand_timing;
 
     /* Latency numbers for whitebox-mode only */
     int64_t upg_rd_lat_ns; /* upper page in MLC/TLC/QLC */
@@ -1502,20 +1685,85 @@ typedef struct FemuCtrl {
     struct rte_ring **to_ftl;
     struct rte_ring **to_poller;
     pqueue_t        **pq;
-    bool            *should_isr;
     bool            poller_on;
 
     int64_t         nr_tt_ios;
     int64_t         nr_tt_late_ios;
+    /* indexed by poller, nr_io_queues + 1 of them */
+    NvmeSmartCnt    *smart_cnt;
     bool            print_log;
 
     uint8_t         multipoller_enabled;
+    /* M:N polling: poller p serves I/O queues p, p + nr_pollers, ... */
+    uint32_t        pollers;
     uint32_t        nr_pollers;
+    QemuSemaphore   poller_ready;
+
+    /*
+     * QoS limits of new I/O SQs (0: none), and whether the pollers serve
+     * their SQs weighted round robin, arb_burst commands per pass
+     */
+    uint32_t        qos_iops;
+    uint32_t        qos_mbps;
+    uint8_t         qos_wfq;
+
+    /* host placement of the dataplane threads and the DRAM backend */
+    char            *poller_cpus;
+    char            *ftl_cpus;
+    cpu_set_t       poller_cpuset;
+    cpu_set_t       ftl_cpuset;
+    int32_t         numa_node;
+
+    /* 0: pollers and FTL thread always spin, else block after this idle */
+    uint32_t        idle_spin_us;
+    FemuIdle        *poller_idle;
+    FemuIdle        ftl_idle;
 
     /* Nand Flash Type: SLC/MLC/TLC/QLC/PLC */
     uint8_t         flash_type;
 } FemuCtrl;
 
+/* Poller serving I/O queue @qid */
+static inline int nvme_poller_of(FemuCtrl *n, uint32_t qid)
+{
+    return (qid - 1) % n->nr_pollers + 1;
+}
+
+/*
+ * FTL thread idling: sleep once no poller handed a request over for
+ * idle_spin_us, until nvme_process_sq_io() kicks ftl_idle.
+ */
+static inline void femu_ftl_idle(FemuCtrl *n, struct rte_ring **to_ftl,
+                                 int work)
+{
+    FemuIdle *w = &n->ftl_idle;
+    int64_t now;
+    int i;
+
+    if (!w->spin_ns) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (work) {
+        femu_idle_busy(w, now);
+        return;
+    }
+    if (!femu_idle_expired(w, now)) {
+        return;
+    }
+
+    femu_idle_prepare(w);
+    for (i = 1; i <= n->nr_pollers; i++) {
+        if (to_ftl[i] && femu_ring_count(to_ftl[i])) {
+            femu_idle_cancel(w);
+            femu_idle_busy(w, now);
+            return;
+        }
+    }
+    femu_idle_sleep(w);
+}
+
 typedef struct NvmePollerThreadArgument {
     FemuCtrl        *n;
     int             index;
@@ -1592,6 +1840,7 @@ void nvme_set_ctrl_name(FemuCtrl *n, const char *mn, const char *sn, int *dev_id
 /* Public APIs from intr.c for interrupt operations */
 void nvme_isr_notify_admin(void *opaque);
 void nvme_isr_notify_io(void *opaque);
+void nvme_isr_coalesce_io(FemuCtrl *n, NvmeCQueue *cq, int64_t now);
 int nvme_setup_virq(FemuCtrl *n, NvmeCQueue *cq);
 int nvme_clear_virq(FemuCtrl *n);
 
@@ -1620,6 +1869,8 @@ uint16_t femu_nvme_rw_check_req(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
 void nvme_process_sq_admin(void *opaque);
 void nvme_post_cqes_io(void *opaque);
 void *nvme_poller(void *arg);
+void nvme_init_poller_queues(FemuCtrl *n, int i);
+void nvme_update_unvmcap(FemuCtrl *n);
 
 /* NVMe I/O */
 uint16_t nvme_rw(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd, NvmeRequest *req);
@@ -304,46 +304,45 @@ static void oc12_read_ppa_list(FemuCtrl *n, Oc12RwCmd *cmd, uint64_t *ppa_list)
 }
 
 /*
- * Given the LBA list within a command, get the statistics about the access
+ * Given the PPA list within a command, get the statistics about the access
  * frequency to different NAND flash pages, this helps us later decide how much
  * latency to emulate for the entire command.
  *
- * Results are stored in @bucket and @n
+ * Must run on the raw PPAs, i.e. before they are turned into backend offsets.
+ * Results are stored in req->vec.bucket and req->vec.nr_buckets
  */
-static void parse_ppa_list(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
-                           NvmeRequest *req, AddrBucket *bucket, int *nr)
+static void oc12_parse_ppa_list(FemuCtrl *n, NvmeRequest *req, uint32_t nlb)
 {
-    Oc12RwCmd *ocrw = (Oc12RwCmd *)cmd;
     Oc12Ctrl *ln = n->oc12_ctrl;
-    uint16_t nlb  = le16_to_cpu(ocrw->nlb) + 1;
-    int max_sec_per_rq = ln->params.max_sec_per_rq;
+    Oc12AddrF *ppaf = &ln->ppaf;
+    NvmeAddrBucket *bucket = req->vec.bucket;
+    uint64_t *psl = req->vec.lbal;
+    uint64_t pg_mask = ~(ppaf->sec_mask | ppaf->pln_mask);
     uint64_t cur_pg_addr, prev_pg_addr = ~(0ULL);
-    int secs_idx = -1;
+    NvmeAddrBucket *b = bucket - 1;
     uint64_t ppa;
     int i;
 
-    memset(bucket, 0, sizeof(AddrBucket) * max_sec_per_rq);
     for (i = 0; i < nlb; i++) {
-        ppa = ((uint64_t *)(req->slba))[i];
-        //pr_ppa(ln, ppa);
-        cur_pg_addr = (ppa & (~(ln->ppaf.sec_mask)) & (~(ln->ppaf.pln_mask)));
+        ppa = psl[i];
+        cur_pg_addr = ppa & pg_mask;
         if (cur_pg_addr == prev_pg_addr) {
-            /* Accessing another secotr in the same NAND page */
-            bucket[secs_idx].cnt++;
-        } else {
-            /* Accessing a new NAND page addr */
-            secs_idx++;
-            bucket[secs_idx].cnt++;
-            bucket[secs_idx].ch = PPA_CH(ln, ppa);
-            bucket[secs_idx].lun = PPA_LUN(ln, ppa);
-            bucket[secs_idx].pg = PPA_PG(ln, ppa);
-            bucket[secs_idx].page_type = get_page_type(n->flash_type, bucket[secs_idx].pg);
-
-            prev_pg_addr = cur_pg_addr;
+            /* Accessing another sector in the same NAND page */
+            b->cnt++;
+            continue;
         }
+
+        /* Accessing a new NAND page addr */
+        b++;
+        b->cnt = 1;
+        b->ch = (ppa & ppaf->ch_mask) >> ppaf->ch_offset;
+        b->lun = (ppa & ppaf->lun_mask) >> ppaf->lun_offset;
+        b->pg = (ppa & ppaf->pg_mask) >> ppaf->pg_offset;
+        b->page_type = get_page_type(n->flash_type, b->pg);
+        prev_pg_addr = cur_pg_addr;
     }
 
-    *nr = secs_idx + 1;
+    req->vec.nr_buckets = b - bucket + 1;
 }
 
 static int oc12_advance_status(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -351,73 +350,57 @@ static int oc12_advance_status(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
 {
     Oc12RwCmd *ocrw = (Oc12RwCmd *)cmd;
     uint8_t opcode = ocrw->opcode;
-    int ch, lun, lunid;
-    int64_t io_done_ts = 0;
-    int64_t total_time_need_to_emulate = 0;
-    int64_t cur_time_need_to_emulate;
     Oc12Ctrl *ln = n->oc12_ctrl;
     Oc12IdGroup *c = &ln->id_ctrl.groups[0];
-    int max_sec_per_rq = ln->params.max_sec_per_rq;
-    uint8_t page_type;
-
-    int64_t now = req->stime;
+    NvmeAddrBucket *b;
+    NandTimingCmd ncmd = {
+        .type = USER_IO,
+        .stime = req->stime,
+    };
+    uint64_t io_done_ts;
     uint64_t ppa;
     int i;
 
+    req->expire_time = req->stime;
+
     /* Erase */
     if (opcode == OC12_CMD_ERASE) {
-        ppa = req->slba;
-        lun = PPA_LUN(ln, ppa);
-        ch = PPA_CH(ln, ppa);
-        lunid = ch * c->num_ch + lun;
-
-        req->expire_time = advance_chip_timestamp(n, lunid, now, opcode, 0);
+        ncmd.op = NAND_ERASE;
+        for (i = 0; i < req->nlb; i++) {
+            ppa = req->vec.lbal[i];
+            ncmd.ch = PPA_CH(ln, ppa);
+            ncmd.lun = PPA_LUN(ln, ppa);
+            ncmd.pl = PPA_PLN(ln, ppa);
+            ncmd.stime = req->stime;
+
+            io_done_ts = nand_timing_advance(&n->nand_timing, &ncmd);
+            if (io_done_ts > req->expire_time) {
+                req->expire_time = io_done_ts;
+            }
+        }
         return 0;
     }
 
-    int secs_idx = -1;
-    int si = 0;
-    int nb_secs_to_write = 0;
-
-    AddrBucket *addr_bucket = g_malloc0(sizeof(AddrBucket) * max_sec_per_rq);
-    parse_ppa_list(n, ns, cmd, req, addr_bucket, &secs_idx);
-
     /* Read & Write */
     assert(opcode == OC12_CMD_READ || opcode == OC12_CMD_WRITE);
-    assert(secs_idx > 0);
-    for (i = 0; i < secs_idx; i++) {
-        ppa = ((uint64_t *)(req->slba))[si];
-        nb_secs_to_write = addr_bucket[i].cnt;
-        si += nb_secs_to_write;
-
-        ch = addr_bucket[i].ch;
-        lun = addr_bucket[i].lun;
-        page_type = addr_bucket[i].page_type;
-        lunid = ch * c->num_lun + lun;
-
-        io_done_ts = 0;
-        assert(ch < c->num_ch && lun < c->num_lun);
-
-        int64_t chnl_end_ts, chip_end_ts;
-        if (req->is_write) {
-            /* Write data needs to be transferred through the channel first */
-            chnl_end_ts = advance_channel_timestamp(n, ch, now, opcode);
-            /* Then issue NAND Program to the target flash chip */
-            io_done_ts = advance_chip_timestamp(n, lunid, chnl_end_ts, opcode, page_type);
-        } else {
-            chip_end_ts = advance_chip_timestamp(n, lunid, now, opcode, page_type);
-            io_done_ts = advance_channel_timestamp(n, ch, chip_end_ts, opcode);
-        }
-
-        /* Coperd: the time need to emulate is (io_done_ts - now) */
-        cur_time_need_to_emulate = io_done_ts - now;
-        if (cur_time_need_to_emulate > total_time_need_to_emulate) {
-            total_time_need_to_emulate = cur_time_need_to_emulate;
+    assert(req->vec.nr_buckets > 0);
+    ncmd.op = req->is_write ? NAND_WRITE : NAND_READ;
+    for (i = 0; i < req->vec.nr_buckets; i++) {
+        b = &req->vec.bucket[i];
+        assert(b->ch < c->num_ch && b->lun < c->num_lun);
+
+        ncmd.ch = b->ch;
+        ncmd.lun = b->lun;
+        ncmd.pl = 0;
+        ncmd.page_type = b->page_type;
+        ncmd.stime = req->stime;
+
+        io_done_ts = nand_timing_advance(&n->nand_timing, &ncmd);
+        if (io_done_ts > req->expire_time) {
+            req->expire_time = io_done_ts;
         }
     }
 
-    req->expire_time = now + total_time_need_to_emulate;
-    g_free(addr_bucket);
     return 0;
 }
 
@@ -441,23 +424,27 @@ static uint16_t oc12_read(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     uint16_t err;
     int i;
 
-    req->is_write = false;
-    req->slba = (uint64_t)g_malloc0(sizeof(uint64_t) * nlb);
-    /* To save some ugly type casts later */
-    psl = (uint64_t *)req->slba;
+    if (nlb > n->vec_max_secs) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
 
-    msl = g_malloc0(ln->params.sos * nlb);
+    req->is_write = false;
+    req->nlb = nlb;
+    psl = req->vec.lbal;
+    msl = req->vec.meta;
 
     oc12_read_ppa_list(n, ocrw, psl);
 
-    /* Must come after req->slba is correctly read from the host side */
-    err = oc12_rw_check_req(n, ns, cmd, req, (uint64_t *)req->slba, nlb, nlb,
-                            data_size, meta_size);
+    /* Must come after the PPA list is correctly read from the host side */
+    err = oc12_rw_check_req(n, ns, cmd, req, psl, nlb, nlb, data_size,
+                            meta_size);
     if (err) {
         femu_err("oc12_rw: failed nvme_rw_check (0x%x)\n", err);
-        goto fail_free;
+        return err;
     }
 
+    oc12_parse_ppa_list(n, req, nlb);
+
     for (i = 0; i < nlb; i++) {
         uint32_t state;
         ppa = psl[i];
@@ -476,24 +463,14 @@ static uint16_t oc12_read(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     /* DMA user data */
     if (nvme_map_prp(&req->qsg, &req->iov, prp1, prp2, data_size, n)) {
         femu_err("oc12_read: malformed prp (sz:%lu)\n", data_size);
-        err = NVME_INVALID_FIELD | NVME_DNR;
-        goto fail_free;
+        return NVME_INVALID_FIELD | NVME_DNR;
     }
     backend_rw(n->mbe, &req->qsg, psl, req->is_write);
 
     /* Timing Model */
     oc12_advance_status(n, ns, cmd, req);
 
-    g_free(msl);
-    g_free((void *)req->slba);
-
     return NVME_SUCCESS;
-
-fail_free:
-    g_free(msl);
-    g_free((void *)req->slba);
-
-    return err;
 }
 
 static uint16_t oc12_write(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -516,23 +493,27 @@ static uint16_t oc12_write(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     uint16_t err;
     int i;
 
-    req->is_write = true;
-    req->slba = (uint64_t)g_malloc0(sizeof(uint64_t) * nlb);
-    psl = (uint64_t *)req->slba;
+    if (nlb > n->vec_max_secs) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
 
-    msl = g_malloc0(ln->params.sos * nlb);
+    req->is_write = true;
+    req->nlb = nlb;
+    psl = req->vec.lbal;
+    msl = req->vec.meta;
 
     oc12_read_ppa_list(n, ocrw, psl);
 
-    /* Must come after req->slba is correctly read from the host side */
-
+    /* Must come after the PPA list is correctly read from the host side */
     err = oc12_rw_check_req(n, ns, cmd, req, psl, nlb, nlb, data_size,
                             meta_size);
     if (err) {
         femu_err("oc12_write: failed nvme_rw_check (0x%x)\n", err);
-        goto fail_free;
+        return err;
     }
 
+    oc12_parse_ppa_list(n, req, nlb);
+
     /* Read host-passed metadata to a temporary buffer */
     if (meta) {
         nvme_addr_read(n, meta, (void *)msl, nlb * ln->params.sos);
@@ -555,24 +536,14 @@ static uint16_t oc12_write(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     /* DMA user data */
     if (nvme_map_prp(&req->qsg, &req->iov, prp1, prp2, data_size, n)) {
         femu_err("oc12_write: malformed prp (sz:%lu)\n", data_size);
-        err = NVME_INVALID_FIELD | NVME_DNR;
-        goto fail_free;
+        return NVME_INVALID_FIELD | NVME_DNR;
     }
     backend_rw(n->mbe, &req->qsg, psl, req->is_write);
 
     /* Timing Model */
     oc12_advance_status(n, ns, cmd, req);
 
-    g_free(msl);
-    g_free((void *)req->slba);
-
     return NVME_SUCCESS;
-
-fail_free:
-    g_free(msl);
-    g_free((void *)req->slba);
-
-    return err;
 }
 
 static uint32_t oc12_tbl_size(NvmeNamespace *ns)
@@ -747,15 +718,19 @@ static uint16_t oc12_erase_async(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     Oc12Ctrl *ln = n->oc12_ctrl;
     Oc12RwCmd *dm = (Oc12RwCmd *)cmd;
     uint32_t nlb = le16_to_cpu(dm->nlb) + 1;
-    uint64_t *psl = g_malloc0(sizeof(uint64_t) * ln->params.max_sec_per_rq);
+    uint64_t *psl = req->vec.lbal;
 
+    if (nlb > n->vec_max_secs) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    req->nlb = nlb;
     oc12_read_ppa_list(n, dm, psl);
 
     oc12_meta_blk_set_erased(ns, ln, psl, nlb);
 
     oc12_advance_status(n, ns, cmd, req);
 
-    g_free(psl);
     return NVME_SUCCESS;
 }
 
@@ -831,44 +806,23 @@ static int oc12_init_bbtbl(FemuCtrl *n, NvmeNamespace *ns)
     return ret;
 }
 
-static void oc12_release_locks(FemuCtrl *n)
-{
-    int ret;
-    int i;
-
-    for (i = 0; i < FEMU_MAX_NUM_CHNLS; i++) {
-        ret = pthread_spin_destroy(&n->chnl_locks[i]);
-        assert(ret == 0);
-    }
-
-    for (i = 0; i < FEMU_MAX_NUM_CHIPS; i++) {
-        ret = pthread_spin_destroy(&n->chip_locks[i]);
-        assert(ret == 0);
-    }
-}
-
 static int oc12_init_misc(FemuCtrl *n)
 {
-    int ret;
-    int i;
+    Oc12Params *lps = &n->oc12_ctrl->params;
+    NandTimingParams tp = {
+        .nchs        = lps->num_ch,
+        .luns_per_ch = lps->num_lun,
+        .pls_per_lun = lps->num_pln,
+        .plane_level = false,
+        .shared      = true,
+    };
 
 	set_latency(n);
+    init_nand_flash(n);
 
-    for (i = 0; i < FEMU_MAX_NUM_CHNLS; i++) {
-        n->chnl_next_avail_time[i] = 0;
-
-        /* FIXME: Can we use PTHREAD_PROCESS_PRIVATE here? */
-        ret = pthread_spin_init(&n->chnl_locks[i], PTHREAD_PROCESS_SHARED);
-        assert(ret == 0);
-    }
-
-    for (i = 0; i < FEMU_MAX_NUM_CHIPS; i++) {
-        n->chip_next_avail_time[i] = 0;
-
-        /* FIXME: Can we use PTHREAD_PROCESS_PRIVATE here? */
-        ret = pthread_spin_init(&n->chip_locks[i], PTHREAD_PROCESS_SHARED);
-        assert(ret == 0);
-    }
+    /* array and channel transfer latencies of the flash type */
+    nand_timing_flash_params(&tp, n->flash_type);
+    nand_timing_init(&n->nand_timing, &tp);
 
     return 0;
 }
@@ -891,6 +845,9 @@ static int oc12_init_params(FemuCtrl *n)
     lps->num_pln = n->oc_params.num_pln;
     lps->sos = n->oc_params.sos;
 
+    n->vec_max_secs = lps->max_sec_per_rq;
+    n->vec_meta_size = lps->sos;
+
     return 0;
 }
 
@@ -1027,8 +984,6 @@ static int oc12_init_more(FemuCtrl *n)
         oc12_tbl_initialize(ns);
     }
 
-    init_nand_flash(n);
-
     ret = oc12_init_meta(ln);
     if (ret) {
         femu_err("oc12_init_meta failed\n");
@@ -1046,7 +1001,7 @@ static int oc12_init_more(FemuCtrl *n)
 
 static void oc12_exit(FemuCtrl *n)
 {
-    oc12_release_locks(n);
+    nand_timing_exit(&n->nand_timing);
 }
 
 static uint16_t oc12_nvme_rw(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
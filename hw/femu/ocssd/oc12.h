@@ -239,14 +239,6 @@ struct oc12_tgt_meta {
     uint64_t rsvd;
 } __attribute__((__packed__));
 
-typedef struct AddrBucket {
-    int  ch;
-    int  lun;
-    int  pg;
-    uint8_t  page_type;
-    int  cnt;
-} AddrBucket;
-
 #define OC12_MAX_GRPS_PR_IDENT (20)
 #define OC12_FEAT_EXT_START 64
 #define OC12_FEAT_EXT_END 127
@@ -124,48 +124,46 @@ static uint16_t oc20_advance_wp(FemuCtrl *n, NvmeNamespace *ns, uint64_t lba,
     return NVME_SUCCESS;
 }
 
-#define max_sec_per_rq (64)
-
 /*
  * Given the LBA list within a command, get the statistics about the access
  * frequency to different NAND flash pages, this helps us later decide how much
  * latency to emulate for the entire command.
  *
- * Results are stored in @bucket and @n
+ * Results are stored in req->vec.bucket and req->vec.nr_buckets
  */
-static void oc20_parse_lba_list(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
-                                NvmeRequest *req, Oc20AddrBucket *bucket,
-                                int *nr)
+static void oc20_parse_lba_list(FemuCtrl *n, NvmeNamespace *ns,
+                                NvmeRequest *req)
 {
-    Oc20RwCmd *ocrw = (Oc20RwCmd *)cmd;
     Oc20Namespace *lns = ns->state;
     Oc20AddrF *addrf = &lns->lbaf;
-    uint16_t nlb  = le16_to_cpu(ocrw->nlb) + 1;
+    NvmeAddrBucket *bucket = req->vec.bucket;
+    uint64_t *lbal = req->vec.lbal;
+    uint64_t pg_mask = ~addrf->sec_mask;
     uint64_t cur_pg_addr, prev_pg_addr = ~(0ULL);
-    int secs_idx = -1;
+    NvmeAddrBucket *b = bucket - 1;
     uint64_t lba;
     int i;
 
-    memset(bucket, 0, sizeof(Oc20AddrBucket) * max_sec_per_rq);
-    for (i = 0; i < nlb; i++) {
-        lba = ((uint64_t *)(req->slba))[i];
-        cur_pg_addr = (lba & (~(lns->lbaf.sec_mask)));
+    for (i = 0; i < req->nlb; i++) {
+        lba = lbal[i];
+        cur_pg_addr = lba & pg_mask;
         if (cur_pg_addr == prev_pg_addr) {
-            /* Accessing another secotr in the same NAND page */
-            bucket[secs_idx].cnt++;
-        } else {
-            /* Accessing a new NAND page addr */
-            secs_idx++;
-            bucket[secs_idx].cnt++;
-            bucket[secs_idx].ch = OC20_LBA_GET_GROUP(addrf, lba);
-            bucket[secs_idx].lun = OC20_LBA_GET_PUNIT(addrf, lba);
-            bucket[secs_idx].pg = OC20_LBA_GET_SECTR(addrf, lba);
-
-            prev_pg_addr = cur_pg_addr;
+            /* Accessing another sector in the same NAND page */
+            b->cnt++;
+            continue;
         }
+
+        /* Accessing a new NAND page addr */
+        b++;
+        b->cnt = 1;
+        b->ch = OC20_LBA_GET_GROUP(addrf, lba);
+        b->lun = OC20_LBA_GET_PUNIT(addrf, lba);
+        b->pg = OC20_LBA_GET_SECTR(addrf, lba);
+        b->page_type = 0;
+        prev_pg_addr = cur_pg_addr;
     }
 
-    *nr = secs_idx + 1;
+    req->vec.nr_buckets = b - bucket + 1;
 }
 
 static int oc20_advance_status(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -175,77 +173,56 @@ static int oc20_advance_status(FemuCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     Oc20RwCmd *ocrw = (Oc20RwCmd *)cmd;
     uint8_t opcode = ocrw->opcode;
     uint16_t nlb = le16_to_cpu(ocrw->nlb) + 1;
-    int ch, lun, lunid;
-    int64_t io_done_ts = 0;
-    int64_t total_time_need_to_emulate = 0;
-    int64_t cur_time_need_to_emulate;
-    int num_ch = lns->id_ctrl.geo.num_chk;
-    int num_lun = lns->id_ctrl.geo.num_lun;
     Oc20AddrF *addrf = &lns->lbaf;
+    NvmeAddrBucket *b;
+    NandTimingCmd ncmd = {
+        .type = USER_IO,
+        .stime = req->stime,
+    };
+    uint64_t io_done_ts;
+    uint64_t lba;
     int i;
 
-    int64_t now = req->stime;
-    uint64_t lba;
+    req->expire_time = req->stime;
 
     /* Erase */
     if (opcode == OC20_CMD_VECT_ERASE) {
-        /* FIXME: vector erase */
+        ncmd.op = NAND_ERASE;
         for (i = 0; i < nlb; i++) {
-            lba = ((uint64_t *)req->slba)[i];
-            ch = OC20_LBA_GET_GROUP(addrf, lba);
-            lun = OC20_LBA_GET_PUNIT(addrf, lba);
-            lunid = ch * num_ch + lun;
-
-            int64_t ts = advance_chip_timestamp(n, lunid, now, opcode, 0);
-            if (ts > req->expire_time) {
-                req->expire_time = ts;
+            lba = req->vec.lbal[i];
+            ncmd.ch = OC20_LBA_GET_GROUP(addrf, lba);
+            ncmd.lun = OC20_LBA_GET_PUNIT(addrf, lba);
+            ncmd.stime = req->stime;
+
+            io_done_ts = nand_timing_advance(&n->nand_timing, &ncmd);
+            if (io_done_ts > req->expire_time) {
+                req->expire_time = io_done_ts;
             }
         }
 
         return 0;
     }
 
-    int secs_idx = -1;
-    int si = 0;
-    int nb_secs_to_one_chip = 0;
-
-    Oc20AddrBucket addr_bucket[max_sec_per_rq];
-    oc20_parse_lba_list(n, ns, cmd, req, addr_bucket, &secs_idx);
+    oc20_parse_lba_list(n, ns, req);
 
     /* Read & Write */
     assert(opcode == NVME_CMD_READ || opcode == OC20_CMD_VECT_READ ||
            opcode == NVME_CMD_WRITE || opcode == OC20_CMD_VECT_WRITE);
-    assert(secs_idx > 0);
-    for (i = 0; i < secs_idx; i++) {
-        lba = ((uint64_t *)(req->slba))[si];
-        nb_secs_to_one_chip = addr_bucket[i].cnt;
-        si += nb_secs_to_one_chip;
-
-        ch = addr_bucket[i].ch;
-        lun = addr_bucket[i].lun;
-        lunid = ch * num_lun + lun;
-
-        io_done_ts = 0;
-        int64_t chnl_end_ts, chip_end_ts;
-        if (req->is_write) {
-            /* Write data needs to be transferred through the channel first */
-            chnl_end_ts = advance_channel_timestamp(n, ch, now, opcode);
-            /* Then issue NAND Program to the target flash chip */
-            io_done_ts = advance_chip_timestamp(n, lunid, chnl_end_ts, opcode, 0);
-        } else {
-            chip_end_ts = advance_chip_timestamp(n, lunid, now, opcode, 0);
-            io_done_ts = advance_channel_timestamp(n, ch, chip_end_ts, opcode);
-        }
-
-        /* Coperd: the time need to emulate is (io_done_ts - now) */
-        cur_time_need_to_emulate = io_done_ts - now;
-        if (cur_time_need_to_emulate > total_time_need_to_emulate) {
-            total_time_need_to_emulate = cur_time_need_to_emulate;
+    assert(req->vec.nr_buckets > 0);
+    ncmd.op = req->is_write ? NAND_WRITE : NAND_READ;
+    for (i = 0; i < req->vec.nr_buckets; i++) {
+        b = &req->vec.bucket[i];
+        ncmd.ch = b->ch;
+        ncmd.lun = b->lun;
+        ncmd.page_type = b->page_type;
+        ncmd.stime = req->stime;
+
+        io_done_ts = nand_timing_advance(&n->nand_timing, &ncmd);
+        if (io_done_ts > req->expire_time) {
+            req->expire_time = io_done_ts;
         }
     }
 
-    req->expire_time = now + total_time_need_to_emulate;
-
     return 0;
 }
 
@@ -721,7 +698,7 @@ static uint16_t oc20_rw(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req, bool vector
 
     req->predef = 0;
     req->nlb = nlb;
-    req->slba = (uint64_t)g_malloc0(sizeof(uint64_t) * nlb);
+    req->slba = (uint64_t)req->vec.lbal;
     req->is_write = oc20_rw_is_write(req) ? true : false;
 
     if (vector) {
@@ -739,13 +716,12 @@ static uint16_t oc20_rw(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req, bool vector
 
     err = oc20_rw_check_vector_req(n, cmd, req);
     if (err) {
-        goto fail_free;
+        return err;
     }
 
     if (nvme_map_prp(&req->qsg, &req->iov, prp1, prp2, nlb << lbads, n)) {
         femu_err("%s,malformed prp\n", __func__);
-        err = NVME_INVALID_FIELD | NVME_DNR;
-        goto fail_free;
+        return NVME_INVALID_FIELD | NVME_DNR;
     }
 
     uint64_t aio_sector_list[OC20_CMD_MAX_LBAS];
@@ -763,13 +739,7 @@ static uint16_t oc20_rw(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req, bool vector
         oc20_advance_wp(n, ns, ((uint64_t *)req->slba)[0], nlb, req);
     }
 
-    g_free((void *)req->slba);
-
     return NVME_SUCCESS;
-
-fail_free:
-    g_free((void *)req->slba);
-    return err;
 }
 
 static uint16_t oc20_identify(FemuCtrl *n, NvmeCmd *cmd)
@@ -795,11 +765,15 @@ static uint16_t oc20_erase(FemuCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     uint32_t nlb = le16_to_cpu(dm->nlb) + 1;
     int i;
 
+    if (nlb > OC20_CMD_MAX_LBAS) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
     req->nlb = nlb;
-    req->slba = (uint64_t)g_malloc0(nlb * sizeof(uint64_t));
+    req->slba = (uint64_t)req->vec.lbal;
 
     if (nlb > 1) {
-        nvme_addr_read(n, lbal, (void *) req->slba, nlb * sizeof(void *));
+        nvme_addr_read(n, lbal, (void *) req->slba, nlb * sizeof(uint64_t));
     } else {
         ((uint64_t *)req->slba)[0] = lbal;
     }
@@ -1310,44 +1284,24 @@ static void oc20_set_ctrl_str(FemuCtrl *n)
     nvme_set_ctrl_name(n, vocssd20_mn, vocssd20_sn, &fsid_voc20);
 }
 
-static void oc20_release_locks(FemuCtrl *n)
-{
-    int ret;
-    int i;
-
-    for (i = 0; i < FEMU_MAX_NUM_CHNLS; i++) {
-        ret = pthread_spin_destroy(&n->chnl_locks[i]);
-        assert(ret == 0);
-    }
-
-    for (i = 0; i < FEMU_MAX_NUM_CHIPS; i++) {
-        ret = pthread_spin_destroy(&n->chip_locks[i]);
-        assert(ret == 0);
-    }
-}
-
 static int oc20_init_misc(FemuCtrl *n)
 {
-    int ret;
-    int i;
+    Oc20Namespace *lns = n->namespaces[0].state;
+    Oc20IdGeo *geo = &lns->id_ctrl.geo;
+    NandTimingParams tp = {
+        .nchs        = geo->num_grp,
+        .luns_per_ch = geo->num_lun,
+        .pls_per_lun = 1,
+        .plane_level = false,
+        .shared      = true,
+    };
 
 	set_latency(n);
+    init_nand_flash(n);
 
-    for (i = 0; i < FEMU_MAX_NUM_CHNLS; i++) {
-        n->chnl_next_avail_time[i] = 0;
-
-        /* FIXME: Can we use PTHREAD_PROCESS_PRIVATE here? */
-        ret = pthread_spin_init(&n->chnl_locks[i], PTHREAD_PROCESS_SHARED);
-        assert(ret == 0);
-    }
-
-    for (i = 0; i < FEMU_MAX_NUM_CHIPS; i++) {
-        n->chip_next_avail_time[i] = 0;
-
-        /* FIXME: Can we use PTHREAD_PROCESS_PRIVATE here? */
-        ret = pthread_spin_init(&n->chip_locks[i], PTHREAD_PROCESS_SHARED);
-        assert(ret == 0);
-    }
+    /* array and channel transfer latencies of the flash type */
+    nand_timing_flash_params(&tp, n->flash_type);
+    nand_timing_init(&n->nand_timing, &tp);
 
     return 0;
 }
@@ -1358,6 +1312,9 @@ static void oc20_init(FemuCtrl *n, Error **errp)
     oc20_set_ctrl_str(n);
     oc20_init_namespaces(n, errp);
 
+    n->vec_max_secs = OC20_CMD_MAX_LBAS;
+    n->vec_meta_size = 0;
+
     oc20_init_misc(n);
 }
 
@@ -1370,7 +1327,7 @@ static void oc20_exit(FemuCtrl *n)
         oc20_free_namespace(n, ns);
     }
 
-    oc20_release_locks(n);
+    nand_timing_exit(&n->nand_timing);
 }
 
 int nvme_register_ocssd20(FemuCtrl *n)
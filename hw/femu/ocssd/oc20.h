@@ -235,14 +235,6 @@ typedef struct Oc20Namespace {
     Oc20CS *chunk_info;
 } Oc20Namespace;
 
-typedef struct Oc20AddrBucket {
-    int  ch;
-    int  lun;
-    int  pg;
-    uint8_t page_type;
-    int  cnt;
-} Oc20AddrBucket;
-
 typedef struct NvmeRequest NvmeRequest;
 typedef struct FemuCtrl FemuCtrl;
 
@@ -32,74 +32,398 @@ void set_latency(FemuCtrl *n)
     }
 }
 
+void nand_timing_init(NandTiming *t, const NandTimingParams *p)
+{
+    int nr_dies = p->nchs * p->luns_per_ch;
+    int ret;
+
+    t->p = *p;
+    t->clock = NULL;
+    if (t->p.sched < 0 || t->p.sched >= NAND_NR_SCHED ||
+        (t->p.sched != NAND_SCHED_FIFO && t->p.plane_level)) {
+        femu_err("Unsupported die scheduler %d, using FIFO\n", t->p.sched);
+        t->p.sched = NAND_SCHED_FIFO;
+    }
+
+    t->ch = g_malloc0(sizeof(NandChannel) * p->nchs);
+    for (int i = 0; i < p->nchs; i++) {
+        ret = pthread_spin_init(&t->ch[i].lock, PTHREAD_PROCESS_PRIVATE);
+        assert(ret == 0);
+    }
+
+    t->die = g_malloc0(sizeof(NandDie) * nr_dies);
+    for (int i = 0; i < nr_dies; i++) {
+        NandDie *die = &t->die[i];
+
+        die->pl_next_avail_time = g_malloc0(sizeof(uint64_t) * p->pls_per_lun);
+        if (t->p.sched != NAND_SCHED_FIFO) {
+            for (int c = 0; c < NAND_NR_CLASSES; c++) {
+                die->cq[c].seg = g_malloc0(sizeof(NandSeg) * NAND_SCHED_QDEPTH);
+            }
+        }
+        ret = pthread_spin_init(&die->lock, PTHREAD_PROCESS_PRIVATE);
+        assert(ret == 0);
+    }
+    t->stats_stime = nand_timing_now(t);
+}
+
+void nand_timing_exit(NandTiming *t)
+{
+    int nr_dies = t->p.nchs * t->p.luns_per_ch;
+
+    for (int i = 0; i < t->p.nchs; i++) {
+        pthread_spin_destroy(&t->ch[i].lock);
+    }
+    for (int i = 0; i < nr_dies; i++) {
+        pthread_spin_destroy(&t->die[i].lock);
+        g_free(t->die[i].pl_next_avail_time);
+        for (int c = 0; c < NAND_NR_CLASSES; c++) {
+            g_free(t->die[i].cq[c].seg);
+        }
+    }
+    g_free(t->ch);
+    g_free(t->die);
+    t->ch = NULL;
+    t->die = NULL;
+}
+
+/* Fill in the page-type latencies of @flash_type from nand_flash_timing */
+void nand_timing_flash_params(NandTimingParams *p, int flash_type)
+{
+    assert(flash_type > 0 && flash_type < MAX_FLASH_TYPE);
+
+    for (int i = 0; i < MAX_FLASH_TYPE; i++) {
+        p->pg_rd_lat[i] = nand_flash_timing.pg_rd_lat[flash_type][i];
+        p->pg_wr_lat[i] = nand_flash_timing.pg_wr_lat[flash_type][i];
+    }
+    p->blk_er_lat = nand_flash_timing.blk_er_lat[flash_type];
+    p->ch_xfer_lat = nand_flash_timing.chnl_pg_xfer_lat[flash_type];
+}
+
+static inline int64_t nand_timing_lat(NandTiming *t, NandTimingCmd *cmd)
+{
+    if (cmd->slc) {
+        switch (cmd->op) {
+        case NAND_READ:
+            return t->p.slc_rd_lat;
+        case NAND_WRITE:
+            return t->p.slc_wr_lat;
+        case NAND_ERASE:
+            return t->p.slc_er_lat;
+        }
+    }
+
+    switch (cmd->op) {
+    case NAND_READ:
+        return t->p.pg_rd_lat[cmd->page_type];
+    case NAND_WRITE:
+        return t->p.pg_wr_lat[cmd->page_type];
+    case NAND_ERASE:
+        return t->p.blk_er_lat;
+    default:
+        femu_err("Unsupported NAND command: 0x%x\n", cmd->op);
+        return 0;
+    }
+}
+
+/* Move one page over channel @ch, no earlier than @at */
+static uint64_t nand_timing_xfer(NandTiming *t, int ch, uint64_t at)
+{
+    NandChannel *chnl = &t->ch[ch];
+    uint64_t stime;
+
+    if (!t->p.ch_xfer_lat) {
+        return at;
+    }
+
+    if (t->p.shared) {
+        pthread_spin_lock(&chnl->lock);
+    }
+    stime = (chnl->next_avail_time < at) ? at : chnl->next_avail_time;
+    chnl->next_avail_time = stime + t->p.ch_xfer_lat;
+    at = chnl->next_avail_time;
+    if (t->p.shared) {
+        pthread_spin_unlock(&chnl->lock);
+    }
+
+    return at;
+}
+
 /*
- * TODO: should be independent from different FEMU modes
+ * Default suspend policy: a read arriving while a program or erase is running
+ * suspends it (up to max_suspends times per operation), runs right away after
+ * suspend_lat, and the suspended operation finishes late by the read plus
+ * suspend_lat and resume_lat. Reads arriving while the die is already
+ * suspended queue behind the earlier reads without extra overhead.
  */
-int64_t advance_channel_timestamp(FemuCtrl *n, int ch, uint64_t now, int opcode)
+static uint64_t nand_timing_suspend(NandTiming *t, NandDie *die,
+                                    uint64_t *avail, NandTimingCmd *cmd,
+                                    uint64_t stime, int64_t lat)
 {
-    uint64_t start_data_xfer_ts;
-    uint64_t data_ready_ts;
+    NandTimingParams *p = &t->p;
+    uint64_t nand_stime;
 
-    /* TODO: Considering channel-level timing */
-    return now;
+    if (cmd->op != NAND_READ || die->last_op == NAND_READ ||
+        die->last_stime > stime) {
+        /* nothing to preempt, or the op is not running yet */
+        return *avail;
+    }
 
-    pthread_spin_lock(&n->chnl_locks[ch]);
-    if (now < n->chnl_next_avail_time[ch]) {
-        start_data_xfer_ts = n->chnl_next_avail_time[ch];
+    if (stime < die->susp_avail_time) {
+        nand_stime = die->susp_avail_time;
+    } else if (die->nr_suspends < p->max_suspends) {
+        die->nr_suspends++;
+        die->tt_suspends++;
+        nand_stime = stime + p->suspend_lat;
+        *avail += p->suspend_lat + p->resume_lat;
     } else {
-        start_data_xfer_ts = now;
+        return *avail;
     }
 
-    switch (opcode) {
-    case NVME_CMD_OC_READ:
-    case NVME_CMD_OC_WRITE:
-        data_ready_ts = start_data_xfer_ts + n->chnl_pg_xfer_lat_ns * 2;
-        break;
-    case NVME_CMD_OC_ERASE:
-        data_ready_ts = start_data_xfer_ts;
-        break;
-    default:
-        femu_err("opcode=%d\n", opcode);
-        assert(0);
+    die->susp_avail_time = nand_stime + lat;
+    *avail += lat;
+
+    return nand_stime;
+}
+
+static inline int nand_timing_class(NandTimingCmd *cmd)
+{
+    if (cmd->type == GC_IO) {
+        return NAND_CLS_GC;
     }
+    return cmd->op == NAND_READ ? NAND_CLS_USER_READ : NAND_CLS_USER_WRITE;
+}
 
-    n->chnl_next_avail_time[ch] = data_ready_ts;
-    pthread_spin_unlock(&n->chnl_locks[ch]);
+/* Class priorities per scheduler, lower runs first */
+static const int nand_sched_prio[NAND_NR_SCHED][NAND_NR_CLASSES] = {
+    [NAND_SCHED_FIFO]       = { 0, 0, 0 },
+    [NAND_SCHED_READ_FIRST] = { 0, 1, 1 },
+    [NAND_SCHED_GC_LOW]     = { 0, 1, 2 },
+};
 
-    return data_ready_ts;
+static inline NandSeg *nand_cq_seg(NandClassQueue *q, int i)
+{
+    return &q->seg[(q->head + i) % NAND_SCHED_QDEPTH];
 }
 
-int64_t advance_chip_timestamp(FemuCtrl *n, int lunid, uint64_t now, int opcode,
-                               uint8_t page_type)
+/* Drop the ops of @q finished by @now */
+static void nand_cq_expire(NandClassQueue *q, uint64_t now)
 {
-    int64_t lat;
-    int64_t io_done_ts;
+    while (q->cnt && q->seg[q->head].etime <= now) {
+        q->head = (q->head + 1) % NAND_SCHED_QDEPTH;
+        q->cnt--;
+    }
+}
 
-    switch (opcode) {
-    case NVME_CMD_OC_READ:
-    case NVME_CMD_READ:
-        lat = get_page_read_latency(n->flash_type, page_type);
-        break;
-    case NVME_CMD_OC_WRITE:
-    case NVME_CMD_WRITE:
-        lat = get_page_write_latency(n->flash_type, page_type);
-        break;
-    case NVME_CMD_OC_ERASE:
-        lat = get_blk_erase_latency(n->flash_type);
-        break;
-    default:
-        assert(0);
+static void nand_cq_push(NandClassQueue *q, uint64_t stime, uint64_t etime,
+                         int op)
+{
+    NandSeg *seg;
+
+    if (q->cnt == NAND_SCHED_QDEPTH) {
+        /* forget the oldest op, it simply can't be pushed back any more */
+        q->head = (q->head + 1) % NAND_SCHED_QDEPTH;
+        q->cnt--;
+    }
+    seg = nand_cq_seg(q, q->cnt++);
+    seg->stime = stime;
+    seg->etime = etime;
+    seg->op = op;
+    seg->nr_suspends = 0;
+}
+
+/* The op of @q that already started by @arrival and still runs at @at */
+static NandSeg *nand_cq_running(NandClassQueue *q, uint64_t arrival,
+                                uint64_t at)
+{
+    for (int i = 0; i < q->cnt; i++) {
+        NandSeg *seg = nand_cq_seg(q, i);
+
+        if (seg->etime > at) {
+            return seg->stime <= arrival ? seg : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* Push every op of @q not started before @from back by @delta */
+static void nand_cq_shift(NandClassQueue *q, uint64_t from, int64_t delta)
+{
+    for (int i = q->cnt - 1; i >= 0; i--) {
+        NandSeg *seg = nand_cq_seg(q, i);
+
+        if (seg->stime < from) {
+            break;
+        }
+        seg->stime += delta;
+        seg->etime += delta;
+    }
+    if (q->avail > from) {
+        q->avail += delta;
+    }
+}
+
+/*
+ * Priority scheduler, called with the die locked. @cmd, ready at @stime, waits
+ * for the backlog of its own and of higher priority classes, and for a lower
+ * priority op the die is already executing (non-preemptive, except that a read
+ * may suspend a program/erase as in nand_timing_suspend()). Lower priority ops
+ * merely queued are overtaken: they slip by the die time @cmd takes. Their
+ * completion times handed out earlier stay as they are, but everything behind
+ * them on the die sees the delay.
+ */
+static uint64_t nand_timing_sched(NandTiming *t, NandDie *die,
+                                  NandTimingCmd *cmd, uint64_t stime,
+                                  int64_t lat)
+{
+    const int *prio = nand_sched_prio[t->p.sched];
+    int cls = nand_timing_class(cmd);
+    uint64_t nand_stime = stime;
+    int64_t delta = lat;
+    NandClassQueue *busy_q = NULL;
+    NandSeg *busy = NULL;
+
+    for (int c = 0; c < NAND_NR_CLASSES; c++) {
+        NandClassQueue *q = &die->cq[c];
+
+        nand_cq_expire(q, stime);
+        if (prio[c] <= prio[cls] && q->avail > nand_stime) {
+            nand_stime = q->avail;
+        }
+    }
+
+    for (int c = 0; c < NAND_NR_CLASSES && !busy; c++) {
+        if (prio[c] > prio[cls]) {
+            busy_q = &die->cq[c];
+            busy = nand_cq_running(busy_q, stime, nand_stime);
+        }
+    }
+    if (busy) {
+        if (cmd->op == NAND_READ && busy->op != NAND_READ &&
+            busy->nr_suspends < t->p.max_suspends) {
+            busy->nr_suspends++;
+            die->tt_suspends++;
+            nand_stime += t->p.suspend_lat;
+            delta = lat + t->p.suspend_lat + t->p.resume_lat;
+            busy->etime += delta;
+            busy_q->busy_ns += t->p.suspend_lat + t->p.resume_lat;
+        } else {
+            nand_stime = busy->etime;
+        }
+    }
+
+    for (int c = 0; c < NAND_NR_CLASSES; c++) {
+        if (prio[c] > prio[cls]) {
+            nand_cq_shift(&die->cq[c], nand_stime, delta);
+        }
+    }
+
+    nand_cq_push(&die->cq[cls], nand_stime, nand_stime + lat, cmd->op);
+    if (die->cq[cls].avail < nand_stime + lat) {
+        die->cq[cls].avail = nand_stime + lat;
+    }
+    for (int c = 0; c < NAND_NR_CLASSES; c++) {
+        if (die->next_avail_time < die->cq[c].avail) {
+            die->next_avail_time = die->cq[c].avail;
+        }
+    }
+
+    return nand_stime;
+}
+
+/*
+ * Charge @cmd against the channel/die/plane it targets and return the time it
+ * completes
+ */
+uint64_t nand_timing_advance(NandTiming *t, NandTimingCmd *cmd)
+{
+    NandDie *die = nand_timing_die(t, cmd->ch, cmd->lun);
+    int64_t lat = nand_timing_lat(t, cmd) + cmd->xlat;
+    uint64_t *avail;
+    uint64_t stime, nand_stime, nand_etime;
+
+    if (cmd->stime == 0) {
+        cmd->stime = nand_timing_now(t);
+    }
+
+    /* program: transfer data through channel first */
+    stime = cmd->stime;
+    if (cmd->op == NAND_WRITE) {
+        stime = nand_timing_xfer(t, cmd->ch, stime);
     }
 
-    pthread_spin_lock(&n->chip_locks[lunid]);
-    if (now < n->chip_next_avail_time[lunid]) {
-        n->chip_next_avail_time[lunid] += lat;
+    if (t->p.shared) {
+        pthread_spin_lock(&die->lock);
+    }
+    die->cq[nand_timing_class(cmd)].busy_ns += lat;
+    die->cq[nand_timing_class(cmd)].nr_ops++;
+    if (t->p.sched != NAND_SCHED_FIFO) {
+        nand_etime = nand_timing_sched(t, die, cmd, stime, lat) + lat;
+        goto unlock;
+    }
+
+    avail = t->p.plane_level ? &die->pl_next_avail_time[cmd->pl] :
+                               &die->next_avail_time;
+    if (*avail <= stime) {
+        nand_stime = stime;
+    } else if (t->p.max_suspends) {
+        nand_stime = nand_timing_suspend(t, die, avail, cmd, stime, lat);
     } else {
-        n->chip_next_avail_time[lunid] = now + lat;
+        nand_stime = *avail;
+    }
+    nand_etime = nand_stime + lat;
+    if (nand_etime >= *avail) {
+        *avail = nand_etime;
+        die->last_op = cmd->op;
+        die->last_stime = nand_stime;
+        die->nr_suspends = 0;
+    }
+    if (die->next_avail_time < *avail) {
+        die->next_avail_time = *avail;
+    }
+unlock:
+    if (t->p.shared) {
+        pthread_spin_unlock(&die->lock);
     }
-    io_done_ts = n->chip_next_avail_time[lunid];
-    pthread_spin_unlock(&n->chip_locks[lunid]);
 
-    return io_done_ts;
+    /* read: then data transfer through channel */
+    if (cmd->op == NAND_READ) {
+        nand_etime = nand_timing_xfer(t, cmd->ch, nand_etime);
+    }
+
+    return nand_etime;
 }
 
+void nand_timing_reset_stats(NandTiming *t)
+{
+    int nr_dies = t->p.nchs * t->p.luns_per_ch;
+
+    for (int i = 0; i < nr_dies; i++) {
+        for (int c = 0; c < NAND_NR_CLASSES; c++) {
+            t->die[i].cq[c].busy_ns = 0;
+            t->die[i].cq[c].nr_ops = 0;
+        }
+    }
+    t->stats_stime = nand_timing_now(t);
+}
+
+/*
+ * Average share of die time each class used since the last reset. Ops queued
+ * into the future count in full, so a backlogged device may exceed 1.0.
+ */
+void nand_timing_util(NandTiming *t, double util[NAND_NR_CLASSES])
+{
+    int nr_dies = t->p.nchs * t->p.luns_per_ch;
+    uint64_t now = nand_timing_now(t);
+    double span = (double)(now - t->stats_stime) * nr_dies;
+
+    for (int c = 0; c < NAND_NR_CLASSES; c++) {
+        uint64_t busy_ns = 0;
+
+        for (int i = 0; i < nr_dies; i++) {
+            busy_ns += t->die[i].cq[c].busy_ns;
+        }
+        util[c] = span > 0 ? busy_ns / span : 0;
+    }
+}
@@ -1,10 +1,174 @@
 #ifndef __FEMU_TIMING_MODEL
 #define __FEMU_TIMING_MODEL
 
+#include "../nand/nand.h"
+
 typedef struct FemuCtrl FemuCtrl;
 
-int64_t advance_channel_timestamp(FemuCtrl *n, int ch, uint64_t now, int opcode);
-int64_t advance_chip_timestamp(FemuCtrl *n, int lunid, uint64_t now, int opcode,
-                               uint8_t page_type);
+enum {
+    NAND_READ =  0,
+    NAND_WRITE = 1,
+    NAND_ERASE = 2,
+};
+
+enum {
+    USER_IO = 0,
+    GC_IO = 1,
+};
+
+/* Priority classes a die schedules between */
+enum {
+    NAND_CLS_USER_READ  = 0,
+    NAND_CLS_USER_WRITE = 1,
+    NAND_CLS_GC         = 2,
+    NAND_NR_CLASSES     = 3,
+};
+
+/* Die scheduling policies */
+enum {
+    /* every class in arrival order */
+    NAND_SCHED_FIFO       = 0,
+    /* host reads ahead of queued host writes and GC */
+    NAND_SCHED_READ_FIRST = 1,
+    /* host reads, then host writes, GC only gets what is left */
+    NAND_SCHED_GC_LOW     = 2,
+    NAND_NR_SCHED,
+};
+
+/* Ops of one class remembered per die so they can be pushed back */
+#define NAND_SCHED_QDEPTH   (1024)
+
+/*
+ * Unified NAND timing engine shared by the bbssd, ZNS and OCSSD FTLs
+ *
+ * The flash is modelled as channels, dies (LUNs) and planes, each of which is
+ * just a "next available" timestamp. A NAND command occupies its die (or only
+ * its plane, see NandTimingParams.plane_level) for the page-type dependent
+ * array time, and the channel for the page transfer: before the array time for
+ * programs, after it for reads.
+ *
+ * With a priority scheduler (NandTimingParams.sched) each die additionally
+ * keeps one queue per class, so a host read can overtake programs and GC
+ * queued ahead of it instead of serializing in arrival order.
+ */
+typedef struct NandTimingParams {
+    int      nchs;
+    int      luns_per_ch;
+    int      pls_per_lun;
+    /* planes of one die operate independently, otherwise the die is busy */
+    bool     plane_level;
+    /* callers run on more than one thread, serialize on per-die locks */
+    bool     shared;
+
+    /* array latencies in ns, indexed by page type */
+    int64_t  pg_rd_lat[MAX_FLASH_TYPE];
+    int64_t  pg_wr_lat[MAX_FLASH_TYPE];
+    int64_t  blk_er_lat;
+    /* array latencies of blocks run in SLC mode (NandTimingCmd.slc) */
+    int64_t  slc_rd_lat;
+    int64_t  slc_wr_lat;
+    int64_t  slc_er_lat;
+    /* per-page channel transfer in ns, 0 leaves channels out of the model */
+    int64_t  ch_xfer_lat;
+
+    /* program/erase suspend for reads, max_suspends == 0 disables it */
+    int64_t  suspend_lat;
+    int64_t  resume_lat;
+    int      max_suspends;
+
+    /* NAND_SCHED_*, anything but FIFO needs the die (not plane) model */
+    int      sched;
+} NandTimingParams;
+
+typedef struct NandTimingCmd {
+    int      op;         /* NAND_READ / NAND_WRITE / NAND_ERASE */
+    int      type;       /* USER_IO / GC_IO */
+    int      ch;
+    int      lun;
+    int      pl;
+    int      page_type;
+    bool     slc;        /* the block is operated in SLC mode */
+    int64_t  xlat;       /* added to the array time, e.g. by read retries */
+    uint64_t stime;      /* 0 means "now" */
+} NandTimingCmd;
+
+/* One op a die has scheduled and not finished yet */
+typedef struct NandSeg {
+    uint64_t stime;
+    uint64_t etime;
+    int      op;
+    int      nr_suspends;
+} NandSeg;
+
+/* Per-class command queue of a die */
+typedef struct NandClassQueue {
+    /* ring of ops ordered by start time, only kept by priority schedulers */
+    NandSeg  *seg;
+    int      head;
+    int      cnt;
+    /* when the class backlog drains */
+    uint64_t avail;
+
+    /* die time used by the class and ops it issued since the last reset */
+    uint64_t busy_ns;
+    uint64_t nr_ops;
+} NandClassQueue;
+
+typedef struct NandDie {
+    uint64_t next_avail_time;
+    uint64_t *pl_next_avail_time;
+
+    /* last operation queued on the die, i.e. the one ending at next_avail */
+    int      last_op;
+    uint64_t last_stime;
+
+    /* suspensions of last_op so far, and when the reads it let in finish */
+    int      nr_suspends;
+    uint64_t susp_avail_time;
+    uint64_t tt_suspends;
+
+    NandClassQueue cq[NAND_NR_CLASSES];
+
+    pthread_spinlock_t lock;
+} NandDie;
+
+typedef struct NandChannel {
+    uint64_t next_avail_time;
+    pthread_spinlock_t lock;
+} NandChannel;
+
+typedef struct NandTiming NandTiming;
+
+struct NandTiming {
+    NandTimingParams      p;
+    NandChannel           *ch;
+    NandDie               *die;    /* nchs * luns_per_ch, channel major */
+    /* start of the utilization accounting window */
+    uint64_t              stats_stime;
+    /* time source for commands without stime, QEMU_CLOCK_REALTIME if unset */
+    uint64_t              (*clock)(void *opaque);
+    void                  *clock_opaque;
+};
+
+void nand_timing_init(NandTiming *t, const NandTimingParams *p);
+void nand_timing_exit(NandTiming *t);
+void nand_timing_flash_params(NandTimingParams *p, int flash_type);
+uint64_t nand_timing_advance(NandTiming *t, NandTimingCmd *cmd);
+void nand_timing_reset_stats(NandTiming *t);
+void nand_timing_util(NandTiming *t, double util[NAND_NR_CLASSES]);
+
+static inline uint64_t nand_timing_now(NandTiming *t)
+{
+    if (t->clock) {
+        return t->clock(t->clock_opaque);
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+static inline NandDie *nand_timing_die(NandTiming *t, int ch, int lun)
+{
+    return &t->die[ch * t->p.luns_per_ch + lun];
+}
+
 void set_latency(FemuCtrl *n);
 #endif
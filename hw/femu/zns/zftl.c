@@ -21,6 +21,9 @@ void zftl_init(FemuCtrl *n)
 
     qemu_thread_create(&ssd->ftl_thread, "FEMU-FTL-Thread", ftl_thread, n,
                        QEMU_THREAD_JOINABLE);
+    if (femu_thread_pin(&ssd->ftl_thread, &n->ftl_cpuset, -1)) {
+        ftl_err("failed to pin the FTL thread\n");
+    }
 }
 
 static inline struct zns_ch *get_ch(struct zns_ssd *zns, struct ppa *ppa)
@@ -70,50 +73,21 @@ static void zns_advance_write_pointer(struct zns_ssd *zns)
 
 static uint64_t zns_advance_status(struct zns_ssd *zns, struct ppa *ppa,struct nand_cmd *ncmd)
 {
-    int c = ncmd->cmd;
-
-    uint64_t nand_stime;
-    uint64_t req_stime = (ncmd->stime == 0) ? \
-        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) : ncmd->stime;
-
     //plane level parallism
-    struct zns_plane *pl = get_plane(zns, ppa);
-
-    uint64_t lat = 0;
-    int nand_type = get_blk(zns,ppa)->nand_type;
-
-    uint64_t read_delay = zns->timing.pg_rd_lat[nand_type];
-    uint64_t write_delay = zns->timing.pg_wr_lat[nand_type];
-    uint64_t erase_delay = zns->timing.blk_er_lat[nand_type];
-
-    switch (c) {
-    case NAND_READ:
-        nand_stime = (pl->next_plane_avail_time < req_stime) ? req_stime : \
-                     pl->next_plane_avail_time;
-        pl->next_plane_avail_time = nand_stime + read_delay;
-        lat = pl->next_plane_avail_time - req_stime;
-	    break;
-
-    case NAND_WRITE:
-	    nand_stime = (pl->next_plane_avail_time < req_stime) ? req_stime : \
-		            pl->next_plane_avail_time;
-	    pl->next_plane_avail_time = nand_stime + write_delay;
-	    lat = pl->next_plane_avail_time - req_stime;
-	    break;
-
-    case NAND_ERASE:
-        nand_stime = (pl->next_plane_avail_time < req_stime) ? req_stime : \
-                        pl->next_plane_avail_time;
-        pl->next_plane_avail_time = nand_stime + erase_delay;
-        lat = pl->next_plane_avail_time - req_stime;
-        break;
-
-    default:
-        /* To silent warnings */
-        ;
-    }
-
-    return lat;
+    NandTimingCmd tcmd = {
+        .op = ncmd->cmd,
+        .type = ncmd->type,
+        .ch = ppa->g.ch,
+        .lun = ppa->g.fc,
+        .pl = ppa->g.pl,
+        .page_type = 0,
+        .stime = ncmd->stime,
+    };
+    uint64_t nand_etime;
+
+    nand_etime = nand_timing_advance(&zns->nt, &tcmd);
+
+    return nand_etime - tcmd.stime;
 }
 
 static inline bool valid_ppa(struct zns_ssd *zns, struct ppa *ppa)
@@ -315,6 +289,7 @@ static void *ftl_thread(void *arg)
     struct zns_ssd *zns = n->zns;
     NvmeRequest *req = NULL;
     uint64_t lat = 0;
+    int work;
     int rc;
     int i;
 
@@ -327,6 +302,7 @@ static void *ftl_thread(void *arg)
     zns->to_poller = n->to_poller;
 
     while (1) {
+        work = 0;
         for (i = 1; i <= n->nr_pollers; i++) {
             if (!zns->to_ftl[i] || !femu_ring_count(zns->to_ftl[i]))
                 continue;
@@ -337,7 +313,7 @@ static void *ftl_thread(void *arg)
             }
 
             ftl_assert(req);
-            switch (req->cmd.opcode) {
+            switch (req->cmd_opcode) {
                 // Fix bug: zone append not respecting configured delay
                 case NVME_CMD_ZONE_APPEND:
                     /* Fall through */
@@ -362,8 +338,10 @@ static void *ftl_thread(void *arg)
             if (rc != 1) {
                 ftl_err("FTL to_poller enqueue failed\n");
             }
-
+            femu_idle_kick(&n->poller_idle[i]);
+            work++;
         }
+        femu_ftl_idle(n, zns->to_ftl, work);
     }
 
     return NULL;
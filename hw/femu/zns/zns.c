@@ -1217,7 +1217,6 @@ static void zns_init_plane(struct zns_plane *plane,int num_blk,int flash_type)
     for (int i = 0; i < num_blk; i++) {
         zns_init_blk(&plane->blk[i],num_blk,i,flash_type);
     }
-    plane->next_plane_avail_time = 0;
 }
 
 static void zns_init_fc(struct zns_fc *fc,uint8_t num_plane,uint8_t num_blk,int flash_type)
@@ -1239,6 +1238,24 @@ static void zns_init_ch(struct zns_ch *ch, uint8_t num_lun,uint8_t num_plane, ui
     ch->next_ch_avail_time = 0;
 }
 
+static void zns_init_timing(struct zns_ssd *zns)
+{
+    NandTimingParams tp = {
+        .nchs        = zns->num_ch,
+        .luns_per_ch = zns->num_lun,
+        .pls_per_lun = zns->num_plane,
+        .plane_level = true,
+        .shared      = false,
+        /* one-shot programming, a single page type per flash type */
+        .pg_rd_lat   = { [0] = zns->timing.pg_rd_lat[zns->flash_type] },
+        .pg_wr_lat   = { [0] = zns->timing.pg_wr_lat[zns->flash_type] },
+        .blk_er_lat  = zns->timing.blk_er_lat[zns->flash_type],
+        .ch_xfer_lat = 0,
+    };
+
+    nand_timing_init(&zns->nt, &tp);
+}
+
 static void zns_init_params(FemuCtrl *n)
 {
     struct zns_ssd *id_zns;
@@ -1304,6 +1321,8 @@ static void zns_init_params(FemuCtrl *n)
     id_zns->timing.blk_er_lat[TLC] = TLC_BLOCK_ERASE_LATENCY_NS;
     id_zns->timing.blk_er_lat[QLC] = QLC_BLOCK_ERASE_LATENCY_NS;
 
+    zns_init_timing(id_zns);
+
     id_zns->dataplane_started_ptr = &n->dataplane_started;
 
     n->zns = id_zns;
@@ -44,17 +44,6 @@
 #define SRAM_WRITE_LATENCY_NS (1000)
 #define SRAM_READ_LATENCY_NS (1000)
 
-enum {
-    NAND_READ =  0,
-    NAND_WRITE = 1,
-    NAND_ERASE = 2,
-};
-
-enum {
-    USER_IO = 0,
-    GC_IO = 1,
-};
-
 typedef struct QEMU_PACKED NvmeZonedResult {
     uint64_t slba;
 } NvmeZonedResult;
@@ -101,7 +90,6 @@ struct zns_blk {
 
 struct zns_plane{
     struct zns_blk *blk;
-    uint64_t next_plane_avail_time;
 };
 
 struct zns_fc {
@@ -144,6 +132,7 @@ struct zns_ssd {
     struct write_pointer wp;
 
     SSDNandFlashTiming timing; /*Misao: accurate  timing emulation for zns ssd.*/
+    NandTiming nt;             /* per-plane timing state */
     int flash_type;
     uint64_t program_unit;
     uint64_t stripe_unit;